@@ -77,6 +77,13 @@ make -j
 cp -v ./fsme/src/libimachine-dyn.so $dist_dir/lib/libimachine.so
 cp -v ./fsme/src/libimachine-static.a $dist_dir/lib/libimachine.a
 cp -v ../src/fsme/header/fsme.h $dist_dir/include
+cp -v ../src/fsme/header/fsme_arena.h $dist_dir/include
+cp -v ../src/fsme/header/fsme_bump.h $dist_dir/include
+cp -v ../src/fsme/header/fsme_minimize.h $dist_dir/include
+cp -v ../src/fsme/header/fsme_pool.h $dist_dir/include
+cp -v ../src/fsme/header/fsme_flatten.h $dist_dir/include
+cp -v ../src/fsme/header/fsme_registry.h $dist_dir/include
+cp -v ../src/fsme/header/fsme_shm.h $dist_dir/include
 cp -v ./example/imachine_example $dist_dir/bin
 
 cd ..
@@ -7,20 +7,35 @@
  * - Action Registration Mechanism
  * 
  * Limitation:
- * - Shallow History/Deep History not supported
- * - Single-threaded only
- * - Parallel state Machine not supported
+ * - Single-threaded only, except for 
+ *   fsme_postEventConcurrent()
  * ---------------------------------------------------------*/
 #ifndef FSM_H
 #define FSM_H
 
 
+#include <stddef.h>
+
 #include "fsme_defs.h"
 
 
 /* --------------- MACROS --------------- */
 #define FSME_FINAL_STATE_ID -1
 
+/**
+ * Number of priority lanes of the event queue
+ * of an engine.
+ */
+#define FSME_PRIORITY_NUM	4
+
+/**
+ * Number of buckets of a dwell time histogram, see
+ * fsme_getDwellHistogram(). Bucket b counts the times
+ * from 2^b to 2^(b+1) - 1 clock units (bucket 0 also
+ * counts 0).
+ */
+#define FSME_DWELL_BUCKET_NUM	64
+
 
 
 /* ---------- TYPE DEFINITIONS ---------- */
@@ -68,6 +83,29 @@ typedef enum
 	 * Fatal error.
 	 */
 	FSME_ERROR_FATAL,
+
+	/**
+	 * Returned when an action suspended the 
+	 * transition by fsme_suspendTransition().
+	 * The engine stays in the transition until 
+	 * fsme_resumeTransition() is called.
+	 */
+	FSME_ACTION_PENDING,
+
+	/**
+	 * Returned when an event is posted to an engine
+	 * whose transition is suspended. The event is
+	 * processed once the transition is resumed.
+	 */
+	FSME_EVENT_QUEUED,
+
+	/**
+	 * Returned when an event posted to an engine 
+	 * whose transition is suspended is dropped 
+	 * because of its FSM_QUEUE_DROP_DUPLICATE policy,
+	 * or because the queue could not grow.
+	 */
+	FSME_EVENT_DROPPED,
 } fsme_return_t;
 
 
@@ -88,6 +126,136 @@ typedef boolean (* fsme_guardFuncPtr_t)(int id,
 										void* outContext);
 
 
+/**
+ * What a name is given to, see fsme_findSymbol().
+ */
+typedef enum
+{
+	FSME_SYMBOL_STATE = 0,
+	FSME_SYMBOL_TRANSITION,
+	FSME_SYMBOL_EVENT
+} fsme_symbol_kind_t;
+
+
+/**
+ * What a row of fsme_addBindings() registers.
+ */
+typedef enum
+{
+	/**
+	 * an entry action of the machine
+	 */
+	FSME_BIND_MACHINE_ENTRY = 0,
+
+	/**
+	 * an exit action of the machine
+	 */
+	FSME_BIND_MACHINE_EXIT,
+
+	/**
+	 * an entry action of a state
+	 */
+	FSME_BIND_STATE_ENTRY,
+
+	/**
+	 * an exit action of a state
+	 */
+	FSME_BIND_STATE_EXIT,
+
+	/**
+	 * an action of a transition
+	 */
+	FSME_BIND_TRANSITION,
+
+	/**
+	 * the guard of a transition
+	 */
+	FSME_BIND_GUARD
+} fsme_bind_kind_t;
+
+
+/**
+ * A row of fsme_addBindings().
+ */
+typedef struct fsme_binding
+{
+	fsme_bind_kind_t			kind;
+
+	/**
+	 * id of the state or transition, ignored for
+	 * the actions of the machine
+	 */
+	int							id;
+
+	/**
+	 * the action, NULL for FSME_BIND_GUARD
+	 */
+	fsme_func_t					action;
+
+	/**
+	 * the guard for FSME_BIND_GUARD, NULL otherwise
+	 */
+	fsme_guardFuncPtr_t			guard;
+
+	/**
+	 * name of the state or transition, looked up
+	 * instead of the id if not NULL
+	 */
+	const char*					name;
+} fsme_binding_t;
+
+
+/**
+ * How a sub machine is resumed when its state
+ * is entered again.
+ */
+typedef enum
+{
+	/**
+	 * The sub machine starts from its entry state.
+	 */
+	FSM_HISTORY_NONE = 0,
+
+	/**
+	 * The sub machine resumes the state it was in 
+	 * when the state was last exited. Its own sub 
+	 * machines are entered as usual.
+	 */
+	FSM_HISTORY_SHALLOW,
+
+	/**
+	 * Like FSM_HISTORY_SHALLOW, but applies to
+	 * every nested sub machine as well.
+	 */
+	FSM_HISTORY_DEEP
+} fsm_history_t;
+
+
+/**
+ * How an event posted to an engine whose transition
+ * is suspended is queued, see fsme_suspendTransition().
+ */
+typedef enum
+{
+	/**
+	 * Every posted event is queued.
+	 */
+	FSM_QUEUE_ALWAYS = 0,
+
+	/**
+	 * The event is dropped if it is already queued.
+	 */
+	FSM_QUEUE_DROP_DUPLICATE,
+
+	/**
+	 * If the event is already queued, the queued one
+	 * keeps its place but takes the contexts of the 
+	 * latest one.
+	 */
+	FSM_QUEUE_COALESCE
+} fsm_queue_policy_t;
+
+
 /**
  * The state type
  */
@@ -101,6 +269,31 @@ typedef struct fsm_state
 	 * NULL if the state is not a sub machine. 
 	 */
 	struct fsm_machine const * const	subMachine;		
+
+	/**
+	 * History of the sub machine. Only used if
+	 * the state is a sub machine; may be omitted
+	 * (FSM_HISTORY_NONE).
+	 */
+	const fsm_history_t			history;
+
+	/**
+	 * Orthogonal regions of the state: sub machines 
+	 * that are all active while the state is. NULL 
+	 * if the state has none. A state has either a 
+	 * sub machine or regions, not both.
+	 */
+	struct fsm_machine const * const * const	regionTable;
+
+	/**
+	 * number of regions, at most FSME_REGION_MAX
+	 */
+	const int					regionNum;
+
+	/**
+	 * name of the state, may be omitted (NULL)
+	 */
+	const char* const			name;
 } fsm_state_t;
 
 
@@ -112,6 +305,11 @@ typedef struct fsm_transition
 	const int					id;
 	const int					sourceStateId;
 	const int					targetStateId;
+
+	/**
+	 * name of the transition, may be omitted (NULL)
+	 */
+	const char* const			name;
 } fsm_transition_t;
 
 
@@ -126,6 +324,28 @@ typedef struct fsm_trigger
 } fsm_trigger_t;
 
 
+/** 
+ * The event type
+ */
+typedef struct fsm_event
+{
+	const int					id;
+	const fsm_queue_policy_t	policy;
+
+	/**
+	 * Priority lane of the event when it is queued,
+	 * from 0 (the default) to FSME_PRIORITY_NUM - 1.
+	 * Lanes with a higher priority are drained first.
+	 */
+	const int					priority;
+
+	/**
+	 * name of the event, may be omitted (NULL)
+	 */
+	const char* const			name;
+} fsm_event_t;
+
+
 /** 
  * Type definition of the State Machine 
  */
@@ -154,7 +374,8 @@ typedef struct fsm_machine
 	const int					transitionNum;
 
 	/** 
-	 * number of events
+	 * number of events, whose ids are 0 to 
+	 * eventNum - 1 unless sparseEvents is set
 	 */
 	const int					eventNum;
 
@@ -174,12 +395,160 @@ typedef struct fsm_machine
 	 * the init state 
 	 */
 	const int					entryStateId;
+
+	/**
+	 * event table, may be omitted (NULL). 
+	 * Only events that do not use the default 
+	 * settings or have a name need to be put into
+	 * this table.
+	 */
+	fsm_event_t const * const	eventTable;
+
+	/**
+	 * number of entries in the event table
+	 */
+	const int					eventTableNum;
+
+	/**
+	 * TRUE if the event ids are any ints (e.g. the
+	 * codes of a protocol). The ids are then those of
+	 * the trigger and event tables, eventNum at most,
+	 * and are hashed when the machine is compiled.
+	 * Such machines cannot be flattened or minimized.
+	 */
+	const boolean				sparseEvents;
 } fsm_machine_t;
 
 
 typedef struct fsme_engine* fsme_engine_ptr_t;
+typedef struct fsme_machine* fsme_machine_ptr_t;
+typedef struct fsme_arena* fsme_arena_ptr_t;
+
+
+/**
+ * Handle of a suspended transition, returned by
+ * fsme_suspendTransition(). The engine is NULL if
+ * the transition could not be suspended.
+ */
+typedef struct fsme_pending
+{
+	fsme_engine_ptr_t			engine;
+	unsigned int				generation;
+} fsme_pending_t;
+
+
+/**
+ * Prototype of an observer function. The id is the
+ * id of the state or transition, or the event.
+ */
+typedef void (* fsme_observerFuncPtr_t)(fsme_engine_ptr_t engine,
+										int id,
+										void* context);
+
+
+/**
+ * Observer of engines, set with fsme_setObserver() or
+ * fsme_setEngineObserver(). Functions that are not
+ * needed may be NULL.
+ */
+typedef struct fsme_observer
+{
+	/**
+	 * A state has been entered and its entry actions
+	 * run, before its sub machines are entered
+	 */
+	fsme_observerFuncPtr_t		onEnterState;
+
+	/**
+	 * A state is left: after its exit actions (and
+	 * those of the transition leaving it), or when
+	 * its engine is exited
+	 */
+	fsme_observerFuncPtr_t		onExitState;
+
+	/**
+	 * A transition is taken, after its guard passed
+	 */
+	fsme_observerFuncPtr_t		onTransition;
+
+	/**
+	 * An event is unknown or triggers no transition
+	 * in the active state
+	 */
+	fsme_observerFuncPtr_t		onInvalidEvent;
+
+	/**
+	 * The guard of a transition failed
+	 */
+	fsme_observerFuncPtr_t		onGuardFailure;
+
+	/**
+	 * passed to every function
+	 */
+	void*						context;
+} fsme_observer_t;
+
+
+/**
+ * Prototype of a clock for dwell time tracking, see
+ * fsme_enableDwellTracking(). It returns a time that 
+ * does not go back, in any unit.
+ */
+typedef unsigned long long (* fsme_clockFuncPtr_t)(void);
+
+
+/**
+ * Prototype of the function that maps an active state
+ * the new version of a machine does not have to one
+ * it has, see fsme_migrateEngine(). It returns the id
+ * of the state in the new version, or an id it does
+ * not have to refuse the migration.
+ */
+typedef int (* fsme_stateMapFuncPtr_t)(int stateId, 
+									   void* context);
+
+
+/**
+ * Prototype of the allocation function of an 
+ * allocator. The block must be aligned to align, 
+ * a power of 2 no larger than FSME_CACHE_LINE_SIZE.
+ * It returns NULL if the memory is exhausted.
+ */
+typedef void* (* fsme_allocFuncPtr_t)(size_t size,
+									  size_t align,
+									  void* context);
+
+
+/**
+ * Prototype of the free function of an allocator.
+ * The size is the one the block was allocated with.
+ */
+typedef void (* fsme_deallocFuncPtr_t)(void* mem,
+									   size_t size,
+									   void* context);
+
+
+/**
+ * Allocator of the memory of engines: the engines,
+ * their tables, event queues, action nodes and
+ * action arrays, and of compiled machines. See 
+ * fsme_setAllocator() and fsme_newEngineWithAllocator().
+ * Scratch buffers freed before a call returns come
+ * from the heap.
+ */
+typedef struct fsme_allocator
+{
+	fsme_allocFuncPtr_t			alloc;
+	fsme_deallocFuncPtr_t		dealloc;
+
+	/**
+	 * passed to both functions
+	 */
+	void*						context;
+} fsme_allocator_t;
 
 struct fsm_machine;
+struct fsme_machine;
 struct fsme_engine;
 struct fsme_state;
 
@@ -190,11 +559,114 @@ extern const fsm_state_t FSM_FINAL_STATE;
 
 
 /* ------------- FUNCTION PROTOTYPES ------------- */
+/**
+ * Compile a state machine.
+ *
+ * The compiled machine holds the dispatch tables
+ * of the machine (and of its sub machines) and can
+ * be shared by any number of engines.
+ *
+ * @Return
+ * The pointer to the compiled machine, or NULL if
+ * the machine is empty, too large or refers to
+ * unknown states, transitions or events, or if it
+ * could not be allocated.
+ *
+ * @param
+ * stateMachine		- The state machine to be compiled
+ */
+fsme_machine_ptr_t
+fsme_compileMachine(const fsm_machine_t* stateMachine);
+
+
+/**
+ * Release a compiled state machine. 
+ *
+ * The machine is freed once it is released and
+ * all engines created from it are deleted.
+ *
+ * @Return
+ *
+ * @param
+ * machine		- The compiled machine to be released
+ */
+void
+fsme_releaseMachine(fsme_machine_ptr_t machine);
+
+
+/**
+ * New a state machine engine instance from a 
+ * compiled machine.
+ *
+ * @Return
+ * The pointer to the new engine instance, NULL if
+ * it could not be allocated.
+ *
+ * @param
+ * machine		- The compiled machine from which
+ *                the engine is to be created
+ */
+fsme_engine_ptr_t
+fsme_newEngineFromMachine(fsme_machine_ptr_t machine);
+
+
+/**
+ * New a state machine engine instance from a 
+ * compiled machine, with the engine, its sub engines
+ * and all their memory allocated from an allocator 
+ * (e.g. a bump arena, see fsme_bump.h).
+ *
+ * @Return
+ * The pointer to the new engine instance, NULL if
+ * it could not be allocated.
+ *
+ * @param
+ * machine		- The compiled machine from which
+ *                the engine is to be created
+ * allocator	- The allocator, NULL for the one set
+ *				  with fsme_setAllocator(). It must
+ *				  outlive the engine.
+ */
+fsme_engine_ptr_t
+fsme_newEngineWithAllocator(fsme_machine_ptr_t machine,
+							const fsme_allocator_t* allocator);
+
+
+/**
+ * Set the allocator of the engines and machines
+ * created from now on, other than those given an
+ * allocator or an arena of their own. Engines and
+ * machines keep the allocator they were created 
+ * with. Must not be called while engines are 
+ * created by other threads.
+ *
+ * @Return
+ *
+ * @param
+ * allocator	- The allocator, NULL for the C library
+ *				  (malloc/free). It must outlive the
+ *				  engines and machines allocated from it.
+ */
+void
+fsme_setAllocator(const fsme_allocator_t* allocator);
+
+
+/**
+ * Get the allocator set with fsme_setAllocator().
+ *
+ * @Return
+ * The allocator, never NULL.
+ */
+const fsme_allocator_t*
+fsme_getAllocator(void);
+
+
 /**
  * New an state machine engine instance.
  *
  * @Return
- * The pointer to the new engine instance.
+ * The pointer to the new engine instance, NULL if
+ * the machine could not be compiled or allocated.
  *
  * @param
  * stateMachine		- The state machine from which
@@ -204,6 +676,60 @@ fsme_engine_ptr_t
 fsme_newEngine(const fsm_machine_t* stateMachine);
 
 
+/**
+ * New a state machine engine instance from a 
+ * configured one. The new engine uses the machine,
+ * actions, guards and observer of the prototype. 
+ * The action lists are shared until one of the 
+ * engines changes them. The clone is allocated 
+ * like the prototype, from its allocator.
+ *
+ * @Return
+ * The pointer to the new engine instance. NULL if 
+ * the prototype is a sub engine, or is cloned with 
+ * its state while it processes a transition, or if
+ * the clone could not be allocated.
+ *
+ * @param
+ * prototype		- The engine to be cloned
+ * withState		- TRUE to start the clone in the
+ *					  active states and history of the
+ *					  prototype (queued events are not
+ *					  copied), FALSE for a clone that
+ *					  is not started
+ */
+fsme_engine_ptr_t
+fsme_cloneEngine(fsme_engine_ptr_t prototype,
+				 boolean withState);
+
+
+/**
+ * New a number of state machine engine instances 
+ * from a compiled machine at once, e.g. when taking 
+ * over a shard of sessions.
+ *
+ * The engines, their sub engines and their tables are
+ * allocated in one slab (with the allocator set with
+ * fsme_setAllocator()), which is freed when the last
+ * of them is deleted. They can be deleted one by one,
+ * in any order, or with fsme_deleteEngines().
+ *
+ * @Return
+ * The number of engines created: num, or 0 if the 
+ * slab could not be allocated.
+ *
+ * @param
+ * machine		- The compiled machine from which
+ *                the engines are to be created
+ * num			- The number of engines
+ * engines		- Receives the new engines
+ */
+int
+fsme_newEngines(fsme_machine_ptr_t machine,
+				int num,
+				fsme_engine_ptr_t* engines);
+
+
 /**
  * Delete new-ed state machine engine.
  *
@@ -216,6 +742,27 @@ void
 fsme_deleteEngine(fsme_engine_ptr_t engine);
 
 
+/**
+ * Delete a number of state machine engines, e.g.
+ * those created with fsme_newEngines().
+ *
+ * As the machine counts its engines without atomic
+ * operations, it must not run at the same time as
+ * another call creating or deleting engines of the
+ * same machine.
+ *
+ * @Return
+ *
+ * @param 
+ * engines		- The engines to be deleted, NULL
+ *				  entries are skipped
+ * num			- The number of engines
+ */
+void
+fsme_deleteEngines(fsme_engine_ptr_t* engines,
+				   int num);
+
+
 /** 
  * Start the state machine engine.
  *
@@ -251,6 +798,81 @@ fsme_shutdownEngine(fsme_engine_ptr_t engine,
 				 void* outContext);
 
 
+/** 
+ * Return an engine and its sub engines to the state 
+ * of a new engine, without running any action and 
+ * without freeing the engine: the active states, 
+ * history, suspended transition and queued events 
+ * are dropped.
+ *
+ * @Return
+ * FSME_OK, or FSME_FORBIDDEN if the engine is a sub
+ * engine or is processing an event (e.g. reset from
+ * one of its actions).
+ *
+ * @param
+ * engine		- The engine to be reset
+ * keepActions	- TRUE to keep the registered actions,
+ *				  guards and observers, FALSE to
+ *				  clear them
+ */
+fsme_return_t
+fsme_resetEngine(fsme_engine_ptr_t engine,
+				 boolean keepActions);
+
+
+/** 
+ * Move a running engine to a new version of its 
+ * machine, e.g. one compiled from an updated
+ * definition. The engine keeps its address; the next
+ * events are processed with the tables of the new 
+ * version.
+ *
+ * The active states and the history are mapped by id.
+ * An active state the new version does not have is
+ * mapped with mapFunc; a history state it does not
+ * have is dropped. The sub engines of a state move
+ * region by region if the state has as many regions
+ * in both versions; the active states must. The 
+ * actions, guards and observers are carried over by
+ * id, and queued events are queued again (those the
+ * new version does not know are dropped). No action 
+ * is run.
+ *
+ * The old tables are handed back as a retired engine,
+ * not started. Threads in fsme_postEventConcurrent()
+ * or fsme_getStatePath() that read them before the
+ * migration retry with the new ones, and may still
+ * read the old ones until they return: the retired
+ * engine is deleted with fsme_deleteEngine() once 
+ * they all have (e.g. after every such thread went
+ * through a quiescent point).
+ *
+ * Like fsme_lockEngine(), it waits for the threads 
+ * in fsme_postEventConcurrent(); it must not be called
+ * from an action of the engine.
+ *
+ * @Return
+ * The retired engine. NULL if the engine is a sub
+ * engine or processes an event, if a transition is 
+ * suspended, if an active state cannot be mapped or 
+ * if the new tables could not be allocated; the 
+ * engine is unchanged then.
+ *
+ * @param
+ * engine		- The root engine to be migrated
+ * machine		- The new version of its machine
+ * mapFunc		- Maps the active states the new
+ *				  version does not have, may be NULL
+ * context		- Passed to mapFunc
+ */
+fsme_engine_ptr_t
+fsme_migrateEngine(fsme_engine_ptr_t engine,
+				   fsme_machine_ptr_t machine,
+				   fsme_stateMapFuncPtr_t mapFunc,
+				   void* context);
+
+
 /** 
  * Post event to a state machine engine.
  *
@@ -270,6 +892,171 @@ fsme_postEvent(fsme_engine_ptr_t engine,
 				 void* outContext);
 
 
+/**
+ * Post event to a state machine engine that may be
+ * driven by several threads at the same time.
+ *
+ * A transition without guard and actions, whose 
+ * source and target states have no exit respectively 
+ * entry actions and no sub engines, and whose target 
+ * state is not final, is committed with a single 
+ * compare-and-swap of the active state. Any other 
+ * event is processed by fsme_postEvent() with the 
+ * engine locked, see fsme_lockEngine().
+ *
+ * Only root engines can be driven this way, and their
+ * actions and guards must not be changed meanwhile.
+ * Like fsme_postEvent(), it returns FSME_ENGINE_FROZEN
+ * if called by an action of the engine or of one of
+ * its sub engines.
+ *
+ * @Return
+ * Refer to fsme_return_t.
+ * 
+ * @param
+ * engine		- The engine the event posted to
+ * event		- The event to be posted.
+ * inContext	- The input context
+ * outContext	- The output context
+ */
+fsme_return_t
+fsme_postEventConcurrent(fsme_engine_ptr_t engine,
+						 int event,
+						 const void* inContext,
+						 void* outContext);
+
+
+/**
+ * Lock an engine driven by fsme_postEventConcurrent(),
+ * waiting for the lock if needed. Any other call on 
+ * the engine (e.g. fsme_resumeTransition() or 
+ * fsme_shutdownEngine()) must be made with the engine 
+ * locked.
+ *
+ * @Return
+ *
+ * @param
+ * engine		- The engine to be locked
+ */
+void
+fsme_lockEngine(fsme_engine_ptr_t engine);
+
+
+/**
+ * Unlock an engine locked by fsme_lockEngine().
+ *
+ * @Return
+ *
+ * @param
+ * engine		- The engine to be unlocked
+ */
+void
+fsme_unlockEngine(fsme_engine_ptr_t engine);
+
+
+/**
+ * Suspend the transition being processed, e.g. to
+ * wait for I/O without blocking the thread.
+ *
+ * May only be called from an exit action of the 
+ * source state, an action of the transition or an 
+ * entry action of the target state, while the engine 
+ * processes the transition. The remaining actions are 
+ * not run and fsme_postEvent() returns 
+ * FSME_ACTION_PENDING. Events posted to the engine 
+ * until the transition is resumed are queued, as with
+ * fsme_queueEvent().
+ *
+ * Shutting down or exiting the engine cancels the
+ * suspended transition and drops the queued events.
+ * The transitions of fsme_broadcastEvent() cannot be
+ * suspended.
+ *
+ * @Return
+ * The handle to pass to fsme_resumeTransition().
+ * Its engine is NULL if the transition cannot be
+ * suspended.
+ * 
+ * @param
+ * engine		- The engine processing the transition
+ */
+fsme_pending_t
+fsme_suspendTransition(fsme_engine_ptr_t engine);
+
+
+/**
+ * Resume a suspended transition: run its remaining
+ * exit, transition and entry actions, then the queued
+ * events as fsme_processEvents() does.
+ *
+ * @Return
+ * FSME_OK if the transition and the queued events 
+ * were processed, FSME_ACTION_PENDING if one of them 
+ * was suspended again (the events after it stay 
+ * queued), FSME_FORBIDDEN if the handle is not the 
+ * one of the current suspension.
+ * 
+ * @param
+ * pending		- The handle of the suspension
+ * inContext	- The input context of the remaining
+ *				  actions
+ * outContext	- The output context of the remaining
+ *				  actions
+ */
+fsme_return_t
+fsme_resumeTransition(fsme_pending_t pending,
+					  const void* inContext,
+					  void* outContext);
+
+
+/**
+ * Queue an event to a state machine engine, to be
+ * processed by fsme_processEvents().
+ *
+ * The event goes to the priority lane and follows the
+ * queue policy declared for it in the event table of 
+ * the machine. Its contexts must stay valid until it 
+ * is processed. Exiting or shutting down the engine 
+ * drops the queued events. This may also be called
+ * from an action of the engine itself.
+ *
+ * @Return
+ * FSME_EVENT_QUEUED or FSME_EVENT_DROPPED (also if
+ * the queue could not grow), FSME_INVALID_EVENT for 
+ * an unknown event.
+ * 
+ * @param
+ * engine		- The engine the event is queued to
+ * event		- The event to be queued.
+ * inContext	- The input context
+ * outContext	- The output context
+ */
+fsme_return_t
+fsme_queueEvent(fsme_engine_ptr_t engine,
+				int event,
+				const void* inContext,
+				void* outContext);
+
+
+/**
+ * Post the queued events of a state machine engine,
+ * highest priority lane first and in queueing order 
+ * within a lane, until the queue is empty.
+ *
+ * @Return
+ * FSME_OK if the queue was drained, 
+ * FSME_ACTION_PENDING if the transition of an event
+ * was suspended (the remaining events are processed
+ * when it is resumed), FSME_ENGINE_FROZEN if the
+ * engine is processing actions.
+ * 
+ * @param
+ * engine		- The engine whose events are processed
+ */
+fsme_return_t
+fsme_processEvents(fsme_engine_ptr_t engine);
+
+
 /** 
  * Get the current state of a state machine engine.
  *
@@ -285,6 +1072,53 @@ struct fsme_state*
 fsme_getCurrentState(fsme_engine_ptr_t engine);
 
 
+/** 
+ * Get the id of the current state of a state 
+ * machine engine.
+ *
+ * @Return
+ * The id of the current state, or 
+ * FSME_FINAL_STATE_ID if the engine is not started.
+ * 
+ * @param
+ * engine		- The state machine engine
+ */
+int
+fsme_getCurrentStateId(fsme_engine_ptr_t engine);
+
+
+/**
+ * Get the ids of the active states of an engine and
+ * of its active sub engines, e.g. from a thread other
+ * than the one posting events to the engine.
+ *
+ * The states are read without locking and without
+ * slowing down the posting thread: the read is retried
+ * until no event was processed by the root engine
+ * while it was done, so the path is always one the
+ * engine has been in. The engine must not be deleted
+ * meanwhile. Called from an action or an observer of
+ * the engine, it reads the states as they are.
+ *
+ * The path lists the active state of the engine,
+ * followed by the path of each of its active sub
+ * engines (one per region), depth first.
+ *
+ * @Return
+ * The number of ids stored, 0 if the engine is
+ * not started.
+ *
+ * @param
+ * engine		- The state machine engine
+ * stateIds		- Receives the ids of the states
+ * maxNum		- Number of ids stateIds can hold
+ */
+int
+fsme_getStatePath(fsme_engine_ptr_t engine,
+				  int* stateIds,
+				  int maxNum);
+
+
 /**
  * Get the parent engine of a state machine engine.
  *
@@ -317,16 +1151,72 @@ fsme_getSubEngine(fsme_engine_ptr_t parent,
 				  int stateId);
 
 
+/**
+ * Get the engine of a region of a state.
+ *
+ * @Return
+ * The pointer to the region engine, or NULL if 
+ * the given state does not have such a region.
+ * A sub machine is region 0 of its state.
+ * 
+ * @param
+ * parent		- The engine the state belongs to.
+ * stateId		- The id of the state.
+ * region		- The index of the region.
+ */
+fsme_engine_ptr_t
+fsme_getRegionEngine(fsme_engine_ptr_t parent, 
+					 int stateId,
+					 int region);
+
+
+/** 
+ * Post an event to all regions of the current
+ * state of a state machine engine in one pass.
+ *
+ * Transitions are selected and their guards 
+ * checked in every region first. Then the source 
+ * states of all regions are exited, the transition 
+ * actions run and the target states entered, each 
+ * step in region order.
+ *
+ * While the event is processed, the regions are 
+ * frozen like an engine processing an event, and 
+ * their transitions cannot be suspended (see 
+ * fsme_suspendTransition()).
+ *
+ * @Return
+ * FSME_OK if at least one region took a transition,
+ * FSME_TRANSITION_FAILURE if all guards failed,
+ * FSME_INVALID_EVENT if no region accepts the event.
+ * Otherwise refer to fsme_return_t.
+ * 
+ * @param
+ * engine		- The engine whose regions the event 
+ *				  is posted to
+ * event		- The event to be posted.
+ * inContext	- The input context
+ * outContext	- The output context
+ */
+fsme_return_t
+fsme_broadcastEvent(fsme_engine_ptr_t engine,
+					int event,
+					const void* inContext,
+					void* outContext);
+
+
 /**
  * Register machine entry action. 
  *
  * @Return
+ * TRUE if the action is registered, FALSE if the
+ * id is unknown or the action could not be allocated.
  *
  * @param
  * engine		- The engine to be registered to
  * action		- The action to be registered
  */
-void
+boolean
 fsme_addMachineEntryAction(fsme_engine_ptr_t engine, 
 						   fsme_func_t action);
 
@@ -335,12 +1225,14 @@ fsme_addMachineEntryAction(fsme_engine_ptr_t engine,
  * Register machine exit action. 
  *
  * @Return
+ * TRUE if the action is registered, FALSE if the
+ * id is unknown or the action could not be allocated.
  *
  * @param
  * engine		- The engine to be registered to
  * action		- The action to be registered
  */
-void
+boolean
 fsme_addMachineExitAction(fsme_engine_ptr_t engine, 
 						  fsme_func_t action);
 
@@ -377,13 +1269,15 @@ fsme_removeMachineExitAction(fsme_engine_ptr_t engine,
  * Register state entry action. 
  *
  * @Return
+ * TRUE if the action is registered, FALSE if the
+ * id is unknown or the action could not be allocated.
  *
  * @param
  * engine		- The engine to be registered to
  * stateId		- The id of the state
  * action		- The action to be registered
  */
-void
+boolean
 fsme_addStateEntryAction(fsme_engine_ptr_t engine, 
 						 int stateId, 
 						 fsme_func_t action);
@@ -409,13 +1303,15 @@ fsme_removeStateEntryAction(fsme_engine_ptr_t engine,
  * Register state exit action. 
  *
  * @Return
+ * TRUE if the action is registered, FALSE if the
+ * id is unknown or the action could not be allocated.
  *
  * @param
  * engine		- The engine to be registered to
  * stateId		- The id of the state
  * action		- The action to be registered
  */
-void
+boolean
 fsme_addStateExitAction(fsme_engine_ptr_t engine, 
 						int stateId, 
 						fsme_func_t action);
@@ -441,13 +1337,15 @@ fsme_removeStateExitAction(fsme_engine_ptr_t engine,
  * Register transition action. 
  *
  * @Return
+ * TRUE if the action is registered, FALSE if the
+ * id is unknown or the action could not be allocated.
  *
  * @param
  * engine		- The engine to be registered to
  * transitionId	- The id of the transition
  * action		- The action to be registered
  */
-void
+boolean
 fsme_addTransitionAction(fsme_engine_ptr_t engine, 
 						 int transitionId, 
 						 fsme_func_t action);
@@ -486,4 +1384,184 @@ fsme_setGuard(fsme_engine_ptr_t engine,
 			  int transitionId, 
 			  fsme_guardFuncPtr_t guardFunc);
 
+
+/**
+ * Register actions and guards from a table, as if 
+ * fsme_add*Action() and fsme_setGuard() were called 
+ * for each row in order. The new actions are 
+ * allocated in one block. Rows with a NULL action
+ * are skipped. Sub engines have tables of their own.
+ *
+ * @Return
+ * The number of actions and guards registered, or -1 
+ * if a row has an unknown kind, id or name or the 
+ * actions could not be allocated, in which case 
+ * nothing is registered.
+ *
+ * @param
+ * engine		- The state machine engine
+ * bindings		- The rows
+ * num			- The number of rows
+ */
+int
+fsme_addBindings(fsme_engine_ptr_t engine,
+				 const fsme_binding_t* bindings,
+				 int num);
+
+
+/**
+ * Set the observer of all engines that do not have
+ * one of their own. It can be set or cleared while 
+ * engines run; the observer is not copied and must 
+ * stay valid while it is set. With FSME_DEBUG, an 
+ * observer printing to stdout is set by default.
+ *
+ * @Return
+ *
+ * @param
+ * observer		- The observer, or NULL to remove it
+ */
+void
+fsme_setObserver(const fsme_observer_t* observer);
+
+
+/**
+ * Set the observer of an engine and its sub engines,
+ * overriding the one set by fsme_setObserver(). 
+ * Events posted with fsme_postEventConcurrent() are
+ * not committed with a CAS while an engine is 
+ * observed, so that every transition is reported.
+ *
+ * @Return
+ *
+ * @param
+ * engine		- The engine to be observed
+ * observer		- The observer, or NULL to use the
+ *				  one set by fsme_setObserver()
+ */
+void
+fsme_setEngineObserver(fsme_engine_ptr_t engine,
+					   const fsme_observer_t* observer);
+
+
+/**
+ * Track how long the engines of a compiled machine 
+ * stay in each state: every engine takes the time
+ * when it enters a state, and adds the time spent in
+ * it to a histogram of the state when it leaves it.
+ * The histograms are shared by all engines of the 
+ * machine and by its sub machines' engines for their
+ * own states. Tracking cannot be turned off; events
+ * posted with fsme_postEventConcurrent() are not 
+ * committed with a CAS while it is on.
+ *
+ * Must not be called by several threads at once, but
+ * may be while engines of the machine take events.
+ * States entered before are not counted until they
+ * are entered again.
+ *
+ * @Return
+ * TRUE if tracking is on, FALSE if the histograms 
+ * could not be allocated.
+ *
+ * @param
+ * machine		- The compiled machine
+ * clock		- The clock, NULL for a monotonic clock
+ *				  in nanoseconds
+ */
+boolean
+fsme_enableDwellTracking(fsme_machine_ptr_t machine,
+						 fsme_clockFuncPtr_t clock);
+
+
+/**
+ * Read the dwell time histogram of a state, while the
+ * engines keep taking events. The counts are read one
+ * by one, so they may be off by the states left while
+ * they are read.
+ *
+ * @Return
+ * The number of times the state was left, -1 if the
+ * state is unknown or tracking is off.
+ *
+ * @param
+ * engine		- Any engine of the machine (a sub engine
+ *				  for the states of a sub machine)
+ * stateId		- The id of the state
+ * buckets		- Receives FSME_DWELL_BUCKET_NUM counts,
+ *				  or NULL
+ * total		- Receives the sum of the times spent in
+ *				  the state, or NULL
+ */
+long long
+fsme_getDwellHistogram(fsme_engine_ptr_t engine,
+					   int stateId,
+					   unsigned long long* buckets,
+					   unsigned long long* total);
+
+
+/**
+ * Find the id of a state, transition or event by the
+ * name it has in the machine definition. The names
+ * are hashed when the machine is compiled; look them
+ * up once and keep the ids for the fsme_add*() and 
+ * fsme_post*() functions.
+ *
+ * @Return
+ * TRUE if the name was found
+ *
+ * @param
+ * engine		- Any engine of the machine (a sub engine
+ *				  for the names of a sub machine)
+ * kind			- What the name is given to
+ * name			- The name
+ * id			- Receives the id
+ */
+boolean
+fsme_findSymbol(fsme_engine_ptr_t engine,
+				fsme_symbol_kind_t kind,
+				const char* name,
+				int* id);
+
+
+/**
+ * Get the name of a state, transition or event, 
+ * e.g. for an observer.
+ *
+ * @Return
+ * The name, NULL if it has none
+ *
+ * @param
+ * engine		- Any engine of the machine
+ * kind			- What the id is of
+ * id			- The id
+ */
+const char*
+fsme_getSymbolName(fsme_engine_ptr_t engine,
+				   fsme_symbol_kind_t kind,
+				   int id);
+
+
+/**
+ * Post an event by its name, as fsme_postEvent().
+ * The name is looked up on every call, so that 
+ * events posted often should be looked up once with
+ * fsme_findSymbol() instead.
+ *
+ * @Return
+ * As fsme_postEvent(), FSME_INVALID_EVENT if the
+ * name is unknown
+ *
+ * @param
+ * engine		- The state machine engine
+ * name			- The name of the event
+ * inContext	- The input context
+ * outContext	- The output context
+ */
+fsme_return_t
+fsme_postEventByName(fsme_engine_ptr_t engine,
+					 const char* name,
+					 const void* inContext,
+					 void* outContext);
+
 #endif
@@ -8,9 +8,8 @@
  * 
  * Limitation:
  * - Guard function not supported
- * - Shallow History/Deep History not supported
- * - Single-threaded only
- * - Parallel state Machine not supported
+ * - Single-threaded only, except for 
+ *   fsme_postEventConcurrent()
  * ---------------------------------------------------------*/
 #ifndef FSME_H
 #define FSME_H
@@ -24,15 +23,332 @@ typedef struct fsme_action* fsme_action_ptr_t;
 
 
 
+/* --------------- MACROS --------------- */
+/**
+ * Index value meaning "no state/transition/event".
+ */
+#define FSME_INDEX_NONE			((fsme_index_t)0xFFFF)
+
+/**
+ * Largest number of states, transitions or events
+ * a machine can have.
+ */
+#define FSME_INDEX_MAX			0xFFFE
+
+/**
+ * Largest number of states or transitions a machine
+ * can have and still use 8-bit indexes.
+ */
+#define FSME_INDEX_MAX_NARROW	0xFE
+
+/**
+ * Largest number of regions a state can have.
+ */
+#define FSME_REGION_MAX			32
+
+/**
+ * Initial number of events a priority lane of the
+ * event queue can hold. It grows as needed.
+ */
+#define FSME_QUEUE_INIT_SIZE	4
+
+/**
+ * Alignment of the blocks allocated for anything
+ * but engines, which are aligned to cache lines.
+ */
+#define FSME_ALLOC_ALIGN		sizeof(void*)
+
+/**
+ * Layout of the state word of an engine: the index
+ * of the active state, a bit set while a thread holds
+ * the engine, a bit set while the engine does not take
+ * events directly (e.g. a transition is suspended), a
+ * bit set if the engine has a parent, and a generation
+ * counted up whenever the engine is unlocked.
+ */
+#define FSME_STATE_MASK			0xFFFFu
+#define FSME_STATE_LOCKED		0x10000u
+#define FSME_STATE_FROZEN		0x20000u
+#define FSME_STATE_SUB			0x40000u
+#define FSME_STATE_GENERATION	0x80000u
+
+/**
+ * What of a root engine lies in the slab of its cold
+ * part: the engine itself, and its cold part, tables
+ * and sub engines. A migrated engine and its retired
+ * version may each hold one of them.
+ */
+#define FSME_SLAB_LINE			0x1u
+#define FSME_SLAB_TABLES		0x2u
+
+/**
+ * Accessors of the compiled machine
+ */
+#define fsmeMachineGetIndex(machine, table, i)	\
+	((fsme_index_t)((1 == (machine)->indexWidth ? \
+	((const unsigned char*)(table))[i] : \
+	((const unsigned short*)(table))[i]) - 1))
+
+#define fsmeMachineSetIndex(machine, table, i, index)	\
+	(1 == (machine)->indexWidth ? \
+	(((unsigned char*)(table))[i] = (unsigned char)((index) + 1)) : \
+	(((unsigned short*)(table))[i] = (unsigned short)((index) + 1)))
+
+#define fsmeMachineFindTransition(machine, state, event)	\
+	fsmeMachineGetIndex(machine, (machine)->dispatchTable, \
+	(size_t)(state) * (machine)->eventNum + (event))
+
+#define fsmeMachineGetSourceState(machine, transition)	\
+	fsmeMachineGetIndex(machine, (machine)->sourceState, transition)
+
+#define fsmeMachineGetTargetState(machine, transition)	\
+	fsmeMachineGetIndex(machine, (machine)->targetState, transition)
+
+#define fsmeMachineGetStateId(machine, state)	\
+	((machine)->stateIds[state])
+
+#define fsmeMachineGetTransitionId(machine, transition)	\
+	((machine)->transitionIds[transition])
+
+#define fsmeMachineStateIsFinal(machine, state)	\
+	(FSME_FINAL_STATE_ID == fsmeMachineGetStateId(machine, state))
+
+#define fsmeMachineGetStateHistory(machine, state)	\
+	((fsm_history_t)(machine)->stateHistory[state])
+
+#define fsmeMachineGetEventPolicy(machine, event)	\
+	((fsm_queue_policy_t)(machine)->eventPolicy[event])
+
+#define fsmeMachineGetEventPriority(machine, event)	\
+	((machine)->eventPriority[event])
+
+#define fsmeMachineGetRegions(machine, state)	\
+	((machine)->regions[state])
+
+#define fsmeMachineGetRegionNum(machine, state)	\
+	(NULL == fsmeMachineGetRegions(machine, state) ? 0 : \
+	fsmeMachineGetRegions(machine, state)->regionNum)
+
+/**
+ * Allocate or free a block with an allocator
+ */
+#define fsmeAllocate(allocator, size, align)	\
+	((allocator)->alloc((size), (align), (allocator)->context))
+
+#define fsmeDeallocate(allocator, mem, size)	\
+	do { if (NULL != (mem)) (allocator)->dealloc((mem), (size), \
+	(allocator)->context); } while (0)
+
+
+
 /* ---------- TYPE DEFINITIONS ---------- */
 /**
- * The engine state type
+ * Index of a state, a transition or an event
+ * within a compiled machine.
  */
-typedef struct fsme_state
+typedef unsigned short fsme_index_t;
+
+
+/**
+ * The compiled sub machines of a state. A state
+ * with a sub machine has one region; a state with
+ * orthogonal regions has one per region.
+ */
+typedef struct fsme_regions
 {
-	int							id; 
-	boolean						isFinal;
+	/**
+	 * number of regions
+	 */
+	fsme_index_t				regionNum;
+
+	/**
+	 * number of entries in eventMask, the largest
+	 * event number of the regions, or 0 if one of
+	 * them has sparse event ids
+	 */
+	fsme_index_t				eventNum;
+
+	/**
+	 * compiled machine of each region
+	 */
+	struct fsme_machine**		machines;
+
+	/**
+	 * Combined dispatch table of the regions.
+	 * Bit r of eventMask[event] is set if region r
+	 * has a transition triggered by the event. NULL
+	 * if every region is to be looked up.
+	 */
+	unsigned int*				eventMask;
+
+	/**
+	 * size of the block holding the regions
+	 */
+	size_t						size;
+} fsme_regions_t;
+
+
+/**
+ * An entry of the hash table of the names of a
+ * compiled machine
+ */
+typedef struct fsme_symbol
+{
+	/**
+	 * the name in the machine definition, NULL if
+	 * the entry is free
+	 */
+	const char*					name;
+	unsigned int				hash;
+	fsme_symbol_kind_t			kind;
+	int							id;
+} fsme_symbol_t;
+
+
+/**
+ * The dwell time histograms of the states of a 
+ * compiled machine, see fsme_enableDwellTracking().
+ */
+typedef struct fsme_dwell
+{
+	fsme_clockFuncPtr_t			clock;
+
+	/**
+	 * For each state, FSME_DWELL_BUCKET_NUM counts
+	 * then the sum of the times, updated atomically
+	 */
+	unsigned long long*			counters;
+} fsme_dwell_t;
+
+
+/**
+ * The compiled state machine.
+ *
+ * It is built once from a fsm_machine_t and shared
+ * by all engines created from it. Every table here
+ * is indexed by position, not by id, and stores
+ * indexes on indexWidth bytes (1 if the machine has
+ * no more than FSME_INDEX_MAX_NARROW states and
+ * transitions, 2 otherwise). Stored values are
+ * index + 1 so that 0 means "none".
+ */
+typedef struct fsme_machine
+{
+	int							id;
+
+	/**
+	 * number of engines and parent machines
+	 * referring to this machine
+	 */
+	int							refCount;
+
+	/**
+	 * width in bytes of the indexes in the tables
+	 */
+	unsigned char				indexWidth;
+
+	fsme_index_t				stateNum;
+	fsme_index_t				transitionNum;
+	fsme_index_t				eventNum;
+
+	/**
+	 * index of the init state
+	 */
+	fsme_index_t				entryState;
+
+	/**
+	 * Dispatch table of stateNum x eventNum entries.
+	 * Entry [state * eventNum + event] is the
+	 * transition the event triggers in the state.
+	 */
+	const void*					dispatchTable;
+
+	/**
+	 * Minimal perfect hash of sparse event ids: the
+	 * id of each event index, and the seed of each of
+	 * the eventBucketNum buckets. NULL if the event 
+	 * ids are the indexes.
+	 */
+	const int*					eventKeys;
+	const unsigned int*			eventSeeds;
+	fsme_index_t				eventBucketNum;
+
+	/**
+	 * Hash table of the names of the states, 
+	 * transitions and events, of symbolMask + 1 
+	 * entries. NULL if none has a name.
+	 */
+	const fsme_symbol_t*		symbols;
+	unsigned int				symbolMask;
+
+	/**
+	 * source and target state of each transition
+	 */
+	const void*					sourceState;
+	const void*					targetState;
+
+	/**
+	 * id of each state and of each transition
+	 */
+	const int*					stateIds;
+	const int*					transitionIds;
+
+	/**
+	 * history kind (fsm_history_t) of each state
+	 */
+	const unsigned char*		stateHistory;
+
+	/**
+	 * queue policy (fsm_queue_policy_t) of each event
+	 */
+	const unsigned char*		eventPolicy;
+
+	/**
+	 * priority lane of each event
+	 */
+	const unsigned char*		eventPriority;
+
+	/**
+	 * Compiled sub machine or regions of each state.
+	 * NULL if the state has none.
+	 */
+	fsme_regions_t**			regions;
+
+	/**
+	 * the machine definition it was compiled from
+	 */
+	const fsm_machine_t*		definition;
+
+	/**
+	 * A definition built by the library (e.g. a
+	 * flattened machine) with the allocator of the
+	 * machine, and its size; freed with the machine.
+	 * NULL if the definition belongs to the user.
+	 */
+	fsm_machine_t*				ownDefinition;
+	size_t						ownDefinitionSize;
+
+	/**
+	 * the allocator of the machine and of the
+	 * regions, and the size of the machine block
+	 */
+	const fsme_allocator_t*		allocator;
+	size_t						size;
 
+	/**
+	 * dwell time histograms, NULL unless tracked
+	 */
+	fsme_dwell_t*				dwell;
+} fsme_machine_t;
+
+
+/**
+ * The engine state type. It only holds what is
+ * specific to an engine instance; the rest is in
+ * the compiled machine.
+ */
+typedef struct fsme_state
+{
 	/**
 	 * The header of the entry action list
 	 */
@@ -44,7 +360,8 @@ typedef struct fsme_state
 	fsme_action_ptr_t 			exitAction;
 
 	/** 
-	 * The pointer to the sub engine. 
+	 * The pointer to the sub engine, or to the first
+	 * of the region engines, which are contiguous.
 	 * NULL if the state is not a sub machine. 
 	 */
 	fsme_engine_ptr_t			subEngine; 
@@ -56,8 +373,6 @@ typedef struct fsme_state
  */
 typedef struct fsme_transition
 {
-	int							id;
-
 	/**
 	 * The guard function
 	 */
@@ -67,92 +382,236 @@ typedef struct fsme_transition
 	 * The header of the transition action list
 	 */
 	fsme_action_ptr_t			action;
-	fsme_state_t*				sourceState;
-	fsme_state_t*				targetState;
+
+	/**
+	 * The actions the transition runs, fused into one
+	 * array. Built when the transition is taken, NULL
+	 * until then.
+	 */
+	struct fsme_chain*			chain;
 } fsme_transition_t;
 
 
 /**
- * The engine trigger type
+ * The action node type
  */
-typedef struct 
+typedef struct fsme_action
 {
+	fsme_func_t action;
+
 	/**
-	 * The event id. Event id must start from 0
-	 * and grows incrementally.
+	 * id the action is called with: the id of the
+	 * state, transition or machine it was added to
 	 */
-	int							eventId;
-	unsigned int				transitionNum;
+	int id;
 
+	/**
+	 * number of engines sharing the list the node
+	 * heads (see fsme_cloneEngine()), 1 if the list
+	 * is not shared. A shared list is copied before
+	 * it is changed. Engines of a pool share lists
+	 * across threads, so it is changed atomically.
+	 */
+	unsigned int refCount;
 
 	/**
-	 * The transition list of the trigger.
-	 * Each element of the list is a pointer
-	 * to the transition.
+	 * the block the node was allocated in by
+	 * fsme_addBindings(), NULL if it was allocated
+	 * on its own
 	 */
-	fsme_transition_t**			transitions;
-} fsme_trigger_t;
+	struct fsme_action_block* block;
+	struct fsme_action * next;
+} fsme_action_t;
 
 
 /**
- * Type definition of the state machine engine 
+ * Action nodes allocated at once. The block is freed
+ * with the last of its nodes.
  */
-typedef struct fsme_engine
+typedef struct fsme_action_block
 {
+	/**
+	 * the nodes, following the header
+	 */
+	fsme_action_t*				nodes;
+
+	/**
+	 * number of nodes not freed yet
+	 */
+	int							nodeNum;
+
+	/**
+	 * size the block was allocated with
+	 */
+	size_t						size;
+} fsme_action_block_t;
+
+
+/**
+ * An action of a fused action array
+ */
+typedef struct fsme_chain_entry
+{
+	fsme_func_t					action;
 	int							id;
+} fsme_chain_entry_t;
 
+
+/**
+ * The exit actions of the source state, the actions
+ * of the transition and the entry actions of the 
+ * target state, in the order they are run. The 
+ * entries follow the header in the same block.
+ */
+typedef struct fsme_chain
+{
 	/**
-	 * engine state table 
+	 * chainGeneration of the engine it was built at
 	 */
-	fsme_state_t*				stateTable;
+	unsigned int				generation;
 
-	/** 
-	 * number of engine states 
+	/**
+	 * index of the first action of the transition
 	 */
-	int							stateNum;
+	int							actionStart;
 
-	/** 
-	 * engine transition table 
+	/**
+	 * index of the first entry action of the target
 	 */
-	fsme_transition_t*			transitionTable;
+	int							enterStart;
+
+	/**
+	 * number of entries
+	 */
+	int							num;
+
+	fsme_chain_entry_t*			entries;
+} fsme_chain_t;
+
+
+/**
+ * The step of a transition an engine is in.
+ */
+typedef enum
+{
+	FSME_PHASE_NONE = 0,
 
 	/** 
-	 * number of engine transitions
+	 * running the exit actions of the source state
+	 * and the actions of the transition
 	 */
-	int							transitionNum;
+	FSME_PHASE_EXIT,
 
 	/** 
-	 * Engine trigger table. 
-	 * Triggers must be put into this table 
-	 * in order of its event id. 
+	 * running the entry actions of the target state
 	 */
-	fsme_trigger_t*				triggerTable;
+	FSME_PHASE_ENTER,
 
 	/** 
-	 * number of events
+	 * running the actions of a transition taken by
+	 * fsme_broadcastEvent(), which cannot be suspended
 	 */
-	int							eventNum;
+	FSME_PHASE_BROADCAST
+} fsme_phase_t;
+
+
+/**
+ * Where a transition continues when it is resumed.
+ */
+typedef struct fsme_continuation
+{
+	/**
+	 * index of the transition
+	 */
+	fsme_index_t				transition;
+
+	/**
+	 * fsme_phase_t of the transition, 
+	 * FSME_PHASE_NONE if no transition is processed
+	 */
+	unsigned char				phase;
 
 	/**
-	 * is a sub state machine or not
+	 * has an action suspended the transition
 	 */
-	boolean						isSubStateMachine;
-	
+	boolean						suspended;
+
+	/**
+	 * number of actions of the transition already run
+	 */
+	int							actionCount;
+
+	/**
+	 * incremented on every suspension, so that a
+	 * stale handle cannot resume a later one
+	 */
+	unsigned int				generation;
+} fsme_continuation_t;
+
+
+/**
+ * A queued event.
+ */
+typedef struct fsme_queued_event
+{
+	int							event;
+	const void*					inContext;
+	void*						outContext;
+} fsme_queued_event_t;
+
+
+/**
+ * Ring buffer of queued events, one per priority lane.
+ */
+typedef struct fsme_event_queue
+{
+	fsme_queued_event_t*		events;
+	int							capacity;
+	int							head;
+	int							count;
+} fsme_event_queue_t;
+
+
+/**
+ * The cold part of the state machine engine. It holds 
+ * everything that is only needed when the engine is 
+ * created, started, shut down, deleted or configured, 
+ * and is kept out of line of the engine itself.
+ */
+typedef struct fsme_engine_cold
+{
 	/**
 	 * Parent state machine engine. NULL if 
 	 * the engine does not have a parent.
 	 */
 	struct fsme_engine*			parent;
 
-	/** 
-	 * the init engine state 
+	/**
+	 * The allocator of the engine and of all its
+	 * memory, shared with its sub engines.
 	 */
-	fsme_state_t *				entryState;
+	const fsme_allocator_t*		allocator;
 
-	/** 
-	 * the current active state 
+	/**
+	 * The slab the engine, its sub engines and
+	 * their tables are carved from if it was 
+	 * created by fsme_newEngines(), NULL if they
+	 * are allocated on their own.
 	 */
-	fsme_state_t *				activeState;
+	struct fsme_engine_slab*	slab;
+
+	/**
+	 * FSME_SLAB_xxx: what of the engine is carved
+	 * from the slab. A root engine with any holds
+	 * one reference to the slab.
+	 */
+	unsigned int				slabParts;
+
+	/**
+	 * index of the state the engine was in when
+	 * it was last exited, FSME_INDEX_NONE if none
+	 */
+	fsme_index_t				historyState;
 
 	/**
 	 * the header of the entry action list 
@@ -164,11 +623,98 @@ typedef struct fsme_engine
 	 */
 	fsme_action_ptr_t			exitAction;
 
+	/**
+	 * the transition being processed
+	 */
+	fsme_continuation_t			pending;
+
+	/**
+	 * incremented whenever a state or transition action
+	 * is added or removed, so that the fused action
+	 * arrays of the transitions are rebuilt
+	 */
+	unsigned int				chainGeneration;
+
+	/**
+	 * clock of the dwell time tracking when the
+	 * active state was entered, 0 if not taken
+	 */
+	unsigned long long			enteredAt;
+
+	/**
+	 * Events queued by fsme_queueEvent() or posted 
+	 * while the transition is suspended, one ring 
+	 * buffer per priority lane.
+	 */
+	fsme_event_queue_t			queue[FSME_PRIORITY_NUM];
+} fsme_engine_cold_t;
+
+
+/**
+ * Type definition of the state machine engine.
+ *
+ * The engine only holds the fields fsme_postEvent()
+ * touches and is aligned to a cache line, so that
+ * dispatching an event reads one line of the engine.
+ * Everything else lives in the cold part.
+ */
+typedef struct fsme_engine
+{
+	/** 
+	 * the compiled machine
+	 */
+	FSME_CACHE_ALIGNED
+	const fsme_machine_t*		machine;
+
+	/** 
+	 * engine state table, in the order of
+	 * the machine states
+	 */
+	fsme_state_t*				stateTable;
+
+	/** 
+	 * engine transition table, in the order of
+	 * the machine transitions
+	 */
+	fsme_transition_t*			transitionTable;
+
+	/**
+	 * State word: index of the current active state,
+	 * FSME_INDEX_NONE if the engine is not started,
+	 * in the FSME_STATE_MASK bits, and the bits used
+	 * by fsme_postEventConcurrent()
+	 */
+	unsigned int				activeState;
+
+	/** 
+	 * Sequence of a root engine, odd while an event is
+	 * processed, see fsme_getStatePath(). Unused in
+	 * sub engines.
+	 */
+	unsigned int				sequence;
+
 	/** 
 	 * is event disabled or not (internal use only) 
 	 */
 	boolean						eventDisabled;
 
+	/**
+	 * the cold part of the engine
+	 */
+	fsme_engine_cold_t*			cold;
+
+	/**
+	 * observer set by fsme_setEngineObserver(), NULL
+	 * if the global one is used
+	 */
+	const fsme_observer_t*		observer;
+
+	/**
+	 * Tag of the thread processing an event while the
+	 * sequence is odd, NULL otherwise. Unused in sub
+	 * engines.
+	 */
+	const void*					writer;
 } fsme_engine_t;
 
 
@@ -187,6 +733,8 @@ typedef struct fsme_engine
  * However, if the user choose to create an engine
  * by other means (e.g. from the stack), he should 
  * call this function to avoid possible memory leak.
+ * Such an engine must be aligned to FSME_CACHE_LINE_SIZE
+ * and provide its own cold part and tables.
  * 
  * @return
  *
@@ -0,0 +1,174 @@
+/* ---------------------------------------------------------
+ * Engine Arena
+ *
+ * Characteristics:
+ * - One mapped region engines and all their memory
+ *   are allocated from, see fsme_newEngineInArena()
+ * - Optionally bound to a NUMA node
+ * - Optionally backed by huge pages
+ *
+ * Limitation:
+ * - Requires POSIX threads and mmap
+ * - NUMA binding and huge pages on Linux only
+ * ---------------------------------------------------------*/
+#ifndef FSME_ARENA_H
+#define FSME_ARENA_H
+
+
+#include <stddef.h>
+
+#include "fsm.h"
+
+
+/* --------------- MACROS --------------- */
+/**
+ * Node passed to fsme_newArena() for an arena
+ * not bound to a NUMA node.
+ */
+#define FSME_ARENA_NO_NODE			(-1)
+
+/**
+ * Largest NUMA node an arena can be bound to, plus 1.
+ */
+#define FSME_ARENA_MAX_NODE			1024
+
+/**
+ * Flags of fsme_newArena()
+ */
+/* ask for transparent huge pages */
+#define FSME_ARENA_HUGE_PAGES		0x1
+/* use explicit (reserved) huge pages */
+#define FSME_ARENA_HUGETLB			0x2
+
+
+
+/* ------------- FUNCTION PROTOTYPES ------------- */
+/**
+ * New an arena.
+ *
+ * The memory is mapped at once and binding it to the
+ * node is best effort: if the system does not support
+ * it, the arena is not bound.
+ *
+ * @Return
+ * The pointer to the new arena, NULL if the memory
+ * could not be mapped (e.g. FSME_ARENA_HUGETLB
+ * without reserved huge pages).
+ *
+ * @param
+ * size			- Size of the arena in bytes
+ * node			- NUMA node to bind the memory to,
+ *				  or FSME_ARENA_NO_NODE
+ * flags		- FSME_ARENA_* flags, or 0
+ */
+fsme_arena_ptr_t
+fsme_newArena(size_t size,
+			  int node,
+			  unsigned int flags);
+
+
+/**
+ * Delete an arena. The engines allocated from it
+ * must have been deleted before.
+ *
+ * @Return
+ *
+ * @param
+ * arena		- The arena to be deleted
+ */
+void
+fsme_deleteArena(fsme_arena_ptr_t arena);
+
+
+/**
+ * Allocate a block from an arena. Blocks are aligned
+ * to FSME_CACHE_LINE_SIZE.
+ *
+ * @Return
+ * The pointer to the block, NULL if the arena is full.
+ *
+ * @param
+ * arena		- The arena
+ * size			- Size of the block in bytes
+ */
+void*
+fsme_arenaAlloc(fsme_arena_ptr_t arena,
+				size_t size);
+
+
+/**
+ * Give a block back to its arena.
+ *
+ * @Return
+ *
+ * @param
+ * arena		- The arena the block was allocated from
+ * mem			- The block
+ * size			- The size it was allocated with
+ */
+void
+fsme_arenaFree(fsme_arena_ptr_t arena,
+			   void* mem,
+			   size_t size);
+
+
+/**
+ * Get the allocator of an arena, e.g. to pass it to
+ * fsme_newEngineWithAllocator().
+ *
+ * @Return
+ * The allocator, valid until the arena is deleted.
+ *
+ * @param
+ * arena		- The arena
+ */
+const fsme_allocator_t*
+fsme_arenaGetAllocator(fsme_arena_ptr_t arena);
+
+
+/**
+ * New a state machine engine instance from a 
+ * compiled machine, with the engine, its sub engines
+ * and all their memory allocated from an arena, see
+ * fsme_newEngineWithAllocator().
+ *
+ * @Return
+ * The pointer to the new engine instance, NULL if
+ * the arena is full.
+ *
+ * @param
+ * machine		- The compiled machine from which
+ *                the engine is to be created
+ * arena		- The arena the engine is allocated
+ *				  from, NULL for the allocator set
+ *				  with fsme_setAllocator()
+ */
+fsme_engine_ptr_t
+fsme_newEngineInArena(fsme_machine_ptr_t machine,
+					  fsme_arena_ptr_t arena);
+
+
+/**
+ * Get the NUMA node an arena is bound to.
+ *
+ * @Return
+ * The node, FSME_ARENA_NO_NODE if the arena
+ * is not bound.
+ *
+ * @param
+ * arena		- The arena
+ */
+int
+fsme_arenaGetNode(fsme_arena_ptr_t arena);
+
+
+/**
+ * Get the NUMA node the calling thread runs on.
+ *
+ * @Return
+ * The node, 0 if it cannot be told.
+ */
+int
+fsme_currentNode(void);
+
+#endif
@@ -0,0 +1,123 @@
+/* ---------------------------------------------------------
+ * Bump Arena
+ *
+ * Characteristics:
+ * - An allocator (see fsme_allocator_t) handing out
+ *   consecutive blocks of one buffer, so that an
+ *   allocation is a pointer bump
+ * - Fails once the buffer is full, bounding the
+ *   memory of the engines allocated from it, and
+ *   tells how much of it is used
+ * - Only the last block allocated is given back when
+ *   freed; the others are reclaimed all at once by
+ *   fsme_bumpArenaReset()
+ *
+ * Limitation:
+ * - Not thread-safe: an arena is meant to be used by
+ *   one thread at a time (e.g. one arena per thread)
+ * ---------------------------------------------------------*/
+#ifndef FSME_BUMP_H
+#define FSME_BUMP_H
+
+
+#include <stddef.h>
+
+#include "fsm.h"
+
+
+
+/* ---------- TYPE DEFINITIONS ---------- */
+struct fsme_bump_arena;
+typedef struct fsme_bump_arena* fsme_bump_arena_ptr_t;
+
+
+
+/* ------------- FUNCTION PROTOTYPES ------------- */
+/**
+ * New a bump arena.
+ *
+ * @Return
+ * The pointer to the new arena, NULL if the buffer
+ * could not be allocated.
+ *
+ * @param
+ * buffer		- The memory handed out, NULL to have
+ *				  the arena allocate it
+ * size			- Size of the buffer in bytes
+ */
+fsme_bump_arena_ptr_t
+fsme_newBumpArena(void* buffer,
+				  size_t size);
+
+
+/**
+ * Delete a bump arena. The engines allocated from
+ * it must have been deleted before. A buffer given
+ * to fsme_newBumpArena() is left to the caller.
+ *
+ * @Return
+ *
+ * @param
+ * arena		- The arena to be deleted
+ */
+void
+fsme_deleteBumpArena(fsme_bump_arena_ptr_t arena);
+
+
+/**
+ * Get the allocator of a bump arena, to pass it to
+ * fsme_newEngineWithAllocator() or fsme_setAllocator().
+ *
+ * @Return
+ * The allocator, valid until the arena is deleted.
+ *
+ * @param
+ * arena		- The arena
+ */
+const fsme_allocator_t*
+fsme_bumpArenaGetAllocator(fsme_bump_arena_ptr_t arena);
+
+
+/**
+ * Make the whole buffer of a bump arena free again.
+ * The engines allocated from it must have been
+ * deleted before.
+ *
+ * @Return
+ *
+ * @param
+ * arena		- The arena
+ */
+void
+fsme_bumpArenaReset(fsme_bump_arena_ptr_t arena);
+
+
+/**
+ * Get the number of bytes of a bump arena in use,
+ * alignment padding included.
+ *
+ * @Return
+ * The number of bytes in use.
+ *
+ * @param
+ * arena		- The arena
+ */
+size_t
+fsme_bumpArenaGetUsed(fsme_bump_arena_ptr_t arena);
+
+
+/**
+ * Get the largest number of bytes of a bump arena
+ * that were in use at once since it was created or
+ * last reset.
+ *
+ * @Return
+ * The peak number of bytes in use.
+ *
+ * @param
+ * arena		- The arena
+ */
+size_t
+fsme_bumpArenaGetPeak(fsme_bump_arena_ptr_t arena);
+
+#endif
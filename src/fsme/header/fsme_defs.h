@@ -17,4 +17,69 @@ typedef unsigned char boolean;
 #define FALSE	((boolean)0)
 #endif
 
+#ifndef FSME_CACHE_LINE_SIZE
+#define FSME_CACHE_LINE_SIZE	64
+#endif
+
+#if defined(_MSC_VER)
+#define FSME_CACHE_ALIGNED	__declspec(align(FSME_CACHE_LINE_SIZE))
+#define FSME_THREAD_LOCAL	__declspec(thread)
+#else
+#define FSME_CACHE_ALIGNED	__attribute__((aligned(FSME_CACHE_LINE_SIZE)))
+#define FSME_THREAD_LOCAL	__thread
+#endif
+
+/* atomic operations on an unsigned int, a pointer or
+ * an unsigned long long counter; FSME_ATOMIC_ADD()
+ * returns the new value */
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define FSME_ATOMIC_LOAD(ptr)	\
+	((unsigned int)_InterlockedOr((volatile long*)(ptr), 0))
+#define FSME_ATOMIC_STORE(ptr, val)	\
+	((void)_InterlockedExchange((volatile long*)(ptr), (long)(val)))
+#define FSME_ATOMIC_CAS(ptr, expected, desired)	\
+	((long)(expected) == _InterlockedCompareExchange( \
+	(volatile long*)(ptr), (long)(desired), (long)(expected)))
+#define FSME_ATOMIC_ADD(ptr, val)	\
+	((unsigned int)(_InterlockedExchangeAdd((volatile long*)(ptr), \
+	(long)(val)) + (long)(val)))
+#define FSME_CPU_RELAX()	_mm_pause()
+#define FSME_ATOMIC_LOAD_PTR(ptr)	\
+	_InterlockedCompareExchangePointer((void* volatile*)(ptr), \
+	NULL, NULL)
+#define FSME_ATOMIC_STORE_PTR(ptr, val)	\
+	((void)_InterlockedExchangePointer((void* volatile*)(ptr), \
+	(void*)(val)))
+#define FSME_ATOMIC_ADD64(ptr, val)	\
+	((void)_InterlockedExchangeAdd64((volatile __int64*)(ptr), \
+	(__int64)(val)))
+#define FSME_ATOMIC_LOAD64(ptr)	\
+	((unsigned long long)_InterlockedOr64((volatile __int64*)(ptr), 0))
+#else
+#define FSME_ATOMIC_LOAD(ptr)	\
+	__atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#define FSME_ATOMIC_STORE(ptr, val)	\
+	__atomic_store_n(ptr, val, __ATOMIC_RELEASE)
+#define FSME_ATOMIC_CAS(ptr, expected, desired)	\
+	__extension__ ({ unsigned int fsmeExpected = (expected); \
+	__atomic_compare_exchange_n(ptr, &fsmeExpected, desired, 0, \
+	__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE); })
+#define FSME_ATOMIC_ADD(ptr, val)	\
+	__atomic_add_fetch(ptr, val, __ATOMIC_ACQ_REL)
+#define FSME_ATOMIC_LOAD_PTR(ptr)	\
+	__atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#define FSME_ATOMIC_STORE_PTR(ptr, val)	\
+	__atomic_store_n(ptr, val, __ATOMIC_RELEASE)
+#define FSME_ATOMIC_ADD64(ptr, val)	\
+	((void)__atomic_fetch_add(ptr, val, __ATOMIC_RELAXED))
+#define FSME_ATOMIC_LOAD64(ptr)	\
+	__atomic_load_n(ptr, __ATOMIC_RELAXED)
+#if defined(__x86_64__) || defined(__i386__)
+#define FSME_CPU_RELAX()	__builtin_ia32_pause()
+#else
+#define FSME_CPU_RELAX()
+#endif
+#endif
+
 #endif /* FSME_DEFS_H */
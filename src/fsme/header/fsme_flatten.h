@@ -0,0 +1,74 @@
+/* ---------------------------------------------------------
+ * Machine Flattening
+ *
+ * Characteristics:
+ * - Turns an engine with nested sub machines into one
+ *   flat engine whose states are the leaf configurations
+ *   of the hierarchy
+ * - Every event is resolved with one table lookup and
+ *   runs one precomputed action sequence
+ *
+ * Limitation:
+ * - States with regions or history are not supported
+ * - Sub machines share the event ids of the top-level
+ *   machine
+ * ---------------------------------------------------------*/
+#ifndef FSME_FLATTEN_H
+#define FSME_FLATTEN_H
+
+
+#include "fsm.h"
+
+
+/* --------------- MACROS --------------- */
+/**
+ * Deepest nesting of sub machines that can be
+ * flattened, the top-level machine included.
+ */
+#define FSME_FLATTEN_DEPTH_MAX		16
+
+
+
+/* ------------- FUNCTION PROTOTYPES ------------- */
+/**
+ * New a flat engine from a hierarchical one.
+ *
+ * The flat engine behaves as if every event were
+ * posted to the innermost active engine that has a
+ * transition for it. Its states are the leaf
+ * configurations of the hierarchy (the active state of
+ * every nesting level), numbered from 0 depth first in
+ * the order of the state tables; a sub machine that has
+ * reached its final state counts as one configuration.
+ * A top-level final state keeps FSME_FINAL_STATE_ID.
+ * Transitions are numbered from 0.
+ *
+ * The actions registered on the engine are copied into
+ * one list per flat transition, in the order the nested
+ * engines would run them: the exit actions below the
+ * level of the transition and of its source state, the
+ * transition actions, then the entry actions down to the
+ * new leaf configuration. Actions are still called with
+ * the ids they were added with; guards are called with
+ * the id of the flat transition. Actions added to the
+ * engine later are not seen by the flat engine.
+ *
+ * Shutting the flat engine down only runs the exit
+ * actions of the top-level machine. The flat engine
+ * is allocated like the engine, from its allocator.
+ *
+ * @Return
+ * The pointer to the flat engine, not started. NULL if
+ * the engine has a parent, or its machine uses regions,
+ * history or sparse event ids, nests deeper than
+ * FSME_FLATTEN_DEPTH_MAX
+ * or has too many configurations, or if the flat 
+ * engine could not be allocated.
+ *
+ * @param
+ * engine		- The hierarchical engine
+ */
+fsme_engine_ptr_t
+fsme_newFlatEngine(fsme_engine_ptr_t engine);
+
+#endif
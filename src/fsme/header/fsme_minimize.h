@@ -0,0 +1,97 @@
+/* ---------------------------------------------------------
+ * Machine Minimization
+ *
+ * Characteristics:
+ * - Removes the states that cannot be reached from the
+ *   init state, and the transitions and triggers that
+ *   can never fire
+ * - Optionally merges equivalent states
+ * - Maps the ids of the original machine to the ones
+ *   of the minimized machine
+ *
+ * Limitation:
+ * - Only the top-level machine is minimized; its sub
+ *   machines and regions are referred to as they are
+ * ---------------------------------------------------------*/
+#ifndef FSME_MINIMIZE_H
+#define FSME_MINIMIZE_H
+
+
+#include <limits.h>
+
+#include "fsm.h"
+
+
+/* --------------- MACROS --------------- */
+/**
+ * Flags of fsme_minimizeMachine()
+ */
+/* merge equivalent states */
+#define FSME_MINIMIZE_MERGE			0x1
+
+/**
+ * Id a removed state or transition is mapped to.
+ */
+#define FSME_MINIMIZE_REMOVED		INT_MIN
+
+
+
+/* ------------- FUNCTION PROTOTYPES ------------- */
+/**
+ * Minimize a machine definition.
+ *
+ * The minimized machine keeps the ids of the states
+ * and transitions it keeps. With FSME_MINIMIZE_MERGE,
+ * states that react to every event alike (same
+ * events, equivalent targets) are merged into the
+ * first of them in the state table. If an engine is
+ * given, only states and transitions with the same
+ * registered actions and guards are merged. States
+ * with a sub machine or regions are never merged.
+ *
+ * Actions are not copied: register them on the engines
+ * of the minimized machine once per id it has, using
+ * the id maps.
+ *
+ * @Return
+ * The minimized machine, to be deleted with
+ * fsme_deleteMinimizedMachine(). NULL if the machine
+ * is not valid, has sparse event ids or none of its
+ * transitions can fire, or if memory ran out.
+ *
+ * @param
+ * stateMachine		- The machine definition. It must
+ *					  outlive the minimized machine,
+ *					  which refers to its sub machines.
+ * actions			- An engine of the machine whose
+ *					  actions are compared, or NULL
+ * flags			- FSME_MINIMIZE_* flags, or 0
+ * stateIdMap		- Receives the new id of each state,
+ *					  in the order of the state table,
+ *					  FSME_MINIMIZE_REMOVED if removed.
+ *					  May be NULL.
+ * transitionIdMap	- Receives the new id of each
+ *					  transition, the same way.
+ *					  May be NULL.
+ */
+fsm_machine_t*
+fsme_minimizeMachine(const fsm_machine_t* stateMachine,
+					 fsme_engine_ptr_t actions,
+					 unsigned int flags,
+					 int* stateIdMap,
+					 int* transitionIdMap);
+
+
+/**
+ * Delete a machine returned by fsme_minimizeMachine().
+ * Machines compiled from it must have been released.
+ *
+ * @Return
+ *
+ * @param
+ * stateMachine		- The machine to be deleted
+ */
+void
+fsme_deleteMinimizedMachine(fsm_machine_t* stateMachine);
+
+#endif
@@ -0,0 +1,106 @@
+/* ---------------------------------------------------------
+ * Engine Pool
+ *
+ * Characteristics:
+ * - Hands out engines cloned from a configured
+ *   prototype, see fsme_cloneEngine()
+ * - Engines given back are reset and reused, so
+ *   that setting up and tearing down a session
+ *   does not allocate
+ *
+ * Limitation:
+ * - Requires POSIX threads
+ * - Actions registered on an engine taken from the
+ *   pool stay with it when it is given back
+ * ---------------------------------------------------------*/
+#ifndef FSME_POOL_H
+#define FSME_POOL_H
+
+
+#include "fsm.h"
+
+
+
+/* ---------- TYPE DEFINITIONS ---------- */
+struct fsme_pool;
+typedef struct fsme_pool* fsme_pool_ptr_t;
+
+
+
+/* ------------- FUNCTION PROTOTYPES ------------- */
+/**
+ * New an engine pool, filled with engines cloned
+ * from the prototype.
+ *
+ * The pool clones and deletes engines with its lock
+ * held. Engines of the machine of the prototype must
+ * not be created or deleted outside of the pool while
+ * it is used by several threads.
+ *
+ * @Return
+ * The pointer to the new pool, NULL if the prototype
+ * is NULL or a sub engine, or memory ran out.
+ *
+ * @param
+ * prototype	- The engine the pooled engines are
+ *				  cloned from. It must outlive the
+ *				  pool.
+ * capacity		- Number of engines the pool holds
+ */
+fsme_pool_ptr_t
+fsme_newPool(fsme_engine_ptr_t prototype,
+			 int capacity);
+
+
+/**
+ * Delete a pool and the engines it holds. Engines
+ * taken from it are not deleted.
+ *
+ * @Return
+ *
+ * @param
+ * pool			- The pool to be deleted
+ */
+void
+fsme_deletePool(fsme_pool_ptr_t pool);
+
+
+/**
+ * Take an engine from a pool. If the pool is empty,
+ * a new engine is cloned from the prototype.
+ *
+ * @Return
+ * The pointer to an engine that is not started,
+ * NULL if the pool is empty and a new engine could
+ * not be allocated.
+ *
+ * @param
+ * pool			- The pool
+ */
+fsme_engine_ptr_t
+fsme_poolAcquire(fsme_pool_ptr_t pool);
+
+
+/**
+ * Give an engine back to a pool. The engine is reset
+ * with fsme_resetEngine(), keeping its actions, and
+ * deleted if the pool is full.
+ *
+ * An engine cannot be given back while it processes
+ * an event, e.g. from one of its actions: it is left
+ * as it is, and must be given back once the event 
+ * has been processed.
+ *
+ * @Return
+ * FSME_OK if the engine was given back, FSME_FORBIDDEN
+ * if it is a sub engine or processing an event.
+ *
+ * @param
+ * pool			- The pool
+ * engine		- An engine taken from the pool
+ */
+fsme_return_t
+fsme_poolRelease(fsme_pool_ptr_t pool,
+				 fsme_engine_ptr_t engine);
+
+#endif
@@ -0,0 +1,257 @@
+/* ---------------------------------------------------------
+ * Session Registry
+ *
+ * Characteristics:
+ * - Maps 64-bit session keys to state machine engines
+ * - Open addressing hash tables, sharded by key
+ * - Engines created on demand from one compiled machine
+ *
+ * Limitation:
+ * - Requires POSIX threads
+ * - An action must not call back into the registry
+ *   (the shard of its engine is locked)
+ * ---------------------------------------------------------*/
+#ifndef FSME_REGISTRY_H
+#define FSME_REGISTRY_H
+
+
+#include <stddef.h>
+
+#include "fsm.h"
+
+
+/* --------------- MACROS --------------- */
+/**
+ * Number of shards used when 0 is given.
+ */
+#define FSME_REGISTRY_SHARD_NUM		64
+
+
+
+/* ---------- TYPE DEFINITIONS ---------- */
+/**
+ * Session key type
+ */
+typedef unsigned long long fsme_key_t;
+
+
+struct fsme_registry;
+typedef struct fsme_registry* fsme_registry_ptr_t;
+
+
+/**
+ * Prototype of the function called when the registry
+ * creates the engine of a session, e.g. to register
+ * the actions and to start the engine.
+ */
+typedef void (* fsme_registryInitFunc_t)(fsme_key_t key,
+										 fsme_engine_ptr_t engine,
+										 void* userData);
+
+
+
+/* ------------- FUNCTION PROTOTYPES ------------- */
+/**
+ * New a session registry.
+ *
+ * The registry keeps a reference to the machine.
+ * Engines of the machine must not be created or
+ * deleted outside of the registry while it is used
+ * by several threads.
+ *
+ * @Return
+ * The pointer to the new registry, NULL if the
+ * machine is NULL or memory ran out.
+ *
+ * @param
+ * machine		- The compiled machine the engines
+ *				  are created from
+ * shardNum		- Number of shards, rounded up to a
+ *				  power of 2; FSME_REGISTRY_SHARD_NUM
+ *				  if 0
+ * capacity		- Number of sessions the registry
+ *				  should hold without growing
+ * initFunc		- Called for every new engine,
+ *				  may be NULL
+ * userData		- Passed to initFunc
+ */
+fsme_registry_ptr_t
+fsme_newRegistry(fsme_machine_ptr_t machine,
+				 int shardNum,
+				 size_t capacity,
+				 fsme_registryInitFunc_t initFunc,
+				 void* userData);
+
+
+/**
+ * Delete a session registry and all its engines.
+ *
+ * @Return
+ *
+ * @param
+ * registry		- The registry to be deleted
+ */
+void
+fsme_deleteRegistry(fsme_registry_ptr_t registry);
+
+
+/**
+ * Have the registry allocate the engines it creates
+ * from per-node arenas. A new engine is allocated
+ * from the arena of the NUMA node of the thread that
+ * creates it, so that it stays local to the thread
+ * processing the session. Must be called before any
+ * engine is created.
+ *
+ * @Return
+ * TRUE if the arenas are set, FALSE if memory ran out
+ * (the engines are then allocated from the heap).
+ *
+ * @param
+ * registry		- The registry
+ * arenas		- The arena of each node, indexed
+ *				  by node; a node whose arena is
+ *				  NULL uses the heap
+ * arenaNum		- Number of arenas
+ */
+boolean
+fsme_registrySetArenas(fsme_registry_ptr_t registry,
+					   fsme_arena_ptr_t const* arenas,
+					   int arenaNum);
+
+
+/**
+ * Find the engine of a session.
+ *
+ * @Return
+ * The pointer to the engine, NULL if the
+ * session is not in the registry.
+ *
+ * @param
+ * registry		- The registry
+ * key			- The session key
+ */
+fsme_engine_ptr_t
+fsme_registryFind(fsme_registry_ptr_t registry,
+				  fsme_key_t key);
+
+
+/**
+ * Find the engines of many sessions at once. The
+ * slots of the next keys are prefetched while a
+ * key is looked up.
+ *
+ * @Return
+ * The number of sessions found.
+ *
+ * @param
+ * registry		- The registry
+ * keys			- The session keys
+ * num			- Number of keys
+ * engines		- Receives the engine of each key,
+ *				  NULL for a session not found
+ */
+size_t
+fsme_registryFindBulk(fsme_registry_ptr_t registry,
+					  const fsme_key_t* keys,
+					  size_t num,
+					  fsme_engine_ptr_t* engines);
+
+
+/**
+ * Find the engine of a session, creating it if
+ * the session is not in the registry yet.
+ *
+ * @Return
+ * The pointer to the engine, NULL if it could
+ * not be allocated.
+ *
+ * @param
+ * registry		- The registry
+ * key			- The session key
+ */
+fsme_engine_ptr_t
+fsme_registryGet(fsme_registry_ptr_t registry,
+				 fsme_key_t key);
+
+
+/**
+ * Post an event to the engine of a session, creating
+ * the engine if needed. The event is processed with
+ * the shard of the session locked, so that engines
+ * can be driven from several threads.
+ *
+ * @Return
+ * Refer to fsme_postEvent().
+ *
+ * @param
+ * registry		- The registry
+ * key			- The session key
+ * event		- The event to be posted.
+ * inContext	- The input context
+ * outContext	- The output context
+ */
+fsme_return_t
+fsme_registryPostEvent(fsme_registry_ptr_t registry,
+					   fsme_key_t key,
+					   int event,
+					   const void* inContext,
+					   void* outContext);
+
+
+/**
+ * Remove a session from the registry and delete
+ * its engine.
+ *
+ * @Return
+ * TRUE if the session was in the registry.
+ *
+ * @param
+ * registry		- The registry
+ * key			- The session key
+ */
+boolean
+fsme_registryRemove(fsme_registry_ptr_t registry,
+					fsme_key_t key);
+
+
+/**
+ * Get the number of sessions in the registry.
+ *
+ * @Return
+ * The number of sessions.
+ *
+ * @param
+ * registry		- The registry
+ */
+size_t
+fsme_registrySize(fsme_registry_ptr_t registry);
+
+
+/**
+ * Publish a new version of the machine: new sessions
+ * are created from it, and the engines of the existing
+ * ones are migrated to it shard by shard, see 
+ * fsme_migrateEngine(). Their old tables are deleted
+ * at once, so the engines must only be driven through
+ * the registry meanwhile. The registry keeps a 
+ * reference to the new machine instead of the old.
+ *
+ * @Return
+ * The number of sessions that could not be migrated
+ * and stay on the old version.
+ *
+ * @param
+ * registry		- The registry
+ * machine		- The new version of the machine
+ * mapFunc		- Maps the active states the new
+ *				  version does not have, may be NULL
+ * context		- Passed to mapFunc
+ */
+size_t
+fsme_registryPublish(fsme_registry_ptr_t registry,
+					 fsme_machine_ptr_t machine,
+					 fsme_stateMapFuncPtr_t mapFunc,
+					 void* context);
+
+#endif
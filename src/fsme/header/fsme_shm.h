@@ -0,0 +1,261 @@
+/* ---------------------------------------------------------
+ * Shared Memory Engines
+ *
+ * Characteristics:
+ * - Keeps the states of a number of engines in a POSIX
+ *   shared memory segment, so that the worker processes
+ *   of a service can all process the events of the same
+ *   sessions
+ * - The segment holds no pointers: an engine is a record
+ *   of state indexes, its sub engines at fixed offsets
+ *   in it, in the order of the state tables
+ * - Every process compiles the same machine and registers
+ *   its own actions, by id, on a prototype engine
+ * - An engine is locked by the process dispatching an
+ *   event to it, and can be claimed by one process for
+ *   a longer time
+ *
+ * Limitation:
+ * - Requires POSIX shared memory and threads
+ * - The processes must share a pid namespace and have
+ *   the same pointer size; a forked child opens the
+ *   store again
+ * - Actions cannot suspend transitions: the event is
+ *   rejected and the engine keeps its states
+ * - Actions cannot post to or reset their own engine
+ *   in the store
+ * - Dwell times are not tracked
+ * ---------------------------------------------------------*/
+#ifndef FSME_SHM_H
+#define FSME_SHM_H
+
+
+#include "fsm.h"
+
+
+/* --------------- MACROS --------------- */
+/**
+ * Number of local engines a store keeps to process
+ * events with, see fsme_newPool().
+ */
+#define FSME_SHM_POOL_SIZE			8
+
+
+
+/* ---------- TYPE DEFINITIONS ---------- */
+struct fsme_shm_store;
+typedef struct fsme_shm_store* fsme_shm_store_ptr_t;
+
+
+
+/* ------------- FUNCTION PROTOTYPES ------------- */
+/**
+ * Create a shared memory segment for a number of
+ * engines and map it. The engines are not started.
+ *
+ * An event is processed by loading the states of the
+ * engine into a local engine cloned from the prototype,
+ * posting it there and writing the states back, so the
+ * actions run are those of the process that posts. The
+ * prototype is configured before the store is created;
+ * actions added to it later are not seen.
+ *
+ * @Return
+ * The pointer to the store, NULL if the segment
+ * already exists or could not be created.
+ *
+ * @param
+ * name			- Name of the segment, as for
+ *				  shm_open(): "/name"
+ * prototype	- The engine whose machine and actions
+ *				  are used. It must outlive the store.
+ * engineNum	- Number of engines
+ */
+fsme_shm_store_ptr_t
+fsme_newShmStore(const char* name,
+				 fsme_engine_ptr_t prototype,
+				 int engineNum);
+
+
+/**
+ * Map a segment created by another process.
+ *
+ * @Return
+ * The pointer to the store, NULL if the segment does
+ * not exist, or was created for a machine that is not
+ * the same as the one of the prototype.
+ *
+ * @param
+ * name			- Name of the segment
+ * prototype	- The engine whose machine and actions
+ *				  are used, see fsme_newShmStore()
+ */
+fsme_shm_store_ptr_t
+fsme_openShmStore(const char* name,
+				  fsme_engine_ptr_t prototype);
+
+
+/**
+ * Unmap a segment. The engines stay in it for the
+ * other processes.
+ *
+ * @Return
+ *
+ * @param
+ * store		- The store to be closed
+ */
+void
+fsme_closeShmStore(fsme_shm_store_ptr_t store);
+
+
+/**
+ * Remove the name of a segment. It is freed when the
+ * last process unmaps it.
+ *
+ * @Return
+ * TRUE if the segment existed.
+ *
+ * @param
+ * name			- Name of the segment
+ */
+boolean
+fsme_unlinkShmStore(const char* name);
+
+
+/**
+ * Get the number of engines of a store.
+ *
+ * @Return
+ * The number of engines, 0 if the store is NULL.
+ *
+ * @param
+ * store		- The store
+ */
+int
+fsme_shmGetEngineNum(fsme_shm_store_ptr_t store);
+
+
+/**
+ * Start an engine of a store.
+ *
+ * @Return
+ * Refer to fsme_startEngine(). FSME_FORBIDDEN too
+ * if the engine is claimed by another process or an
+ * action suspended the transition, 
+ * FSME_ENGINE_FROZEN if called by an action of the 
+ * same engine, and FSME_ERROR_FATAL if the index is
+ * out of range or the record of the engine is 
+ * corrupt.
+ *
+ * @param
+ * store		- The store
+ * index		- Index of the engine, from 0
+ * inContext	- The input context
+ * outContext	- The output context
+ */
+fsme_return_t
+fsme_shmStartEngine(fsme_shm_store_ptr_t store,
+					int index,
+					const void* inContext,
+					void* outContext);
+
+
+/**
+ * Post an event to an engine of a store. Any process
+ * may post, unless the engine is claimed; processes
+ * posting to the same engine wait for each other.
+ *
+ * If an action suspends the transition, the event is
+ * rejected: the actions run so far are not undone, 
+ * but the engine in the store keeps its states.
+ *
+ * @Return
+ * Refer to fsme_postEvent() and fsme_shmStartEngine().
+ *
+ * @param
+ * store		- The store
+ * index		- Index of the engine, from 0
+ * event		- The event to be posted
+ * inContext	- The input context
+ * outContext	- The output context
+ */
+fsme_return_t
+fsme_shmPostEvent(fsme_shm_store_ptr_t store,
+				  int index,
+				  int event,
+				  const void* inContext,
+				  void* outContext);
+
+
+/**
+ * Return an engine of a store to the state of a new
+ * engine, without running any action.
+ *
+ * @Return
+ * Refer to fsme_shmStartEngine().
+ *
+ * @param
+ * store		- The store
+ * index		- Index of the engine, from 0
+ */
+fsme_return_t
+fsme_shmResetEngine(fsme_shm_store_ptr_t store,
+					int index);
+
+
+/**
+ * Get the active states of an engine of a store, see
+ * fsme_getStatePath(). It does not wait for a process
+ * processing an event, only retries while the states
+ * are being written back.
+ *
+ * @Return
+ * The number of state ids written, 0 if no consistent
+ * copy of the states could be read.
+ *
+ * @param
+ * store		- The store
+ * index		- Index of the engine, from 0
+ * stateIds		- Receives the state ids
+ * maxNum		- Size of stateIds
+ */
+int
+fsme_shmGetStatePath(fsme_shm_store_ptr_t store,
+					 int index,
+					 int* stateIds,
+					 int maxNum);
+
+
+/**
+ * Claim an engine of a store for this process, e.g.
+ * while the process serves the session. The events
+ * posted by other processes are refused until it is
+ * given up. A claim of a process that has exited is
+ * taken over.
+ *
+ * @Return
+ * TRUE if this process holds the claim.
+ *
+ * @param
+ * store		- The store
+ * index		- Index of the engine, from 0
+ */
+boolean
+fsme_shmClaimEngine(fsme_shm_store_ptr_t store,
+					int index);
+
+
+/**
+ * Give up the claim of this process on an engine.
+ *
+ * @Return
+ *
+ * @param
+ * store		- The store
+ * index		- Index of the engine, from 0
+ */
+void
+fsme_shmReleaseEngine(fsme_shm_store_ptr_t store,
+					  int index);
+
+#endif
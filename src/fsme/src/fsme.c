@@ -1,7 +1,12 @@
 #include <assert.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#if defined(_WIN32)
+#include <malloc.h>
+#endif
 
 #include "fsme.h"
 
@@ -11,43 +16,148 @@
 //Engine functions
 //////////////////////////////
 #define fsmeEngineStarted(engine)	\
-	(NULL != ((fsme_engine_ptr_t)engine)->activeState)
+	(FSME_INDEX_NONE != fsmeEngineGetActiveState(engine))
+
+#define fsmeEngineGetMachine(engine)	\
+	(((fsme_engine_ptr_t)engine)->machine)
 
 #define fsmeEngineGetEntryAction(engine)	\
-	(((fsme_engine_ptr_t)engine)->entryAction)
+	(((fsme_engine_ptr_t)engine)->cold->entryAction)
 
 #define fsmeEngineGetExitAction(engine)		\
-	(((fsme_engine_ptr_t)engine)->exitAction)
+	(((fsme_engine_ptr_t)engine)->cold->exitAction)
 
 #define fsmeEngineGetAction(engine, wantEntryAction)	\
 	((boolean)wantEntryAction ? fsmeEngineGetEntryAction(engine): \
 	fsmeEngineGetExitAction(engine))
 
 #define fsmEngineGetEntryState(engine)    \
-    (((fsme_engine_ptr_t)engine)->entryState)
+    (fsmeEngineGetMachine(engine)->entryState)
 
+//Only the thread holding the engine writes the state 
+//word, but threads in fsme_postEventConcurrent() may 
+//read and swap it at the same time.
 #define fsmeEngineGetActiveState(engine)	\
-	(((fsme_engine_ptr_t)engine)->activeState)
+	((fsme_index_t)(FSME_ATOMIC_LOAD( \
+	&((fsme_engine_ptr_t)engine)->activeState) & FSME_STATE_MASK))
 
 #define fsmeEngineSetActiveState(engine, state)	\
-	(((fsme_engine_ptr_t)engine)->activeState = state)
+	FSME_ATOMIC_STORE(&((fsme_engine_ptr_t)engine)->activeState, \
+	(FSME_ATOMIC_LOAD(&((fsme_engine_ptr_t)engine)->activeState) & \
+	~FSME_STATE_MASK) | (fsme_index_t)(state))
+
+#define fsmeEngineIsSub(engine)	\
+	(0 != (FSME_ATOMIC_LOAD(&((fsme_engine_ptr_t)engine)->activeState) \
+	& FSME_STATE_SUB))
+
+//The index of an event in the tables of the engine,
+//FSME_INDEX_NONE if its machine does not know it.
+#define fsmeEngineGetEventIndex(engine, event)	\
+	fsmeMachineGetEventIndex(fsmeEngineGetMachine(engine), event)
+
+#define fsmeEngineGetState(engine, index)	\
+	(&(((fsme_engine_ptr_t)engine)->stateTable[index]))
+
+#define fsmeEngineGetTransition(engine, index)	\
+	(&(((fsme_engine_ptr_t)engine)->transitionTable[index]))
+
+#define fsmeEngineGetPending(engine)	\
+	(&(((fsme_engine_ptr_t)engine)->cold->pending))
+
+#define fsmeEngineIsSuspended(engine)	\
+	(fsmeEngineGetPending(engine)->suspended)
+
+#define fsmeEngineChangeActions(engine)	\
+	(((fsme_engine_ptr_t)engine)->cold->chainGeneration++)
+
+#define fsmeEngineGetAllocator(engine)	\
+	(((fsme_engine_ptr_t)engine)->cold->allocator)
+
+//Call a function of the observer of the engine. Unless
+//an observer is set, this is one branch.
+#define fsmeEngineNotify(engine, hook, id)	\
+	do { \
+		const fsme_observer_t* fsmeObserver = \
+			fsmeGetObserver(engine); \
+		if (NULL != fsmeObserver && NULL != fsmeObserver->hook) { \
+			fsmeObserver->hook(engine, id, fsmeObserver->context); \
+		} \
+	} while (0)
+
+//Take the time a state is entered, and count the time
+//spent in it when it is left. Unless the machine is 
+//tracked, this is one branch.
+#define fsmeEngineDwellEnter(engine)	\
+	do { \
+		if (NULL != FSME_ATOMIC_LOAD_PTR( \
+			&fsmeEngineGetMachine(engine)->dwell)) { \
+			fsmeDwellEnter(engine); \
+		} \
+	} while (0)
+
+#define fsmeEngineDwellExit(engine, state)	\
+	do { \
+		if (NULL != FSME_ATOMIC_LOAD_PTR( \
+			&fsmeEngineGetMachine(engine)->dwell)) { \
+			fsmeDwellExit(engine, state); \
+		} \
+	} while (0)
+
+#define fsmeEngineColdSize(machine)	\
+	(sizeof(fsme_engine_cold_t) + \
+	sizeof(fsme_state_t) * (machine)->stateNum + \
+	sizeof(fsme_transition_t) * (machine)->transitionNum)
+
+#define fsmeChainSize(num)	\
+	(sizeof(fsme_chain_t) + sizeof(fsme_chain_entry_t) * (num))
+
+#define fsmeDwellSize(stateNum)	\
+	(sizeof(fsme_dwell_t) + sizeof(unsigned long long) * \
+	(FSME_DWELL_BUCKET_NUM + 1) * (stateNum))
+
+//the keys of an event hash, then its seeds and a 
+//byte per slot telling whether it is taken
+#define fsmeEventHashSize(slotNum, bucketNum)	\
+	((sizeof(int) + sizeof(unsigned char)) * (size_t)(slotNum) + \
+	sizeof(unsigned int) * (size_t)(bucketNum))
+
+//Blocks carved from a slab are rounded up to cache 
+//lines, keeping the engines in it aligned.
+#define fsmeSlabLines(size)	\
+	(((size) + FSME_CACHE_LINE_SIZE - 1) / \
+	FSME_CACHE_LINE_SIZE * FSME_CACHE_LINE_SIZE)
+
+
+//////////////////////////////
+//Machine functions
+//////////////////////////////
+#define fsmeMachineGetEventIndex(machine, event)	\
+	(NULL == (machine)->eventKeys ? \
+	((0 <= (event) && (event) < (machine)->eventNum) ? \
+	(fsme_index_t)(event) : FSME_INDEX_NONE) : \
+	fsmeHashEvent(machine, event))
 
-#define fsmeEngineGetEventCount(engine)    \
-    (((fsme_engine_ptr_t)engine)->eventNum)
+//Map a 32-bit hash to 0 to num - 1 without a division
+#define fsmeHashRange(hash, num)	\
+	((unsigned int)(((unsigned long long)(hash) * (num)) >> 32))
 
-#define fsmeEngineFindTrigger(engine,event) \
-	(&(((fsme_engine_ptr_t)engine)->triggerTable[event]))
+/**
+ * Largest seed tried for a bucket of event ids before
+ * the hash table is made larger
+ */
+#define FSME_EVENT_SEED_MAX		0x10000
 
 
 //////////////////////////////
-//State functions
+//Misc
 //////////////////////////////
-#define fsmeStateGetId(state)	\
-	(((fsme_state_ptr_t)state)->id)
+#define FSME_STATIC_ASSERT(cond, name)	\
+	typedef char fsme_static_assert_##name[(cond) ? 1 : -1]
 
-#define fsmeStateIsFinal(state)	\
-	(FSME_FINAL_STATE_ID == fsmeStateGetId(state))
 
+//////////////////////////////
+//State functions
+//////////////////////////////
 #define fsmeStateGetEntryAction(state)	\
 	(state->entryAction)
 
@@ -74,39 +184,210 @@
 #define fsmeTransitionHasAction(transition)	\
 	(NULL != fsmeTransitionGetAction(transition))
 
-#define fsmeTransitionGetSourceState(transition)	\
-	(((fsme_transition_t*)transition)->sourceState)
-
-#define fsmeTransitionGetTargetState(transition)	\
-	(((fsme_transition_t*)transition)->targetState)
-
 
 
 /* ------------------- local type definitions --------------------- */
 typedef fsme_state_t * fsme_state_ptr_t;
 
-/* the action node type */
-typedef struct fsme_action
+/* the minimal perfect hash of the sparse event ids 
+ * of a machine, while it is compiled */
+typedef struct fsme_event_hash
 {
-	fsme_func_t action;
-	struct fsme_action * next;
-} fsme_action_t;
+	int*						keys;
+	unsigned int*				seeds;
+	int							slotNum;
+	int							bucketNum;
+} fsme_event_hash_t;
+
+/* the id of a state or transition and its index */
+typedef struct fsme_id_index
+{
+	int							id;
+	fsme_index_t				index;
+} fsme_id_index_t;
+
+/* Header of the block engines created together are 
+ * carved from, taking the first cache line of it. It 
+ * is freed with the last of its engines. */
+typedef struct fsme_engine_slab
+{
+	unsigned int				engineNum;
+	size_t						size;
+} fsme_engine_slab_t;
 
 const fsm_state_t FSM_FINAL_STATE = 
 {
     FSME_FINAL_STATE_ID,
 	TRUE, /* is final state */
-	NULL  /* sub state machine */
+	NULL, /* sub state machine */
+	FSM_HISTORY_NONE,
+	NULL, /* regions */
+	0,
+	NULL  /* name */
+};
+
+#ifdef FSME_DEBUG
+static void
+fsmeDebugEnterState(fsme_engine_ptr_t engine, int id, void* context);
+static void
+fsmeDebugExitState(fsme_engine_ptr_t engine, int id, void* context);
+static void
+fsmeDebugTransition(fsme_engine_ptr_t engine, int id, void* context);
+static void
+fsmeDebugInvalidEvent(fsme_engine_ptr_t engine, int id, void* context);
+static void
+fsmeDebugGuardFailure(fsme_engine_ptr_t engine, int id, void* context);
+
+static const fsme_observer_t fsmeDebugObserver = 
+{
+	fsmeDebugEnterState,
+	fsmeDebugExitState,
+	fsmeDebugTransition,
+	fsmeDebugInvalidEvent,
+	fsmeDebugGuardFailure,
+	NULL
+};
+
+/* observer of the engines without one of their own */
+static const fsme_observer_t* fsmeGlobalObserver = &fsmeDebugObserver;
+#else
+/* observer of the engines without one of their own */
+static const fsme_observer_t* fsmeGlobalObserver = NULL;
+#endif
+
+/* its address tells a thread whether it holds the 
+ * sequence of an engine, see fsme_getStatePath() */
+static FSME_THREAD_LOCAL char fsmeWriterTag;
+
+static void*
+fsmeDefaultAlloc(size_t size, size_t align, void* context);
+static void
+fsmeDefaultDealloc(void* mem, size_t size, void* context);
+static unsigned long long
+fsmeDefaultClock(void);
+
+static const fsme_allocator_t fsmeDefaultAllocator = 
+{
+	fsmeDefaultAlloc,
+	fsmeDefaultDealloc,
+	NULL
 };
 
+/* allocator of the engines without one of their own */
+static const fsme_allocator_t* fsmeAllocator = &fsmeDefaultAllocator;
+
+
+/* ------------------- layout checks ------------------------------ */
+//Everything fsme_postEvent() touches in the engine 
+//must stay within one aligned cache line. 
+FSME_STATIC_ASSERT(sizeof(fsme_engine_t) == FSME_CACHE_LINE_SIZE,
+				   engine_is_one_cache_line);
+FSME_STATIC_ASSERT(offsetof(fsme_engine_t, cold) + 
+				   sizeof(fsme_engine_cold_t*) <= 
+				   FSME_CACHE_LINE_SIZE,
+				   cold_pointer_in_the_line);
+FSME_STATIC_ASSERT(sizeof(fsme_engine_slab_t) <= FSME_CACHE_LINE_SIZE,
+				   slab_header_in_one_line);
+
 
 
 /* --------------- local function prototypes ------------------- */
+static fsme_machine_ptr_t
+fsmeDoCompileMachine(const fsm_machine_t* stateMachine);
+static void
+fsmeFreeMachine(fsme_machine_ptr_t machine);
+static boolean
+fsmeBuildEventHash(const fsm_machine_t* stateMachine,
+				   fsme_event_hash_t* hash);
+static unsigned int
+fsmeHashEventId(int id,
+				unsigned int seed);
+static fsme_index_t
+fsmeHashEvent(const fsme_machine_t* machine,
+			  int event);
+static int
+fsmeCompareIds(const void* a,
+			   const void* b);
+static int
+fsmeCountSymbols(const fsm_machine_t* stateMachine);
+static boolean
+fsmeGetBindingId(const fsme_machine_t* machine,
+				 const fsme_binding_t* binding,
+				 fsme_symbol_kind_t kind,
+				 int* id);
+static boolean
+fsmeCompileSymbols(fsme_machine_ptr_t machine,
+				   const fsm_machine_t* stateMachine);
+static boolean
+fsmeAddSymbol(fsme_machine_ptr_t machine,
+			  fsme_symbol_kind_t kind,
+			  const char* name,
+			  int id);
+static const fsme_symbol_t*
+fsmeFindSymbol(const fsme_machine_t* machine,
+			   fsme_symbol_kind_t kind,
+			   const char* name);
+static unsigned int
+fsmeHashName(fsme_symbol_kind_t kind,
+			 const char* name);
+static fsme_index_t
+fsmeMachineGetStateIndex(const fsm_machine_t* stateMachine, 
+						 int id);
+static fsme_index_t
+fsmeMachineGetTransitionIndex(const fsm_machine_t* stateMachine, 
+							  int id);
+static boolean
+fsmeCompileRegions(const fsme_allocator_t* allocator,
+				   const fsm_state_t* state, 
+				   fsme_regions_t** regions);
+static void
+fsmeFreeRegions(const fsme_allocator_t* allocator,
+				fsme_regions_t* regions);
+static fsme_engine_ptr_t
+fsmeDoNewEngine(fsme_machine_ptr_t machine, 
+				fsme_engine_ptr_t parent,
+				const fsme_allocator_t* allocator);
+static boolean
+fsmeInitEngine(fsme_engine_ptr_t engine, 
+			   fsme_machine_ptr_t machine, 
+			   fsme_engine_ptr_t parent,
+			   const fsme_allocator_t* allocator,
+			   fsme_engine_slab_t* slab,
+			   unsigned char** cursor);
+static size_t
+fsmeEngineSlabSize(const fsme_machine_t* machine);
+static void
+fsmeFinalizeEngine(fsme_engine_ptr_t engine);
+static boolean
+fsmeCopyEngine(fsme_engine_ptr_t engine, 
+			   fsme_engine_ptr_t prototype,
+			   boolean withState);
+static boolean
+fsmeMigrateEngine(fsme_engine_ptr_t engine,
+				  fsme_engine_ptr_t old,
+				  fsme_stateMapFuncPtr_t mapFunc,
+				  void* context);
+static fsme_index_t
+fsmeMigrateState(const fsme_machine_t* machine,
+				 const fsme_machine_t* old,
+				 fsme_index_t state,
+				 fsme_stateMapFuncPtr_t mapFunc,
+				 void* context);
+static void
+fsmeAdoptSubEngines(fsme_engine_ptr_t engine);
+static void
+fsmeResetEngine(fsme_engine_ptr_t engine,
+				boolean keepActions);
 static fsme_engine_ptr_t
-fsmeDoNewEngine(const fsm_machine_t* stateMachine, 
-				fsme_engine_ptr_t parent);
+fsmeAllocEngines(const fsme_allocator_t* allocator,
+				 int num);
+static void
+fsmeFreeEngines(const fsme_allocator_t* allocator,
+				fsme_engine_ptr_t engine,
+				int num);
 static void
 fsmeEnterEngine(fsme_engine_ptr_t engine, 
+				fsm_history_t history,
 				const void* inContext,
 				void* outContext);
 static void
@@ -116,14 +397,51 @@ fsmeExitEngine(fsme_engine_ptr_t engine,
 
 static void
 fsmeEnterState(fsme_engine_ptr_t engine,
-			   fsme_state_t const * targetState,
+			   fsme_index_t targetState,
+			   boolean deepHistory,
 			   const void* inContext,
 			   void* outContext);
 static void
-fsmeExitState(fsme_engine_ptr_t engine,
-			  fsme_state_ptr_t  srcState,
-			  const void* inContext,
-			  void* outContext);
+fsmeCompleteEnterState(fsme_engine_ptr_t engine,
+					   fsme_index_t targetState,
+					   boolean deepHistory,
+					   const void* inContext,
+					   void* outContext);
+static void
+fsmeExitSubEngines(fsme_engine_ptr_t engine,
+				   fsme_index_t srcState,
+				   const void* inContext,
+				   void* outContext);
+static fsme_return_t
+fsmeRunTransition(fsme_engine_ptr_t engine,
+				  const void* inContext,
+				  void* outContext);
+static boolean
+fsmeRunChain(fsme_engine_ptr_t engine, 
+			 const fsme_chain_t* chain,
+			 int end,
+			 const void* inContext, 
+			 void* outContext);
+static const fsme_chain_t*
+fsmeGetChain(fsme_engine_ptr_t engine,
+			 fsme_index_t transitionIndex);
+static fsme_chain_entry_t*
+fsmeFillChain(fsme_chain_entry_t* entry,
+			  fsme_action_ptr_t actionNode);
+static void
+fsmeCancelTransition(fsme_engine_ptr_t engine);
+static void
+fsmeClearQueue(fsme_engine_ptr_t engine);
+static fsme_return_t
+fsmeDrainQueue(fsme_engine_ptr_t engine);
+static fsme_return_t
+fsmeQueueEvent(fsme_engine_ptr_t engine,
+			   int event,
+			   const void* inContext,
+			   void* outContext);
+static boolean
+fsmeDequeueEvent(fsme_engine_ptr_t engine,
+				 fsme_queued_event_t* queued);
 static fsme_state_t*
 fsmeGetStateById(const fsme_engine_t* engine, 
 				 int id);
@@ -134,79 +452,265 @@ fsmeGetTransitionById(const fsme_engine_t* engine,
 static fsme_action_ptr_t
 fsme_getLastAction(fsme_action_ptr_t headNode);
 static fsme_action_ptr_t
-fsme_createAction(fsme_func_t func);
-static void
+fsme_createAction(const fsme_allocator_t* allocator,
+				  fsme_func_t func,
+				  int id);
+static boolean
 fsme_addEngineAction(fsme_engine_ptr_t engine,
 					 boolean wantEntryAction,
 					 fsme_func_t action);
-static void
+static boolean
 fsme_addStateAction(fsme_engine_ptr_t engine,
 					int stateId,
 					boolean wantEntryAction,
 					fsme_func_t action);
-static void
-fsme_appendAction(fsme_action_ptr_t action, 
+static boolean
+fsme_appendAction(const fsme_allocator_t* allocator,
+				  fsme_action_ptr_t action, 
 				  fsme_func_t func);
 static void
-fsme_removeAction(fsme_action_ptr_t *head, 
+fsme_removeAction(const fsme_allocator_t* allocator,
+				  fsme_action_ptr_t *head, 
 				  fsme_func_t func);
+static boolean
+fsmeTransitionIsTrivial(const fsme_machine_t* machine,
+						const fsme_state_t* stateTable,
+						const fsme_transition_t* transitionTable,
+						fsme_index_t transition);
+static boolean
+fsmeCheckGuard(fsme_engine_ptr_t engine,
+			   fsme_index_t transition,
+			   const void* inContext,
+			   void* outContext);
 static fsme_return_t
 fsmeProcessTransition(fsme_engine_ptr_t engine,
-					  fsme_transition_t* transition,
+					  fsme_index_t transition,
 					  const void* inContext,
 					  void* outContext);
 static void 
 fsme_processActions(fsme_engine_ptr_t engine, 
 					fsme_action_ptr_t actionNode, 
-					int id, 
 					const void* inContext, 
 					void* outContext);
 
 static void
-fsme_clearActionList(fsme_action_ptr_t *head);
+fsme_clearActionList(const fsme_allocator_t* allocator,
+					 fsme_action_ptr_t *head);
+static fsme_action_ptr_t
+fsme_shareActionList(fsme_action_ptr_t head);
+static void
+fsme_freeAction(const fsme_allocator_t* allocator,
+				fsme_action_ptr_t action);
+static fsme_action_ptr_t*
+fsmeGetActionList(fsme_engine_ptr_t engine,
+				  int list);
+static int
+fsmeCompareIdIndex(const void* a,
+				   const void* b);
+static int
+fsmeFindIdIndex(const fsme_id_index_t* table,
+				int num,
+				int id);
+static boolean
+fsme_unshareActionList(const fsme_allocator_t* allocator,
+					   fsme_action_ptr_t *head);
+static fsme_return_t
+fsmeDoPostEvent(fsme_engine_ptr_t engine,
+				int event,
+				const void* inContext,
+				void* outContext);
+static fsme_engine_ptr_t
+fsmeGetRootEngine(fsme_engine_ptr_t engine);
+static const fsme_observer_t*
+fsmeGetObserver(fsme_engine_ptr_t engine);
+static void
+fsmeSetObserver(fsme_engine_ptr_t engine,
+				const fsme_observer_t* observer);
+static fsme_engine_ptr_t
+fsmeBeginWrite(fsme_engine_ptr_t engine);
+static void
+fsmeEndWrite(fsme_engine_ptr_t root);
+static int
+fsmeReadStatePath(fsme_engine_ptr_t engine,
+				  fsme_engine_ptr_t root,
+				  unsigned int sequence,
+				  int* stateIds,
+				  int num,
+				  int maxNum);
+static void
+fsmeDwellEnter(fsme_engine_ptr_t engine);
+static void
+fsmeDwellExit(fsme_engine_ptr_t engine,
+			  fsme_index_t state);
 
 
 
 /* ------------------ Implementations --------------------------- */
+fsme_machine_ptr_t
+fsme_compileMachine(const fsm_machine_t* stateMachine)
+{
+	return fsmeDoCompileMachine(stateMachine);
+}
+
+
+void
+fsme_releaseMachine(fsme_machine_ptr_t machine)
+{
+	if (NULL == machine) return;
+
+	if (0 == --machine->refCount) {
+		fsmeFreeMachine(machine);
+	}
+}
+
+
+fsme_engine_ptr_t
+fsme_newEngineFromMachine(fsme_machine_ptr_t machine)
+{
+	return fsmeDoNewEngine(machine, NULL, fsmeAllocator);
+}
+
+
+fsme_engine_ptr_t
+fsme_newEngineWithAllocator(fsme_machine_ptr_t machine,
+							const fsme_allocator_t* allocator)
+{
+	return fsmeDoNewEngine(machine, NULL, (NULL != allocator) ?
+		allocator : fsmeAllocator);
+}
+
+
+void
+fsme_setAllocator(const fsme_allocator_t* allocator)
+{
+	fsmeAllocator = (NULL != allocator) ? 
+		allocator : &fsmeDefaultAllocator;
+}
+
+
+const fsme_allocator_t*
+fsme_getAllocator(void)
+{
+	return fsmeAllocator;
+}
+
+
 fsme_engine_ptr_t
 fsme_newEngine(const fsm_machine_t* stateMachine)
 {
-	return fsmeDoNewEngine(stateMachine, NULL);
+	fsme_machine_ptr_t machine = NULL;
+	fsme_engine_ptr_t engine = NULL;
+
+	machine = fsmeDoCompileMachine(stateMachine);
+	if (NULL == machine) return NULL;
+
+	//the engine keeps its own reference
+	engine = fsmeDoNewEngine(machine, NULL, fsmeAllocator);
+	fsme_releaseMachine(machine);
+	return engine;
+}
+
+
+fsme_engine_ptr_t
+fsme_cloneEngine(fsme_engine_ptr_t prototype,
+				 boolean withState)
+{
+	fsme_engine_ptr_t engine = NULL;
+
+	if (NULL == prototype || NULL != prototype->cold->parent) {
+		return NULL;
+	}
+
+	engine = fsmeDoNewEngine((fsme_machine_ptr_t)prototype->machine, 
+		NULL, fsmeEngineGetAllocator(prototype));
+	if (NULL == engine) return NULL;
+	if (!fsmeCopyEngine(engine, prototype, withState)) {
+		fsme_deleteEngine(engine);
+		return NULL;
+	}
+	return engine;
+}
+
+
+int
+fsme_newEngines(fsme_machine_ptr_t machine,
+				int num,
+				fsme_engine_ptr_t* engines)
+{
+	fsme_engine_slab_t* slab = NULL;
+	fsme_engine_ptr_t first = NULL;
+	unsigned char* cursor = NULL;
+	size_t engineSize = 0;
+	int i = 0;
+
+	if (NULL == machine || NULL == engines || 0 >= num) {
+		return 0;
+	}
+
+	//The header, the engines next to each other, then
+	//for each engine its cold part and sub engines.
+	engineSize = fsmeEngineSlabSize(machine);
+	if ((size_t)num > ((size_t)-1 - FSME_CACHE_LINE_SIZE) / 
+		(sizeof(fsme_engine_t) + engineSize)) {
+		return 0;
+	}
+	slab = (fsme_engine_slab_t*)fsmeAllocate(fsmeAllocator,
+		FSME_CACHE_LINE_SIZE + 
+		(sizeof(fsme_engine_t) + engineSize) * num, 
+		FSME_CACHE_LINE_SIZE);
+	if (NULL == slab) return 0;
+
+	slab->engineNum = (unsigned int)num;
+	slab->size = FSME_CACHE_LINE_SIZE + 
+		(sizeof(fsme_engine_t) + engineSize) * num;
+	first = (fsme_engine_ptr_t)((unsigned char*)slab + 
+		FSME_CACHE_LINE_SIZE);
+	cursor = (unsigned char*)(first + num);
+	for (i = 0; i < num; i++) {
+		fsmeInitEngine(&first[i], machine, NULL, fsmeAllocator,
+			slab, &cursor);
+		first[i].cold->slabParts |= FSME_SLAB_LINE;
+		engines[i] = &first[i];
+	}
+	return num;
 }
 
 
 void
 fsme_deleteEngine(fsme_engine_ptr_t engine)
 {
-	int i = 0, j = 0;
+	const fsme_allocator_t* allocator = NULL;
+	fsme_engine_slab_t* slab = NULL;
+	unsigned int slabParts = 0;
 
 	if (NULL == engine) return;
 
-	//clear all registered actions
-	fsme_clearActions(engine);
-
-	//release transition group tables
-	for (i=0; i<engine->eventNum; i++) {
-		free(engine->triggerTable[i].transitions);
+	allocator = fsmeEngineGetAllocator(engine);
+	slab = engine->cold->slab;
+	slabParts = engine->cold->slabParts;
+	fsmeFinalizeEngine(engine);
+	if (0 == (slabParts & FSME_SLAB_LINE)) {
+		fsmeFreeEngines(allocator, engine, 1);
 	}
-	
-	//release the trigger table
-	free(engine->triggerTable);
+	//the engines of a slab may be deleted by different
+	//threads
+	if (NULL != slab && 0 == FSME_ATOMIC_ADD(&slab->engineNum, -1)) {
+		fsmeDeallocate(allocator, slab, slab->size);
+	}
+}
 
-	//release the transition table
-	free(engine->transitionTable);
 
-	//release the state table
-	for (i=0; i<engine->stateNum; i++) {
-		if (NULL != engine->stateTable[i].subEngine)
-		{
-			fsme_deleteEngine(engine->stateTable[i].subEngine);
-		}
+void
+fsme_deleteEngines(fsme_engine_ptr_t* engines,
+				   int num)
+{
+	int i = 0;
+
+	if (NULL == engines) return;
+
+	for (i = 0; i < num; i++) {
+		fsme_deleteEngine(engines[i]);
 	}
-	free(engine->stateTable);
-	
-	//release the engine
-	free(engine);
 }
 
 
@@ -215,9 +719,14 @@ fsme_startEngine(fsme_engine_ptr_t engine,
 				 const void* inContext,
 				 void* outContext)
 {
+	fsme_engine_ptr_t root = NULL;
+
 	if (!fsmeEngineStarted(engine) && 
-		NULL == engine->parent) {
-		fsmeEnterEngine(engine, inContext, outContext);
+		NULL == engine->cold->parent) {
+		root = fsmeBeginWrite(engine);
+		fsmeEnterEngine(engine, FSM_HISTORY_NONE, 
+			inContext, outContext);
+		fsmeEndWrite(root);
 		return FSME_OK;
 	} else {
 		return FSME_FORBIDDEN;
@@ -230,11 +739,15 @@ fsme_shutdownEngine(fsme_engine_ptr_t engine,
 				 const void* inContext,
 				 void* outContext)
 {
+	fsme_engine_ptr_t root = NULL;
+
 	if (fsmeEngineStarted(engine) && 
-		NULL == engine->parent) {
+		NULL == engine->cold->parent) {
+		root = fsmeBeginWrite(engine);
 		fsmeExitEngine(engine, 
                        inContext, 
                        outContext);
+		fsmeEndWrite(root);
 		return FSME_OK;
 	} else {
 		return FSME_FORBIDDEN;
@@ -242,175 +755,841 @@ fsme_shutdownEngine(fsme_engine_ptr_t engine,
 }
 
 
+fsme_return_t
+fsme_resetEngine(fsme_engine_ptr_t engine,
+				 boolean keepActions)
+{
+	fsme_engine_ptr_t root = NULL;
+
+	if (NULL == engine || NULL != engine->cold->parent) {
+		return FSME_FORBIDDEN;
+	}
+
+	//the sequence is already odd while the engine
+	//processes an event
+	root = fsmeBeginWrite(engine);
+	if (NULL == root) {
+		return FSME_FORBIDDEN;
+	}
+	fsmeResetEngine(engine, keepActions);
+	fsmeEndWrite(root);
+	return FSME_OK;
+}
+
+
+fsme_engine_ptr_t
+fsme_migrateEngine(fsme_engine_ptr_t engine,
+				   fsme_machine_ptr_t machine,
+				   fsme_stateMapFuncPtr_t mapFunc,
+				   void* context)
+{
+	fsme_engine_ptr_t retired = NULL;
+	fsme_engine_ptr_t root = NULL;
+	const fsme_machine_t* oldMachine = NULL;
+	fsme_state_t* oldStates = NULL;
+	fsme_transition_t* oldTransitions = NULL;
+	fsme_engine_cold_t* oldCold = NULL;
+	fsme_index_t state = FSME_INDEX_NONE;
+	unsigned int word = 0;
+
+	if (NULL == engine || NULL == machine || 
+		NULL != engine->cold->parent) {
+		return NULL;
+	}
+
+	//The new version is built as an engine of its own,
+	//which takes the old tables in exchange.
+	retired = fsmeDoNewEngine(machine, NULL, 
+		fsmeEngineGetAllocator(engine));
+	if (NULL == retired) return NULL;
+
+	//Hold the engine, so that no thread commits a 
+	//transition meanwhile, and write it like an event.
+	//The sequence is already odd if the engine processes
+	//an event.
+	fsme_lockEngine(engine);
+	root = fsmeBeginWrite(engine);
+	if (NULL == root || engine->eventDisabled ||
+		FSME_PHASE_NONE != fsmeEngineGetPending(engine)->phase ||
+		!fsmeMigrateEngine(retired, engine, mapFunc, context)) {
+		fsmeEndWrite(root);
+		fsme_unlockEngine(engine);
+		fsme_deleteEngine(retired);
+		return NULL;
+	}
+	state = fsmeEngineGetActiveState(retired);
+
+	//Swap the tables. A thread that read the state word
+	//before it was locked finds it changed after it
+	//read any of the new ones, and reads them again.
+	oldMachine = engine->machine;
+	oldStates = engine->stateTable;
+	oldTransitions = engine->transitionTable;
+	oldCold = engine->cold;
+	FSME_ATOMIC_STORE_PTR(&engine->machine, retired->machine);
+	FSME_ATOMIC_STORE_PTR(&engine->stateTable, retired->stateTable);
+	FSME_ATOMIC_STORE_PTR(&engine->transitionTable, 
+		retired->transitionTable);
+	FSME_ATOMIC_STORE_PTR(&engine->cold, retired->cold);
+	retired->machine = oldMachine;
+	retired->stateTable = oldStates;
+	retired->transitionTable = oldTransitions;
+	retired->cold = oldCold;
+	fsmeEngineSetActiveState(retired, FSME_INDEX_NONE);
+	fsmeAdoptSubEngines(engine);
+	fsmeAdoptSubEngines(retired);
+
+	//The engine stays in its slab, the old tables and 
+	//the retired engine holding them keep it too.
+	engine->cold->slab = (0 != (oldCold->slabParts & FSME_SLAB_LINE)) ?
+		oldCold->slab : NULL;
+	engine->cold->slabParts = oldCold->slabParts & FSME_SLAB_LINE;
+	oldCold->slabParts &= ~FSME_SLAB_LINE;
+	if (0 == oldCold->slabParts) {
+		oldCold->slab = NULL;
+	} else if (0 != engine->cold->slabParts) {
+		FSME_ATOMIC_ADD(&oldCold->slab->engineNum, 1);
+	}
+
+	//unlock in the new state, with a new generation
+	word = FSME_ATOMIC_LOAD(&engine->activeState);
+	FSME_ATOMIC_STORE(&engine->activeState, 
+		((word & ~(FSME_STATE_MASK | FSME_STATE_LOCKED | 
+		FSME_STATE_FROZEN)) | state) + FSME_STATE_GENERATION);
+	fsmeEndWrite(root);
+	return retired;
+}
+
+
 fsme_return_t
 fsme_postEvent(fsme_engine_ptr_t  engine,
 			   int event,
 			   const void* inContext,
 			   void* outContext)
 {
-    fsme_state_t const *   srcState = NULL;
-    fsme_return_t retVal = FSME_OK;
-	fsme_trigger_t const * triggerTable = NULL;
-	fsme_trigger_t const * trigger = NULL;
-	boolean validEvent = FALSE;
-	unsigned int i = 0;
+	fsme_engine_ptr_t root = NULL;
+	fsme_return_t retVal = FSME_OK;
 
 	if (NULL == engine) {
-#ifdef FSME_DEBUG
-		fprintf(stderr, 
-			"[FSME_ERROR]: Engine is NULL! \n");
-#endif
 		return FSME_ERROR_FATAL;
 	}
 
-    /* check if the engine has been started */
-	if (!fsmeEngineStarted(engine)) {
-#ifdef FSME_DEBUG
-		fprintf(stderr, 
-			"[FSME_ERROR]: Engine is not started! \n");
-#endif
+	root = fsmeBeginWrite(engine);
+	retVal = fsmeDoPostEvent(engine, event, inContext, outContext);
+	fsmeEndWrite(root);
+	return retVal;
+}
+
+
+fsme_return_t
+fsme_postEventConcurrent(fsme_engine_ptr_t engine,
+						 int event,
+						 const void* inContext,
+						 void* outContext)
+{
+	unsigned int word = 0;
+	const fsme_machine_t* machine = NULL;
+	const fsme_state_t* stateTable = NULL;
+	const fsme_transition_t* transitionTable = NULL;
+	fsme_index_t state = FSME_INDEX_NONE;
+	fsme_index_t index = FSME_INDEX_NONE;
+	fsme_index_t transition = FSME_INDEX_NONE;
+	fsme_return_t retVal = FSME_OK;
+
+	if (NULL == engine) {
+		return FSME_ERROR_FATAL;
+	}
+	if (fsmeEngineIsSub(engine)) {
 		return FSME_FORBIDDEN;
 	}
 
-    /* check if the engine has been frozen */
-	if (engine->eventDisabled) {
-#ifdef FSME_DEBUG
-		fprintf(stderr, 
-			"[FSME_ERROR]: Engine is frozen! \n");
-#endif
+	//called by an action or an observer of the engine:
+	//the thread would wait for itself
+	if (0 != (FSME_ATOMIC_LOAD(&engine->sequence) & 1) &&
+		FSME_ATOMIC_LOAD_PTR(&engine->writer) == &fsmeWriterTag) {
 		return FSME_ENGINE_FROZEN;
 	}
 
-    /* check if it is an unknown event */
-    if (event < 0 || event >= 
-		fsmeEngineGetEventCount(engine)) {
-#ifdef FSME_DEBUG
-		fprintf(stderr, 
-			"[FSME_ERROR]: Unknown event! \n");
-#endif
-        return FSME_INVALID_EVENT;
-    }
+	for (;;) {
+		word = FSME_ATOMIC_LOAD(&engine->activeState);
 
-    /* find trigger */
-    trigger = fsmeEngineFindTrigger(engine, event);
-
-    /* get current state */
-	srcState = fsmeEngineGetActiveState(engine);
-
-	/* Find corresponding transition and process it */
-	for(i = 0; i < trigger->transitionNum; i++) {
-		if (fsmeTransitionGetSourceState(trigger->
-			transitions[i]) == srcState) {
-			/* process transition */
-			retVal = fsmeProcessTransition(engine, 
-						trigger->transitions[i], 
-						inContext, 
-						outContext);
-			validEvent = TRUE;
-			break;
+		//The tables belong to the state word if it is 
+		//unchanged after they are read; 
+		//fsme_migrateEngine() swaps them.
+		machine = FSME_ATOMIC_LOAD_PTR(&engine->machine);
+		stateTable = FSME_ATOMIC_LOAD_PTR(&engine->stateTable);
+		transitionTable = FSME_ATOMIC_LOAD_PTR(&engine->transitionTable);
+		if (FSME_ATOMIC_LOAD(&engine->activeState) != word) {
+			continue;
 		}
-	}
-
-	if (!validEvent) {
-		retVal = FSME_INVALID_EVENT;
-#ifdef FSME_DEBUG
-		fprintf(stdout, 
-			"[FSME_DEBUG]: Invalid event! \n");
-#endif
-	}
 
-	return retVal;
-}
+		//Commit a trivial transition with one CAS, as long 
+		//as no thread holds the engine, it is not frozen 
+		//and nobody observes it or tracks its dwell times.
+		if (0 == (word & (FSME_STATE_LOCKED | FSME_STATE_FROZEN)) &&
+			NULL == fsmeGetObserver(engine) &&
+			NULL == FSME_ATOMIC_LOAD_PTR(&machine->dwell)) {
+			state = (fsme_index_t)(word & FSME_STATE_MASK);
+			if (FSME_INDEX_NONE == state) {
+				return FSME_FORBIDDEN;
+			}
+			index = fsmeMachineGetEventIndex(machine, event);
+			if (FSME_INDEX_NONE == index) {
+				return FSME_INVALID_EVENT;
+			}
 
+			transition = fsmeMachineFindTransition(
+				machine, state, index);
+			if (FSME_INDEX_NONE == transition) {
+				return FSME_INVALID_EVENT;
+			}
 
-fsme_engine_ptr_t
-fsme_getSubEngine(fsme_engine_ptr_t parent, 
-				  int stateId)
-{
-	fsme_engine_ptr_t subEngine = NULL;
-	fsme_state_ptr_t state = NULL;
+			if (fsmeTransitionIsTrivial(machine, stateTable,
+				transitionTable, transition)) {
+				if (FSME_ATOMIC_CAS(&engine->activeState, word, 
+					(word & ~FSME_STATE_MASK) | 
+					fsmeMachineGetTargetState(machine, transition))) {
+					return FSME_OK;
+				}
+				continue;
+			}
+		}
 
-	if (NULL != parent) {
-		state = fsmeGetStateById(parent, stateId);
-		if (NULL != state) {
-			subEngine = state->subEngine;
+		//Otherwise process the event holding the engine.
+		if (0 != (word & FSME_STATE_LOCKED)) {
+			FSME_CPU_RELAX();
+			continue;
+		}
+		if (FSME_ATOMIC_CAS(&engine->activeState, word, 
+			word | FSME_STATE_LOCKED)) {
+			retVal = fsme_postEvent(engine, 
+				event, inContext, outContext);
+			fsme_unlockEngine(engine);
+			return retVal;
 		}
 	}
-	return subEngine;
 }
 
 
-struct fsme_state*
-fsme_getCurrentState(fsme_engine_ptr_t engine)
+void
+fsme_lockEngine(fsme_engine_ptr_t engine)
 {
-	if (NULL != engine) {
-		return engine->activeState;
-	} else {
-		return NULL;
-	}
-}
+	unsigned int word = 0;
 
+	if (NULL == engine) return;
 
-fsme_engine_ptr_t
-fsme_getParent(fsme_engine_ptr_t engine)
-{
-	if (NULL != engine) {
-		return engine->parent;
-	} else {
-		return NULL;
+	for (;;) {
+		word = FSME_ATOMIC_LOAD(&engine->activeState);
+		if (0 == (word & FSME_STATE_LOCKED) &&
+			FSME_ATOMIC_CAS(&engine->activeState, word, 
+			word | FSME_STATE_LOCKED)) {
+			return;
+		}
+		FSME_CPU_RELAX();
 	}
 }
 
 
 void
-fsme_addMachineEntryAction(fsme_engine_ptr_t engine, 
-						   fsme_func_t action)
+fsme_unlockEngine(fsme_engine_ptr_t engine)
 {
-	fsme_addEngineAction(engine, TRUE, action);
-}
+	unsigned int word = 0;
 
+	if (NULL == engine) return;
 
-void
-fsme_addMachineExitAction(fsme_engine_ptr_t engine, 
-						  fsme_func_t action)
-{
-	fsme_addEngineAction(engine, FALSE, action);
+	//A frozen engine (e.g. with a suspended transition)
+	//must not take trivial transitions either.
+	word = FSME_ATOMIC_LOAD(&engine->activeState) & 
+		~(FSME_STATE_LOCKED | FSME_STATE_FROZEN);
+	if (engine->eventDisabled) {
+		word |= FSME_STATE_FROZEN;
+	}
+	FSME_ATOMIC_STORE(&engine->activeState, 
+		word + FSME_STATE_GENERATION);
 }
 
 
-void
-fsme_removeMachineEntryAction(fsme_engine_ptr_t engine, 
-							  fsme_func_t action)
+fsme_pending_t
+fsme_suspendTransition(fsme_engine_ptr_t engine)
 {
-	fsme_removeAction(&fsmeEngineGetEntryAction(engine), 
-		action);
+	fsme_pending_t handle = { NULL, 0 };
+	fsme_continuation_t* pending = NULL;
+
+	if (NULL == engine) return handle;
+
+	//Only the actions the continuation runs can be 
+	//suspended, and only once per run.
+	pending = fsmeEngineGetPending(engine);
+	if (FSME_PHASE_NONE == pending->phase || 
+		FSME_PHASE_BROADCAST == pending->phase ||
+		!engine->eventDisabled || 
+		pending->suspended) {
+		return handle;
+	}
+
+	pending->suspended = TRUE;
+	pending->generation++;
+	handle.engine = engine;
+	handle.generation = pending->generation;
+	return handle;
 }
 
 
-void
-fsme_removeMachineExitAction(fsme_engine_ptr_t engine, 
-							 fsme_func_t action)
+fsme_return_t
+fsme_resumeTransition(fsme_pending_t handle,
+					  const void* inContext,
+					  void* outContext)
 {
-	fsme_removeAction(&fsmeEngineGetExitAction(engine), 
-		action);
-}
-
+	fsme_engine_ptr_t engine = handle.engine;
+	fsme_engine_ptr_t root = NULL;
+	fsme_continuation_t* pending = NULL;
+	fsme_return_t retVal = FSME_OK;
+
+	if (NULL == engine) {
+		return FSME_ERROR_FATAL;
+	}
+
+	pending = fsmeEngineGetPending(engine);
+	if (!pending->suspended || 
+		pending->generation != handle.generation) {
+		return FSME_FORBIDDEN;
+	}
+
+	root = fsmeBeginWrite(engine);
+	pending->suspended = FALSE;
+	retVal = fsmeRunTransition(engine, inContext, outContext);
+
+	//post the events queued while the transition was
+	//suspended
+	if (FSME_ACTION_PENDING != retVal) {
+		retVal = fsmeDrainQueue(engine);
+	}
+	fsmeEndWrite(root);
+	return retVal;
+}
+
+
+fsme_return_t
+fsme_queueEvent(fsme_engine_ptr_t engine,
+				int event,
+				const void* inContext,
+				void* outContext)
+{
+	if (NULL == engine) {
+		return FSME_ERROR_FATAL;
+	}
+	return fsmeQueueEvent(engine, event, inContext, outContext);
+}
+
+
+fsme_return_t
+fsme_processEvents(fsme_engine_ptr_t engine)
+{
+	if (NULL == engine) {
+		return FSME_ERROR_FATAL;
+	}
+
+	//a suspended engine drains its queue when resumed
+	if (fsmeEngineIsSuspended(engine)) {
+		return FSME_ACTION_PENDING;
+	}
+	if (engine->eventDisabled) {
+		return FSME_ENGINE_FROZEN;
+	}
+	return fsmeDrainQueue(engine);
+}
+
+
+fsme_engine_ptr_t
+fsme_getSubEngine(fsme_engine_ptr_t parent, 
+				  int stateId)
+{
+	fsme_engine_ptr_t subEngine = NULL;
+	fsme_state_ptr_t state = NULL;
+
+	if (NULL != parent) {
+		state = fsmeGetStateById(parent, stateId);
+		if (NULL != state) {
+			subEngine = state->subEngine;
+		}
+	}
+	return subEngine;
+}
+
+
+fsme_engine_ptr_t
+fsme_getRegionEngine(fsme_engine_ptr_t parent, 
+					 int stateId,
+					 int region)
+{
+	const fsme_regions_t* regions = NULL;
+	int i = 0;
+
+	if (NULL == parent || 0 > region) return NULL;
+
+	for (i = 0; i < parent->machine->stateNum; i++) {
+		if (fsmeMachineGetStateId(parent->machine, i) == stateId) {
+			regions = fsmeMachineGetRegions(parent->machine, i);
+			if (NULL != regions && region < regions->regionNum) {
+				return &parent->stateTable[i].subEngine[region];
+			}
+			break;
+		}
+	}
+	return NULL;
+}
+
+
+fsme_return_t
+fsme_broadcastEvent(fsme_engine_ptr_t engine,
+					int event,
+					const void* inContext,
+					void* outContext)
+{
+	const fsme_regions_t* regions = NULL;
+	fsme_engine_ptr_t regionEngines = NULL;
+	fsme_engine_ptr_t root = NULL;
+	fsme_continuation_t* pending = NULL;
+	fsme_index_t transitions[FSME_REGION_MAX];
+	const fsme_chain_t* chains[FSME_REGION_MAX];
+	fsme_index_t index = FSME_INDEX_NONE;
+	unsigned int mask = 0;
+	unsigned int selected = 0;
+	boolean guardFailed = FALSE;
+	fsme_return_t retVal = FSME_OK;
+	int r = 0;
+
+	if (NULL == engine) {
+		return FSME_ERROR_FATAL;
+	}
+
+	/* the engine must be started and not frozen */
+	if (!fsmeEngineStarted(engine)) {
+		return FSME_FORBIDDEN;
+	}
+	if (engine->eventDisabled) {
+		return FSME_ENGINE_FROZEN;
+	}
+
+	/* the regions of the current state that react 
+	 * to the event at all */
+	regions = fsmeMachineGetRegions(engine->machine, 
+		fsmeEngineGetActiveState(engine));
+	if (NULL == regions || (NULL != regions->eventMask && 
+		(event < 0 || event >= regions->eventNum))) {
+		fsmeEngineNotify(engine, onInvalidEvent, event);
+		return FSME_INVALID_EVENT;
+	}
+	mask = (NULL != regions->eventMask) ? 
+		regions->eventMask[event] : ~0u;
+	regionEngines = fsmeEngineGetState(engine, 
+		fsmeEngineGetActiveState(engine))->subEngine;
+
+	/* Pass 1: find each region's transition. Nothing 
+	 * is run if one of the regions is frozen. */
+	for (r = 0; r < regions->regionNum; r++) {
+		transitions[r] = FSME_INDEX_NONE;
+		if (0 == (mask & (1u << r)) || 
+			!fsmeEngineStarted(&regionEngines[r])) {
+			continue;
+		}
+		if (regionEngines[r].eventDisabled) {
+			return FSME_ENGINE_FROZEN;
+		}
+		index = fsmeEngineGetEventIndex(&regionEngines[r], event);
+		if (FSME_INDEX_NONE != index) {
+			transitions[r] = fsmeMachineFindTransition(
+				regionEngines[r].machine, 
+				fsmeEngineGetActiveState(&regionEngines[r]), 
+				index);
+		}
+	}
+
+	/* Pass 2: evaluate guards in region order. The 
+	 * regions stay frozen until the broadcast is done, 
+	 * so that no guard or action changes their states 
+	 * meanwhile. */
+	root = fsmeBeginWrite(engine);
+	engine->eventDisabled = TRUE;
+	for (r = 0; r < regions->regionNum; r++) {
+		if (FSME_INDEX_NONE == transitions[r]) continue;
+		regionEngines[r].eventDisabled = TRUE;
+	}
+	for (r = 0; r < regions->regionNum; r++) {
+		if (FSME_INDEX_NONE == transitions[r]) continue;
+		if (fsmeCheckGuard(&regionEngines[r], transitions[r], 
+			inContext, outContext)) {
+			selected |= 1u << r;
+		} else {
+			guardFailed = TRUE;
+		}
+	}
+
+	/* The action arrays are built before anything is
+	 * left. Their transitions cannot be suspended: the
+	 * other regions would be left half way. */
+	for (r = 0; r < regions->regionNum; r++) {
+		if (0 == (selected & (1u << r))) continue;
+		chains[r] = fsmeGetChain(&regionEngines[r], transitions[r]);
+		if (NULL == chains[r]) {
+			retVal = FSME_ERROR_FATAL;
+			selected = 0;
+			break;
+		}
+	}
+	for (r = 0; r < regions->regionNum; r++) {
+		if (0 == (selected & (1u << r))) continue;
+		pending = fsmeEngineGetPending(&regionEngines[r]);
+		pending->transition = transitions[r];
+		pending->phase = FSME_PHASE_BROADCAST;
+		pending->actionCount = 0;
+	}
+
+	/* Pass 3: exit all source states, then run all 
+	 * transition actions, then enter all target states, 
+	 * each in region order. */
+	for (r = 0; r < regions->regionNum; r++) {
+		if (0 == (selected & (1u << r))) continue;
+		fsmeExitSubEngines(&regionEngines[r], 
+			fsmeMachineGetSourceState(regionEngines[r].machine, 
+			transitions[r]), 
+			inContext, outContext);
+		fsmeRunChain(&regionEngines[r], chains[r], 
+			chains[r]->actionStart, inContext, outContext);
+		regionEngines[r].eventDisabled = TRUE;
+		fsmeEngineDwellExit(&regionEngines[r], 
+			fsmeMachineGetSourceState(regionEngines[r].machine, 
+			transitions[r]));
+		fsmeEngineNotify(&regionEngines[r], onExitState, 
+			fsmeMachineGetStateId(regionEngines[r].machine, 
+			fsmeMachineGetSourceState(regionEngines[r].machine, 
+			transitions[r])));
+	}
+	for (r = 0; r < regions->regionNum; r++) {
+		if (0 == (selected & (1u << r))) continue;
+		fsmeEngineNotify(&regionEngines[r], onTransition,
+			fsmeMachineGetTransitionId(regionEngines[r].machine, 
+			transitions[r]));
+		fsmeRunChain(&regionEngines[r], chains[r], 
+			chains[r]->enterStart, inContext, outContext);
+		regionEngines[r].eventDisabled = TRUE;
+	}
+	for (r = 0; r < regions->regionNum; r++) {
+		if (0 == (selected & (1u << r))) continue;
+		fsmeEngineSetActiveState(&regionEngines[r], 
+			fsmeMachineGetTargetState(regionEngines[r].machine, 
+			transitions[r]));
+		fsmeRunChain(&regionEngines[r], chains[r], 
+			chains[r]->num, inContext, outContext);
+		regionEngines[r].eventDisabled = TRUE;
+		pending = fsmeEngineGetPending(&regionEngines[r]);
+		pending->phase = FSME_PHASE_NONE;
+		pending->actionCount = 0;
+		fsmeCompleteEnterState(&regionEngines[r], 
+			fsmeMachineGetTargetState(regionEngines[r].machine, 
+			transitions[r]), 
+			FALSE, inContext, outContext);
+	}
+	for (r = 0; r < regions->regionNum; r++) {
+		if (FSME_INDEX_NONE == transitions[r]) continue;
+		regionEngines[r].eventDisabled = FALSE;
+	}
+	engine->eventDisabled = FALSE;
+	fsmeEndWrite(root);
+
+	if (FSME_OK != retVal) {
+		return retVal;
+	} else if (0 != selected) {
+		return FSME_OK;
+	} else if (guardFailed) {
+		return FSME_TRANSITION_FAILURE;
+	} else {
+		fsmeEngineNotify(engine, onInvalidEvent, event);
+		return FSME_INVALID_EVENT;
+	}
+}
+
+
+struct fsme_state*
+fsme_getCurrentState(fsme_engine_ptr_t engine)
+{
+	if (NULL != engine && fsmeEngineStarted(engine)) {
+		return fsmeEngineGetState(engine, 
+			fsmeEngineGetActiveState(engine));
+	} else {
+		return NULL;
+	}
+}
+
+
+int
+fsme_getCurrentStateId(fsme_engine_ptr_t engine)
+{
+	if (NULL != engine && fsmeEngineStarted(engine)) {
+		return fsmeMachineGetStateId(
+			fsmeEngineGetMachine(engine), 
+			fsmeEngineGetActiveState(engine));
+	} else {
+		return FSME_FINAL_STATE_ID;
+	}
+}
+
+
+int
+fsme_getStatePath(fsme_engine_ptr_t engine,
+				  int* stateIds,
+				  int maxNum)
+{
+	fsme_engine_ptr_t root = NULL;
+	unsigned int sequence = 0;
+	int num = 0;
+
+	if (NULL == engine || NULL == stateIds || 0 >= maxNum) {
+		return 0;
+	}
+
+	root = fsmeGetRootEngine(engine);
+
+	//The path is consistent if the sequence of the root
+	//is even and unchanged after it is read. Transitions
+	//committed by fsme_postEventConcurrent() do not count,
+	//they only change the state of a root engine without
+	//regions.
+	for (;;) {
+		sequence = FSME_ATOMIC_LOAD(&root->sequence);
+
+		//called by an action or an observer: the thread 
+		//would wait for itself, and nothing changes the
+		//states while it reads them
+		if (0 != (sequence & 1) && 
+			FSME_ATOMIC_LOAD_PTR(&root->writer) == &fsmeWriterTag) {
+			return fsmeReadStatePath(engine, root, sequence, 
+				stateIds, 0, maxNum);
+		}
+		if (0 == (sequence & 1)) {
+			num = fsmeReadStatePath(engine, root, sequence, 
+				stateIds, 0, maxNum);
+			if (FSME_ATOMIC_LOAD(&root->sequence) == sequence) {
+				return num;
+			}
+		}
+		FSME_CPU_RELAX();
+	}
+}
+
+
+void
+fsme_setObserver(const fsme_observer_t* observer)
+{
+	FSME_ATOMIC_STORE_PTR(&fsmeGlobalObserver, observer);
+}
+
+
+void
+fsme_setEngineObserver(fsme_engine_ptr_t engine,
+					   const fsme_observer_t* observer)
+{
+	if (NULL != engine) {
+		fsmeSetObserver(engine, observer);
+	}
+}
+
+
+boolean
+fsme_enableDwellTracking(fsme_machine_ptr_t machine,
+						 fsme_clockFuncPtr_t clock)
+{
+	const fsme_regions_t* regions = NULL;
+	fsme_dwell_t* dwell = NULL;
+	const size_t size = (NULL != machine) ? 
+		fsmeDwellSize(machine->stateNum) : 0;
+	int i = 0, r = 0;
+
+	if (NULL == machine) return FALSE;
+
+	for (i = 0; i < machine->stateNum; i++) {
+		regions = fsmeMachineGetRegions(machine, i);
+		for (r = 0; NULL != regions && r < regions->regionNum; r++) {
+			if (!fsme_enableDwellTracking(regions->machines[r], 
+				clock)) {
+				return FALSE;
+			}
+		}
+	}
+
+	if (NULL != machine->dwell) return TRUE;
+
+	dwell = (fsme_dwell_t*)fsmeAllocate(machine->allocator,
+		size, FSME_ALLOC_ALIGN);
+	if (NULL == dwell) return FALSE;
+
+	memset(dwell, 0, size);
+	dwell->clock = (NULL != clock) ? clock : fsmeDefaultClock;
+	dwell->counters = (unsigned long long*)(dwell + 1);
+
+	//engines see the histograms only once they are set
+	FSME_ATOMIC_STORE_PTR(&machine->dwell, dwell);
+	return TRUE;
+}
+
+
+long long
+fsme_getDwellHistogram(fsme_engine_ptr_t engine,
+					   int stateId,
+					   unsigned long long* buckets,
+					   unsigned long long* total)
+{
+	const fsme_machine_t* machine = NULL;
+	const fsme_dwell_t* dwell = NULL;
+	const unsigned long long* counters = NULL;
+	unsigned long long count = 0;
+	long long num = 0;
+	int i = 0;
+
+	if (NULL == engine) return -1;
+
+	machine = fsmeEngineGetMachine(engine);
+	dwell = (const fsme_dwell_t*)FSME_ATOMIC_LOAD_PTR(&machine->dwell);
+	if (NULL == dwell) return -1;
+
+	for (i = 0; i < machine->stateNum; i++) {
+		if (fsmeMachineGetStateId(machine, i) == stateId) break;
+	}
+	if (i == machine->stateNum) return -1;
+
+	counters = dwell->counters + (size_t)i * (FSME_DWELL_BUCKET_NUM + 1);
+	for (i = 0; i < FSME_DWELL_BUCKET_NUM; i++) {
+		count = FSME_ATOMIC_LOAD64(&counters[i]);
+		if (NULL != buckets) buckets[i] = count;
+		num += (long long)count;
+	}
+	if (NULL != total) {
+		*total = FSME_ATOMIC_LOAD64(&counters[FSME_DWELL_BUCKET_NUM]);
+	}
+	return num;
+}
+
+
+boolean
+fsme_findSymbol(fsme_engine_ptr_t engine,
+				fsme_symbol_kind_t kind,
+				const char* name,
+				int* id)
+{
+	const fsme_symbol_t* symbol = NULL;
+
+	if (NULL == engine || NULL == name) return FALSE;
+
+	symbol = fsmeFindSymbol(engine->machine, kind, name);
+	if (NULL == symbol) return FALSE;
+
+	if (NULL != id) *id = symbol->id;
+	return TRUE;
+}
+
+
+const char*
+fsme_getSymbolName(fsme_engine_ptr_t engine,
+				   fsme_symbol_kind_t kind,
+				   int id)
+{
+	const fsme_machine_t* machine = NULL;
+	unsigned int slot = 0;
+
+	if (NULL == engine || NULL == engine->machine->symbols) {
+		return NULL;
+	}
+
+	machine = engine->machine;
+	for (slot = 0; slot <= machine->symbolMask; slot++) {
+		if (NULL != machine->symbols[slot].name &&
+			kind == machine->symbols[slot].kind &&
+			id == machine->symbols[slot].id) {
+			return machine->symbols[slot].name;
+		}
+	}
+	return NULL;
+}
+
+
+fsme_return_t
+fsme_postEventByName(fsme_engine_ptr_t engine,
+					 const char* name,
+					 const void* inContext,
+					 void* outContext)
+{
+	int event = 0;
+
+	if (NULL == engine) {
+		return FSME_ERROR_FATAL;
+	}
+	if (!fsme_findSymbol(engine, FSME_SYMBOL_EVENT, name, &event)) {
+		return FSME_INVALID_EVENT;
+	}
+	return fsme_postEvent(engine, event, inContext, outContext);
+}
+
+
+fsme_engine_ptr_t
+fsme_getParent(fsme_engine_ptr_t engine)
+{
+	if (NULL != engine) {
+		return engine->cold->parent;
+	} else {
+		return NULL;
+	}
+}
+
+
+boolean
+fsme_addMachineEntryAction(fsme_engine_ptr_t engine, 
+						   fsme_func_t action)
+{
+	return fsme_addEngineAction(engine, TRUE, action);
+}
+
+
+boolean
+fsme_addMachineExitAction(fsme_engine_ptr_t engine, 
+						  fsme_func_t action)
+{
+	return fsme_addEngineAction(engine, FALSE, action);
+}
+
 
 void
+fsme_removeMachineEntryAction(fsme_engine_ptr_t engine, 
+							  fsme_func_t action)
+{
+	fsme_removeAction(fsmeEngineGetAllocator(engine),
+		&fsmeEngineGetEntryAction(engine), action);
+}
+
+
+void
+fsme_removeMachineExitAction(fsme_engine_ptr_t engine, 
+							 fsme_func_t action)
+{
+	fsme_removeAction(fsmeEngineGetAllocator(engine),
+		&fsmeEngineGetExitAction(engine), action);
+}
+
+
+boolean
 fsme_addStateEntryAction(fsme_engine_ptr_t engine, 
 						 int stateId, 
 						 fsme_func_t action)
 {
-	fsme_addStateAction(engine, stateId, TRUE, action);
+	return fsme_addStateAction(engine, stateId, TRUE, action);
 }
 
 
-void
+boolean
 fsme_addStateExitAction(fsme_engine_ptr_t engine, 
 						int stateId, 
 						fsme_func_t action)
 {
-	fsme_addStateAction(engine, stateId, FALSE, action);
+	return fsme_addStateAction(engine, stateId, FALSE, action);
 }
 
 
@@ -425,8 +1604,9 @@ fsme_removeStateEntryAction(fsme_engine_ptr_t engine,
 		state = fsmeGetStateById(engine, stateId);
 		if (NULL == state) return;
 
-		fsme_removeAction(&fsmeStateGetEntryAction(state), 
-			action);
+		fsme_removeAction(fsmeEngineGetAllocator(engine),
+			&fsmeStateGetEntryAction(state), action);
+		fsmeEngineChangeActions(engine);
 	}
 }
 
@@ -443,33 +1623,43 @@ fsme_removeStateExitAction(fsme_engine_ptr_t engine,
 		state = fsmeGetStateById(engine, stateId);
 		if (NULL == state) return;
 
-		fsme_removeAction(&fsmeStateGetExitAction(state), 
-			action);
+		fsme_removeAction(fsmeEngineGetAllocator(engine),
+			&fsmeStateGetExitAction(state), action);
+		fsmeEngineChangeActions(engine);
 	}
 }
 
 
-void
+boolean
 fsme_addTransitionAction(fsme_engine_ptr_t engine, 
 						 int transitionId, 
 						 fsme_func_t action)
 {
 	fsme_transition_t* transition = NULL;
 	fsme_action_ptr_t firstAction = NULL;
+	boolean added = FALSE;
 	
 	if (NULL != engine && NULL != action) {
 		transition = fsmeGetTransitionById(engine, 
 			transitionId);
-		if (NULL == transition) return;
+		if (NULL == transition) return FALSE;
 
+		if (!fsme_unshareActionList(fsmeEngineGetAllocator(engine),
+			&transition->action)) {
+			return FALSE;
+		}
 		firstAction = fsmeTransitionGetAction(transition);
 		if (NULL != firstAction) {
-			fsme_appendAction(firstAction, action);
+			added = fsme_appendAction(fsmeEngineGetAllocator(engine), 
+				firstAction, action);
 		} else {
-			transition->action = 
-				fsme_createAction(action);
+			transition->action = fsme_createAction(
+				fsmeEngineGetAllocator(engine), action, transitionId);
+			added = (boolean)(NULL != transition->action);
 		}
+		fsmeEngineChangeActions(engine);
 	}
+	return added;
 }
 
 
@@ -485,8 +1675,10 @@ fsme_removeTransitionAction(fsme_engine_ptr_t engine,
 			transitionId);
 		if (NULL == transition) return;
 
-		fsme_removeAction(&fsmeTransitionGetAction(transition), 
+		fsme_removeAction(fsmeEngineGetAllocator(engine),
+			&fsmeTransitionGetAction(transition), 
 			action);
+		fsmeEngineChangeActions(engine);
 	}
 }
 
@@ -511,64 +1703,405 @@ fsme_setGuard(fsme_engine_ptr_t engine,
 }
 
 
-void
-fsme_clearActions(fsme_engine_ptr_t engine)
+int
+fsme_addBindings(fsme_engine_ptr_t engine,
+				 const fsme_binding_t* bindings,
+				 int num)
 {
+	const fsme_machine_t* machine = NULL;
+	fsme_action_ptr_t** tails = NULL;
+	fsme_id_index_t* stateIds = NULL;
+	fsme_id_index_t* transitionIds = NULL;
+	int* lists = NULL;
+	fsme_action_block_t* block = NULL;
+	size_t size = 0;
+	fsme_action_ptr_t node = NULL;
+	int listNum = 0, actionNum = 0, guardNum = 0, index = 0;
+	int id = 0;
 	int i = 0;
-	fsme_action_ptr_t head = NULL;
 
-	if (NULL == engine) return;
-	
-	//clear state machine actions
-	fsme_clearActionList(&engine->entryAction);
-	fsme_clearActionList(&engine->exitAction);
-
-	//clear all state actions
-	for (i = 0; i<engine->stateNum; i++) {
-		fsme_clearActionList(&engine->
-			stateTable[i].entryAction);
-		fsme_clearActionList(&engine->
-			stateTable[i].exitAction);
+	if (NULL == engine || NULL == bindings || 0 > num) {
+		return -1;
 	}
-
-	//clear all transition actions
-	for (i = 0; i<engine->transitionNum; i++) {
-		fsme_clearActionList(&engine->
+	machine = engine->machine;
+	listNum = 2 + 2 * machine->stateNum + machine->transitionNum;
+
+	//The tail of each list, the ids sorted for lookup 
+	//and the list of each row, freed when done.
+	tails = (fsme_action_ptr_t**)calloc(1, 
+		sizeof(fsme_action_ptr_t*) * listNum + 
+		sizeof(fsme_id_index_t) * 
+		(machine->stateNum + machine->transitionNum) +
+		sizeof(int) * num);
+	if (NULL == tails) return -1;
+	stateIds = (fsme_id_index_t*)(tails + listNum);
+	transitionIds = stateIds + machine->stateNum;
+	lists = (int*)(transitionIds + machine->transitionNum);
+
+	for (i = 0; i < machine->stateNum; i++) {
+		stateIds[i].id = fsmeMachineGetStateId(machine, i);
+		stateIds[i].index = (fsme_index_t)i;
+	}
+	for (i = 0; i < machine->transitionNum; i++) {
+		transitionIds[i].id = fsmeMachineGetTransitionId(machine, i);
+		transitionIds[i].index = (fsme_index_t)i;
+	}
+	qsort(stateIds, machine->stateNum, sizeof(fsme_id_index_t),
+		fsmeCompareIdIndex);
+	qsort(transitionIds, machine->transitionNum, 
+		sizeof(fsme_id_index_t), fsmeCompareIdIndex);
+
+	//////////////////////////////
+	//Resolve the list of each row; a guard row is 
+	//given the number of lists plus its transition.
+	//////////////////////////////
+	for (i = 0; i < num; i++) {
+		switch (bindings[i].kind) {
+		case FSME_BIND_MACHINE_ENTRY:
+		case FSME_BIND_MACHINE_EXIT:
+			//the machine lists are 0 and 1, as their kinds
+			index = 0;
+			lists[i] = (int)bindings[i].kind;
+			break;
+		case FSME_BIND_STATE_ENTRY:
+		case FSME_BIND_STATE_EXIT:
+			index = !fsmeGetBindingId(machine, &bindings[i], 
+				FSME_SYMBOL_STATE, &id) ? -1 :
+				fsmeFindIdIndex(stateIds, machine->stateNum, id);
+			lists[i] = 2 + 2 * index + 
+				(FSME_BIND_STATE_EXIT == bindings[i].kind);
+			break;
+		case FSME_BIND_TRANSITION:
+		case FSME_BIND_GUARD:
+			index = !fsmeGetBindingId(machine, &bindings[i], 
+				FSME_SYMBOL_TRANSITION, &id) ? -1 :
+				fsmeFindIdIndex(transitionIds, 
+				machine->transitionNum, id);
+			lists[i] = (FSME_BIND_GUARD == bindings[i].kind) ? 
+				listNum + index : 2 + 2 * machine->stateNum + index;
+			break;
+		default:
+			index = -1;
+			break;
+		}
+		if (0 > index) {
+			free(tails);
+			return -1;
+		}
+		if (FSME_BIND_GUARD == bindings[i].kind) {
+			guardNum++;
+		} else if (NULL != bindings[i].action) {
+			actionNum++;
+		}
+	}
+
+	//////////////////////////////
+	//Find the tail of each list used, copying the 
+	//shared ones, and allocate the actions in one 
+	//block. Nothing is installed if either fails.
+	//////////////////////////////
+	for (i = 0; i < num; i++) {
+		if (listNum <= lists[i] || NULL == bindings[i].action ||
+			NULL != tails[lists[i]]) {
+			continue;
+		}
+		tails[lists[i]] = fsmeGetActionList(engine, lists[i]);
+		if (!fsme_unshareActionList(fsmeEngineGetAllocator(engine), 
+			tails[lists[i]])) {
+			free(tails);
+			return -1;
+		}
+		while (NULL != *tails[lists[i]]) {
+			tails[lists[i]] = &(*tails[lists[i]])->next;
+		}
+	}
+
+	if (0 < actionNum) {
+		size = sizeof(fsme_action_block_t) + 
+			sizeof(fsme_action_t) * actionNum;
+		block = (fsme_action_block_t*)fsmeAllocate(
+			fsmeEngineGetAllocator(engine), size, FSME_ALLOC_ALIGN);
+		if (NULL == block) {
+			free(tails);
+			return -1;
+		}
+		block->nodes = (fsme_action_t*)(block + 1);
+		block->nodeNum = actionNum;
+		block->size = size;
+		node = block->nodes;
+	}
+
+	//////////////////////////////
+	//Install the guards and append the actions
+	//////////////////////////////
+	for (i = 0; i < num; i++) {
+		if (listNum <= lists[i]) {
+			fsmeEngineGetTransition(engine, 
+				lists[i] - listNum)->guard = bindings[i].guard;
+			continue;
+		}
+		if (NULL == bindings[i].action) continue;
+
+		//the actions of a list share its id
+		node->action = bindings[i].action;
+		node->id = (2 > lists[i]) ? machine->id :
+			(2 + 2 * machine->stateNum > lists[i]) ? 
+			fsmeMachineGetStateId(machine, (lists[i] - 2) / 2) :
+			fsmeMachineGetTransitionId(machine, 
+			lists[i] - 2 - 2 * machine->stateNum);
+		node->refCount = 1;
+		node->block = block;
+		node->next = NULL;
+		*tails[lists[i]] = node;
+		tails[lists[i]] = &node->next;
+		node++;
+	}
+
+	free(tails);
+	fsmeEngineChangeActions(engine);
+	return actionNum + guardNum;
+}
+
+
+void
+fsme_clearActions(fsme_engine_ptr_t engine)
+{
+	const fsme_allocator_t* allocator = NULL;
+	const fsme_continuation_t* pending = NULL;
+	fsme_chain_t* chain = NULL;
+	int i = 0;
+
+	if (NULL == engine) return;
+	
+	allocator = fsmeEngineGetAllocator(engine);
+	pending = fsmeEngineGetPending(engine);
+
+	//clear state machine actions
+	fsme_clearActionList(allocator, &engine->cold->entryAction);
+	fsme_clearActionList(allocator, &engine->cold->exitAction);
+
+	//clear all state actions
+	for (i = 0; i<engine->machine->stateNum; i++) {
+		fsme_clearActionList(allocator, &engine->
+			stateTable[i].entryAction);
+		fsme_clearActionList(allocator, &engine->
+			stateTable[i].exitAction);
+	}
+
+	//Clear all transition actions and their fused arrays.
+	//The array of a transition in progress, e.g. cleared
+	//by one of its actions or while it is suspended, is
+	//still run from; it is only made stale, and freed
+	//when it is rebuilt or the engine is finalized.
+	for (i = 0; i<engine->machine->transitionNum; i++) {
+		chain = engine->transitionTable[i].chain;
+		fsme_clearActionList(allocator, &engine->
 			transitionTable[i].action);
+		if (FSME_PHASE_NONE != pending->phase &&
+			i == pending->transition) {
+			continue;
+		}
+		if (NULL != chain) {
+			fsmeDeallocate(allocator, chain, 
+				fsmeChainSize(chain->num));
+		}
+		engine->transitionTable[i].chain = NULL;
 	}
+	fsmeEngineChangeActions(engine);
 }
 
 
 /* -------------- Local Function Definitions -------------------- */
+static fsme_return_t
+fsmeDoPostEvent(fsme_engine_ptr_t engine,
+				int event,
+				const void* inContext,
+				void* outContext)
+{
+    fsme_return_t retVal = FSME_OK;
+	fsme_index_t index = FSME_INDEX_NONE;
+	fsme_index_t transition = FSME_INDEX_NONE;
+
+    /* check if the engine has been started */
+	if (!fsmeEngineStarted(engine)) {
+		return FSME_FORBIDDEN;
+	}
+
+    /* check if the engine has been frozen */
+	if (engine->eventDisabled) {
+		/* queue the event until the suspended 
+		 * transition is resumed */
+		if (fsmeEngineIsSuspended(engine)) {
+			return fsmeQueueEvent(engine, 
+				event, inContext, outContext);
+		}
+		return FSME_ENGINE_FROZEN;
+	}
+
+    /* check if it is an unknown event */
+	index = fsmeEngineGetEventIndex(engine, event);
+    if (FSME_INDEX_NONE == index) {
+		fsmeEngineNotify(engine, onInvalidEvent, event);
+        return FSME_INVALID_EVENT;
+    }
+
+	/* Find the transition the event triggers in the 
+	 * current state */
+	transition = fsmeMachineFindTransition(
+		fsmeEngineGetMachine(engine), 
+		fsmeEngineGetActiveState(engine), 
+		index);
+
+	if (FSME_INDEX_NONE != transition) {
+		/* process transition */
+		retVal = fsmeProcessTransition(engine, 
+					transition, 
+					inContext, 
+					outContext);
+	} else {
+		retVal = FSME_INVALID_EVENT;
+		fsmeEngineNotify(engine, onInvalidEvent, event);
+	}
+
+	return retVal;
+}
+
+
+static fsme_engine_ptr_t
+fsmeGetRootEngine(fsme_engine_ptr_t engine)
+{
+	while (fsmeEngineIsSub(engine)) {
+		engine = engine->cold->parent;
+	}
+	return engine;
+}
+
+
+static const fsme_observer_t*
+fsmeGetObserver(fsme_engine_ptr_t engine)
+{
+	const fsme_observer_t* observer = (const fsme_observer_t*)
+		FSME_ATOMIC_LOAD_PTR(&engine->observer);
+
+	return (NULL != observer) ? observer : (const fsme_observer_t*)
+		FSME_ATOMIC_LOAD_PTR(&fsmeGlobalObserver);
+}
+
+
+static void
+fsmeSetObserver(fsme_engine_ptr_t engine,
+				const fsme_observer_t* observer)
+{
+	fsme_engine_ptr_t subEngine = NULL;
+	int i = 0, r = 0;
+
+	FSME_ATOMIC_STORE_PTR(&engine->observer, observer);
+	for (i = 0; i < engine->machine->stateNum; i++) {
+		subEngine = engine->stateTable[i].subEngine;
+		for (r = 0; r < fsmeMachineGetRegionNum(engine->machine, 
+			i); r++) {
+			fsmeSetObserver(&subEngine[r], observer);
+		}
+	}
+}
+
+
+static fsme_engine_ptr_t
+fsmeBeginWrite(fsme_engine_ptr_t engine)
+{
+	fsme_engine_ptr_t root = NULL;
+	unsigned int sequence = 0;
+
+	root = fsmeGetRootEngine(engine);
+
+	//Only the thread processing the event writes the 
+	//sequence. It is already odd if an action posts 
+	//an event to the engine.
+	sequence = root->sequence;
+	if (0 != (sequence & 1)) {
+		return NULL;
+	}
+	FSME_ATOMIC_STORE(&root->sequence, sequence + 1);
+	FSME_ATOMIC_STORE_PTR(&root->writer, &fsmeWriterTag);
+	return root;
+}
+
+
+static void
+fsmeEndWrite(fsme_engine_ptr_t root)
+{
+	if (NULL != root) {
+		FSME_ATOMIC_STORE_PTR(&root->writer, NULL);
+		FSME_ATOMIC_STORE(&root->sequence, root->sequence + 1);
+	}
+}
+
+
+static int
+fsmeReadStatePath(fsme_engine_ptr_t engine,
+				  fsme_engine_ptr_t root,
+				  unsigned int sequence,
+				  int* stateIds,
+				  int num,
+				  int maxNum)
+{
+	const fsme_regions_t* regions = NULL;
+	const fsme_index_t state = fsmeEngineGetActiveState(engine);
+	const fsme_machine_t* const machine = 
+		FSME_ATOMIC_LOAD_PTR(&engine->machine);
+	fsme_state_t* const stateTable = 
+		FSME_ATOMIC_LOAD_PTR(&engine->stateTable);
+	int r = 0;
+
+	//The tables may have been swapped by 
+	//fsme_migrateEngine() since the state was read, 
+	//then the sequence has changed and the caller 
+	//reads the path again.
+	if (FSME_INDEX_NONE == state || num >= maxNum ||
+		FSME_ATOMIC_LOAD(&root->sequence) != sequence) {
+		return num;
+	}
+
+	stateIds[num++] = fsmeMachineGetStateId(machine, state);
+
+	regions = fsmeMachineGetRegions(machine, state);
+	if (NULL != regions) {
+		for (r = 0; r < regions->regionNum; r++) {
+			num = fsmeReadStatePath(&stateTable[state].subEngine[r], 
+				root, sequence, stateIds, num, maxNum);
+		}
+	}
+	return num;
+}
+
+
 static void
 fsmeEnterEngine(fsme_engine_ptr_t engine,
+				fsm_history_t history,
 				const void* inContext,
 				void* outContext)
 {
-#ifdef FSME_DEBUG
-	fprintf(stdout, 
-		"[FSME_DEBUG]: Entering engine(id=%d)... \n", 
-		engine->id);
-#endif
+	fsme_index_t targetState = fsmEngineGetEntryState(engine);
+
+	//Resume the state the engine was in when it was 
+	//last exited, if entered with history.
+	if (FSM_HISTORY_NONE != history && 
+		FSME_INDEX_NONE != engine->cold->historyState) {
+		targetState = engine->cold->historyState;
+	}
 
 	/* execute entry action */
 	fsme_processActions(engine, 
 		fsmeEngineGetEntryAction(engine), 
-		engine->id, 
 		inContext, 
 		outContext);
 
-	/* Enter entry state */
+	/* Enter entry (or history) state */
 	fsmeEnterState(engine, 
-				fsmEngineGetEntryState(engine), 
+				targetState, 
+				(boolean)(FSM_HISTORY_DEEP == history),
 				inContext, 
 				outContext); 
-
-#ifdef FSME_DEBUG
-	fprintf(stdout, 
-		"[FSME_DEBUG]: Engine(id=%d) entered. \n", 
-		engine->id);
-#endif
 }
 
 
@@ -577,305 +2110,696 @@ fsmeExitEngine(fsme_engine_ptr_t engine,
 			   const void* inContext,
 			   void* outContext)
 {
-#ifdef FSME_DEBUG
-	fprintf(stdout, 
-		"[FSME_DEBUG]: Exiting engine(id=%d)... \n", 
-		engine->id);
-#endif
+	const fsme_index_t activeState = 
+		fsmeEngineGetActiveState(engine);
+	fsme_engine_ptr_t subEngine = NULL;
+	int r = 0;
+
+	//drop a suspended transition and the queued events
+	fsmeCancelTransition(engine);
+	fsmeClearQueue(engine);
+
+	//Exit the sub engines of the active state first, 
+	//so that nested engines record their history too.
+	if (FSME_INDEX_NONE != activeState) {
+		subEngine = fsmeEngineGetState(engine, 
+			activeState)->subEngine;
+		for (r = 0; r < fsmeMachineGetRegionNum(engine->machine, 
+			activeState); r++) {
+			if (fsmeEngineStarted(&subEngine[r])) {
+				fsmeExitEngine(&subEngine[r], 
+					inContext, outContext);
+			}
+		}
+	}
+
+	//Remember the active state for history, unless the 
+	//engine is exited because it reached its final state.
+	if (FSME_INDEX_NONE != activeState &&
+		!fsmeMachineStateIsFinal(engine->machine, activeState)) {
+		engine->cold->historyState = activeState;
+	} else {
+		engine->cold->historyState = FSME_INDEX_NONE;
+	}
+	if (FSME_INDEX_NONE != activeState) {
+		fsmeEngineDwellExit(engine, activeState);
+		fsmeEngineNotify(engine, onExitState, 
+			fsmeMachineGetStateId(engine->machine, activeState));
+	}
 
 	/* execute exit action */
 	fsme_processActions(engine, 
 		fsmeEngineGetExitAction(engine), 
-		engine->id, 
 		inContext, 
 		outContext);
 
-	/* set active state to NULL */
-	fsmeEngineSetActiveState(engine, NULL);
-
-#ifdef FSME_DEBUG
-	fprintf(stdout, 
-		"[FSME_DEBUG]: Engine(id=%d) exited. \n", 
-		engine->id);
-#endif
+	/* clear the active state */
+	fsmeEngineSetActiveState(engine, FSME_INDEX_NONE);
 }
 
 
 
 static void
 fsmeEnterState(fsme_engine_ptr_t engine,
-			   fsme_state_t const * targetState,
+			   fsme_index_t targetState,
+			   boolean deepHistory,
 			   const void* inContext,
 			   void* outContext)
 {
-#ifdef FSME_DEBUG
-	fprintf(stdout, 
-		"[FSME_DEBUG]: Entering state(id=%d)... \n", 
-		targetState->id);
-#endif
+	const fsme_state_ptr_t state = 
+		fsmeEngineGetState(engine, targetState);
 	
 	//set current state
-	fsmeEngineSetActiveState(engine, 
-		(fsme_state_ptr_t)targetState);
+	fsmeEngineSetActiveState(engine, targetState);
 
     // execute entry actions
 	fsme_processActions(engine, 
-		fsmeStateGetAction(targetState, TRUE), 
-		targetState->id, 
+		fsmeStateGetAction(state, TRUE), 
 		inContext, 
 		outContext);
 
-     //If the state is asociated with a sub state machine, 
-	 //then start the sub state machine.
-	if (NULL != targetState->subEngine) {
-		fsmeEnterEngine(targetState->subEngine, 
+	fsmeCompleteEnterState(engine, targetState, deepHistory,
+		inContext, outContext);
+}
+
+
+static void
+fsmeCompleteEnterState(fsme_engine_ptr_t engine,
+					   fsme_index_t targetState,
+					   boolean deepHistory,
+					   const void* inContext,
+					   void* outContext)
+{
+	const fsme_machine_t* machine = fsmeEngineGetMachine(engine);
+	const fsme_state_ptr_t state = 
+		fsmeEngineGetState(engine, targetState);
+	int r = 0;
+
+	fsmeEngineDwellEnter(engine);
+	fsmeEngineNotify(engine, onEnterState, 
+		fsmeMachineGetStateId(machine, targetState));
+
+     //If the state is asociated with sub state machines
+	 //(regions), then start them in region order. Deep 
+	 //history applies to every nested level.
+	for (r = 0; r < fsmeMachineGetRegionNum(machine, 
+		targetState); r++) {
+		fsmeEnterEngine(&state->subEngine[r], 
+			deepHistory ? FSM_HISTORY_DEEP : 
+			fsmeMachineGetStateHistory(machine, targetState),
 			inContext,
 			outContext);
 	}    
 
 	//if the target state is the final state,
 	//exit the engine
-	if (fsmeStateIsFinal(targetState)) {
-#ifdef FSME_DEBUG
-		fprintf(stdout, 
-			"[FSME_DEBUG]: State(id=%d) entered. \n", 
-			targetState->id);
-#endif
+	if (fsmeMachineStateIsFinal(machine, targetState)) {
 		fsmeExitEngine(engine, inContext, outContext);
-	} else {
-#ifdef FSME_DEBUG
-		fprintf(stdout, 
-			"[FSME_DEBUG]: State(id=%d) entered. \n", 
-			targetState->id);
-#endif
 	}
 }
 
 
 static void
-fsmeExitState(fsme_engine_ptr_t engine,
-			  fsme_state_ptr_t  srcState,
-			  const void* inContext,
-			  void* outContext)
+fsmeExitSubEngines(fsme_engine_ptr_t engine,
+				   fsme_index_t srcState,
+				   const void* inContext,
+				   void* outContext)
 {
-#ifdef FSME_DEBUG
-	fprintf(stdout, 
-		"[FSME_DEBUG]: Exiting state(id=%d)... \n", 
-		srcState->id);
-#endif
-
-     //If the state is asociated with a sub state machine, 
-	 //then exit the sub state machine.
-	if (NULL != srcState->subEngine) {
-		fsmeExitEngine(srcState->subEngine, 
+	const fsme_state_ptr_t state = 
+		fsmeEngineGetState(engine, srcState);
+	int r = 0;
+
+     //If the state is asociated with sub state machines
+	 //(regions), then exit them in region order.
+	for (r = 0; r < fsmeMachineGetRegionNum(
+		fsmeEngineGetMachine(engine), srcState); r++) {
+		fsmeExitEngine(&state->subEngine[r], 
 			inContext, 
 			outContext);
 	}
+}
 
-    // execute exit actions
-	fsme_processActions(engine, 
-		fsmeStateGetAction(srcState, FALSE), 
-		srcState->id, 
-		inContext, 
-		outContext);
 
-#ifdef FSME_DEBUG
-	fprintf(stdout, 
-		"[FSME_DEBUG]: State(id=%d) exited. \n", 
-		srcState->id);
-#endif
+static boolean
+fsmeTransitionIsTrivial(const fsme_machine_t* machine,
+						const fsme_state_t* stateTable,
+						const fsme_transition_t* transitionTable,
+						fsme_index_t transitionIndex)
+{
+	const fsme_transition_t* transition = 
+		&transitionTable[transitionIndex];
+	const fsme_index_t srcState = 
+		fsmeMachineGetSourceState(machine, transitionIndex);
+	const fsme_index_t tgtState = 
+		fsmeMachineGetTargetState(machine, transitionIndex);
+
+	//nothing but the active state changes
+	return (boolean)(!fsmeTransitionHasGuard(transition) &&
+		!fsmeTransitionHasAction(transition) &&
+		NULL == stateTable[srcState].exitAction &&
+		NULL == stateTable[tgtState].entryAction &&
+		0 == fsmeMachineGetRegionNum(machine, srcState) &&
+		0 == fsmeMachineGetRegionNum(machine, tgtState) &&
+		!fsmeMachineStateIsFinal(machine, tgtState));
+}
+
+
+static boolean
+fsmeCheckGuard(fsme_engine_ptr_t engine,
+			   fsme_index_t transitionIndex,
+			   const void* inContext,
+			   void* outContext)
+{
+	fsme_transition_t* const transition = 
+		fsmeEngineGetTransition(engine, transitionIndex);
+	const int transitionId = fsmeMachineGetTransitionId(
+		fsmeEngineGetMachine(engine), transitionIndex);
+
+	if (fsmeTransitionHasGuard(transition) &&
+		!fsmeTransitionGetGuard(transition)(transitionId, 
+		inContext, 
+		outContext)) {
+		fsmeEngineNotify(engine, onGuardFailure, transitionId);
+		return FALSE;
+	} 
+	return TRUE;
 }
 
 
 static fsme_return_t
 fsmeProcessTransition(fsme_engine_ptr_t engine,
-					  fsme_transition_t* transition,
+					  fsme_index_t transitionIndex,
 					  const void* inContext,
 					  void* outContext)
 {
     fsme_return_t retVal = FSME_OK;
 
-	const fsme_state_ptr_t srcState = 
-		fsmeTransitionGetSourceState(transition);
-	const fsme_state_ptr_t tgtState = 
-		fsmeTransitionGetTargetState(transition);
+	fsme_continuation_t* const pending = 
+		fsmeEngineGetPending(engine);
+	const fsme_index_t srcState = fsmeMachineGetSourceState(
+		fsmeEngineGetMachine(engine), transitionIndex);
 	
-	if (fsmeTransitionHasGuard(transition)) {
-		if (fsmeTransitionGetGuard(transition)(transition->id, 
-		inContext, 
-		outContext)) {
-#ifdef FSME_DEBUG
-		    fprintf(stdout, 
-			    "[FSME_DEBUG]: Transition(id=%d) guard check succeeded. \n", 
-			    transition->id);
-#endif
-        } else {
-#ifdef FSME_DEBUG
-		    fprintf(stdout, 
-			    "[FSME_DEBUG]: Transition(id=%d) guard check failed. \n", 
-			    transition->id);
-#endif
-     		retVal = FSME_TRANSITION_FAILURE;
-            return retVal;
-        }
+	if (!fsmeCheckGuard(engine, transitionIndex, 
+		inContext, outContext)) {
+     	retVal = FSME_TRANSITION_FAILURE;
+        return retVal;
 	} 
 
-	//exit the src state
-	fsmeExitState(engine, srcState, inContext, outContext);
-		
-	//process transition actions
-	fsme_processActions(engine, 
-		fsmeTransitionGetAction(transition), 
-		transition->id, 
-		inContext, 
-		outContext);
+	//The exit, transition and entry actions are run
+	//from a continuation, so that one of them can 
+	//suspend the transition. Their array is built 
+	//before anything is left.
+	if (NULL == fsmeGetChain(engine, transitionIndex)) {
+		return FSME_ERROR_FATAL;
+	}
 
-	//enter the target state
-	fsmeEnterState(engine, tgtState, inContext, outContext);
+	fsmeEngineNotify(engine, onTransition, fsmeMachineGetTransitionId(
+		fsmeEngineGetMachine(engine), transitionIndex));
+		
+	//exit the sub engines of the src state
+	fsmeExitSubEngines(engine, srcState, inContext, outContext);
 
+	pending->transition = transitionIndex;
+	pending->phase = FSME_PHASE_EXIT;
+	pending->actionCount = 0;
+	retVal = fsmeRunTransition(engine, inContext, outContext);
 
 	return retVal;
 }
 
 
-static void 
-fsme_processActions(fsme_engine_ptr_t engine, 
-					fsme_action_ptr_t actionNode, 
-					int id, 
-					const void* inContext, 
-					void* outContext)
+static fsme_return_t
+fsmeRunTransition(fsme_engine_ptr_t engine,
+				  const void* inContext,
+				  void* outContext)
+{
+	const fsme_machine_t* machine = fsmeEngineGetMachine(engine);
+	fsme_continuation_t* const pending = 
+		fsmeEngineGetPending(engine);
+	const fsme_index_t transitionIndex = pending->transition;
+	const fsme_index_t tgtState = 
+		fsmeMachineGetTargetState(machine, transitionIndex);
+	const fsme_chain_t* const chain = 
+		fsmeEngineGetTransition(engine, transitionIndex)->chain;
+
+	if (NULL == chain) return FSME_ERROR_FATAL;
+
+	switch (pending->phase) {
+	case FSME_PHASE_EXIT:
+		//exit the src state and process transition actions
+		if (!fsmeRunChain(engine, chain, chain->enterStart,
+			inContext, outContext)) {
+			return FSME_ACTION_PENDING;
+		}
+		fsmeEngineDwellExit(engine, 
+			fsmeMachineGetSourceState(machine, transitionIndex));
+		fsmeEngineNotify(engine, onExitState, 
+			fsmeMachineGetStateId(machine, 
+			fsmeMachineGetSourceState(machine, transitionIndex)));
+		pending->phase = FSME_PHASE_ENTER;
+
+		//set current state
+		fsmeEngineSetActiveState(engine, tgtState);
+		/* fall through */
+
+	case FSME_PHASE_ENTER:
+		//enter the target state
+		if (!fsmeRunChain(engine, chain, chain->num,
+			inContext, outContext)) {
+			return FSME_ACTION_PENDING;
+		}
+		break;
+
+	default:
+		return FSME_ERROR_FATAL;
+	}
+
+	pending->phase = FSME_PHASE_NONE;
+	pending->actionCount = 0;
+	fsmeCompleteEnterState(engine, tgtState, FALSE, 
+		inContext, outContext);
+
+	return FSME_OK;
+}
+
+
+static boolean
+fsmeRunChain(fsme_engine_ptr_t engine, 
+			 const fsme_chain_t* chain,
+			 int end,
+			 const void* inContext, 
+			 void* outContext)
 {
+	fsme_continuation_t* const pending = 
+		fsmeEngineGetPending(engine);
+	const fsme_chain_entry_t* const last = chain->entries + end;
+	const fsme_chain_entry_t* entry = 
+		chain->entries + pending->actionCount;
+
+	//start after the actions run before the transition
+	//was suspended
 	engine->eventDisabled = TRUE;
-	while (NULL != actionNode) {
-		if (NULL != actionNode->action) {
-			actionNode->action(id, 
-				inContext, 
-				outContext);
+	while (entry < last) {
+		pending->actionCount++;
+		entry->action(entry->id, inContext, outContext);
+		entry++;
+
+		//the engine stays frozen until it is resumed
+		if (pending->suspended) {
+			return FALSE;
 		}
-		actionNode = actionNode->next;
 	};
 	engine->eventDisabled = FALSE;
+	return TRUE;
 }
 
 
-static fsme_action_ptr_t
-fsme_getLastAction(fsme_action_ptr_t headNode)
+static const fsme_chain_t*
+fsmeGetChain(fsme_engine_ptr_t engine,
+			 fsme_index_t transitionIndex)
 {
-	fsme_action_ptr_t rtn = NULL;
-	fsme_action_ptr_t tmpNode = NULL;
+	const fsme_machine_t* machine = fsmeEngineGetMachine(engine);
+	fsme_transition_t* const transition = 
+		fsmeEngineGetTransition(engine, transitionIndex);
+	const fsme_state_ptr_t srcState = fsmeEngineGetState(engine,
+		fsmeMachineGetSourceState(machine, transitionIndex));
+	const fsme_state_ptr_t tgtState = fsmeEngineGetState(engine,
+		fsmeMachineGetTargetState(machine, transitionIndex));
+	fsme_chain_t* chain = transition->chain;
+	fsme_chain_entry_t* entry = NULL;
+	fsme_action_ptr_t actionNode = NULL;
+	int num = 0;
+
+	//rebuilt only if actions were added or removed
+	if (NULL != chain && 
+		chain->generation == engine->cold->chainGeneration) {
+		return chain;
+	}
 
-	if (NULL != headNode) {
-		tmpNode = headNode;
-		while (tmpNode)	{
-			rtn = tmpNode;
-			tmpNode = tmpNode->next;
+	for (actionNode = fsmeStateGetExitAction(srcState); 
+		NULL != actionNode; actionNode = actionNode->next) {
+		num += (NULL != actionNode->action);
+	}
+	for (actionNode = fsmeTransitionGetAction(transition); 
+		NULL != actionNode; actionNode = actionNode->next) {
+		num += (NULL != actionNode->action);
+	}
+	for (actionNode = fsmeStateGetEntryAction(tgtState); 
+		NULL != actionNode; actionNode = actionNode->next) {
+		num += (NULL != actionNode->action);
+	}
+
+	if (NULL != chain) {
+		fsmeDeallocate(fsmeEngineGetAllocator(engine), chain,
+			fsmeChainSize(chain->num));
+	}
+	chain = (fsme_chain_t*)fsmeAllocate(fsmeEngineGetAllocator(engine),
+		fsmeChainSize(num), FSME_ALLOC_ALIGN);
+	transition->chain = chain;
+	if (NULL == chain) return NULL;
+
+	chain->generation = engine->cold->chainGeneration;
+	chain->entries = (fsme_chain_entry_t*)(chain + 1);
+
+	entry = fsmeFillChain(chain->entries, 
+		fsmeStateGetExitAction(srcState));
+	chain->actionStart = (int)(entry - chain->entries);
+	entry = fsmeFillChain(entry, 
+		fsmeTransitionGetAction(transition));
+	chain->enterStart = (int)(entry - chain->entries);
+	entry = fsmeFillChain(entry, 
+		fsmeStateGetEntryAction(tgtState));
+	chain->num = (int)(entry - chain->entries);
+
+	return chain;
+}
+
+
+static fsme_chain_entry_t*
+fsmeFillChain(fsme_chain_entry_t* entry,
+			  fsme_action_ptr_t actionNode)
+{
+	for (; NULL != actionNode; actionNode = actionNode->next) {
+		if (NULL != actionNode->action) {
+			entry->action = actionNode->action;
+			entry->id = actionNode->id;
+			entry++;
 		}
 	}
-	return rtn;
+	return entry;
 }
 
 
-static fsme_action_ptr_t
-fsme_createAction(fsme_func_t func)
+static void
+fsmeCancelTransition(fsme_engine_ptr_t engine)
 {
-	fsme_action_ptr_t newAction = NULL;
+	fsme_continuation_t* const pending = 
+		fsmeEngineGetPending(engine);
 
-	if (NULL != func) {
-		newAction = (fsme_action_ptr_t)
-			malloc(sizeof(struct fsme_action));
-		assert(newAction);
+	if (FSME_PHASE_NONE == pending->phase) return;
 
-		newAction->action = func;
-		newAction->next = NULL;
-		}
-	return newAction;
+	pending->phase = FSME_PHASE_NONE;
+	pending->suspended = FALSE;
+	pending->actionCount = 0;
+	engine->eventDisabled = FALSE;
 }
 
 
 static void
-fsme_addEngineAction(fsme_engine_ptr_t engine,
-					 boolean wantEntryAction,
-					 fsme_func_t action)
+fsmeClearQueue(fsme_engine_ptr_t engine)
 {
-	fsme_action_ptr_t firstAction = NULL;
-	
-	if (NULL != engine && NULL != action) {
+	int lane = 0;
+
+	for (lane = 0; lane < FSME_PRIORITY_NUM; lane++) {
+		engine->cold->queue[lane].head = 0;
+		engine->cold->queue[lane].count = 0;
+	}
+}
+
+
+static fsme_return_t
+fsmeDrainQueue(fsme_engine_ptr_t engine)
+{
+	fsme_queued_event_t queued;
+
+	//Post the queued events until the transition of 
+	//one of them is suspended. Events queued meanwhile 
+	//are drained too, in priority order.
+	while (fsmeDequeueEvent(engine, &queued)) {
+		if (FSME_ACTION_PENDING == fsme_postEvent(engine, 
+			queued.event, 
+			queued.inContext, 
+			queued.outContext)) {
+			return FSME_ACTION_PENDING;
+		}
+	}
+	return FSME_OK;
+}
+
+
+static fsme_return_t
+fsmeQueueEvent(fsme_engine_ptr_t engine,
+			   int event,
+			   const void* inContext,
+			   void* outContext)
+{
+	fsme_event_queue_t* queue = NULL;
+	fsme_queued_event_t* events = NULL;
+	fsme_queued_event_t* queued = NULL;
+	fsm_queue_policy_t policy = FSM_QUEUE_ALWAYS;
+	fsme_index_t index = FSME_INDEX_NONE;
+	int capacity = 0;
+	int i = 0;
+
+	index = fsmeEngineGetEventIndex(engine, event);
+	if (FSME_INDEX_NONE == index) {
+		return FSME_INVALID_EVENT;
+	}
+
+	//an event always goes to the same lane
+	queue = &engine->cold->queue[fsmeMachineGetEventPriority(
+		fsmeEngineGetMachine(engine), index)];
+
+	//apply the queue policy of the event if it is
+	//already queued
+	policy = fsmeMachineGetEventPolicy(
+		fsmeEngineGetMachine(engine), index);
+	if (FSM_QUEUE_ALWAYS != policy) {
+		for (i = 0; i < queue->count; i++) {
+			queued = &queue->events[
+				(queue->head + i) % queue->capacity];
+			if (queued->event != event) continue;
+
+			if (FSM_QUEUE_COALESCE == policy) {
+				queued->inContext = inContext;
+				queued->outContext = outContext;
+				return FSME_EVENT_QUEUED;
+			}
+			return FSME_EVENT_DROPPED;
+		}
+	}
+
+	//grow the ring buffer, unwrapping it
+	if (queue->count == queue->capacity) {
+		capacity = (0 == queue->capacity) ? 
+			FSME_QUEUE_INIT_SIZE : queue->capacity * 2;
+		events = (fsme_queued_event_t*)fsmeAllocate(
+			fsmeEngineGetAllocator(engine),
+			sizeof(fsme_queued_event_t) * capacity, FSME_ALLOC_ALIGN);
+		if (NULL == events) {
+			return FSME_EVENT_DROPPED;
+		}
+		for (i = 0; i < queue->count; i++) {
+			events[i] = queue->events[
+				(queue->head + i) % queue->capacity];
+		}
+		fsmeDeallocate(fsmeEngineGetAllocator(engine), queue->events,
+			sizeof(fsme_queued_event_t) * queue->capacity);
+		queue->events = events;
+		queue->capacity = capacity;
+		queue->head = 0;
+	}
+
+	queued = &queue->events[
+		(queue->head + queue->count) % queue->capacity];
+	queued->event = event;
+	queued->inContext = inContext;
+	queued->outContext = outContext;
+	queue->count++;
+
+	return FSME_EVENT_QUEUED;
+}
+
+
+static boolean
+fsmeDequeueEvent(fsme_engine_ptr_t engine,
+				 fsme_queued_event_t* queued)
+{
+	fsme_event_queue_t* queue = NULL;
+	int lane = 0;
+
+	//take the oldest event of the highest non-empty lane
+	for (lane = FSME_PRIORITY_NUM - 1; lane >= 0; lane--) {
+		queue = &engine->cold->queue[lane];
+		if (0 == queue->count) continue;
+
+		*queued = queue->events[queue->head];
+		queue->head = (queue->head + 1) % queue->capacity;
+		queue->count--;
+		return TRUE;
+	}
+	return FALSE;
+}
+
+
+static void 
+fsme_processActions(fsme_engine_ptr_t engine, 
+					fsme_action_ptr_t actionNode, 
+					const void* inContext, 
+					void* outContext)
+{
+	engine->eventDisabled = TRUE;
+	while (NULL != actionNode) {
+		if (NULL != actionNode->action) {
+			actionNode->action(actionNode->id, 
+				inContext, 
+				outContext);
+		}
+		actionNode = actionNode->next;
+	};
+	engine->eventDisabled = FALSE;
+}
+
+
+static fsme_action_ptr_t
+fsme_getLastAction(fsme_action_ptr_t headNode)
+{
+	fsme_action_ptr_t rtn = NULL;
+	fsme_action_ptr_t tmpNode = NULL;
+
+	if (NULL != headNode) {
+		tmpNode = headNode;
+		while (tmpNode)	{
+			rtn = tmpNode;
+			tmpNode = tmpNode->next;
+		}
+	}
+	return rtn;
+}
+
+
+static fsme_action_ptr_t
+fsme_createAction(const fsme_allocator_t* allocator,
+				  fsme_func_t func,
+				  int id)
+{
+	fsme_action_ptr_t newAction = NULL;
+
+	if (NULL != func) {
+		newAction = (fsme_action_ptr_t)fsmeAllocate(allocator,
+			sizeof(struct fsme_action), FSME_ALLOC_ALIGN);
+		if (NULL == newAction) return NULL;
+
+		newAction->action = func;
+		newAction->id = id;
+		newAction->refCount = 1;
+		newAction->block = NULL;
+		newAction->next = NULL;
+		}
+	return newAction;
+}
+
+
+static boolean
+fsme_addEngineAction(fsme_engine_ptr_t engine,
+					 boolean wantEntryAction,
+					 fsme_func_t action)
+{
+	const fsme_allocator_t* allocator = NULL;
+	fsme_action_ptr_t firstAction = NULL;
+	boolean added = FALSE;
+	
+	if (NULL != engine && NULL != action) {
+		allocator = fsmeEngineGetAllocator(engine);
+		if (!fsme_unshareActionList(allocator, wantEntryAction ? 
+			&engine->cold->entryAction : &engine->cold->exitAction)) {
+			return FALSE;
+		}
 		firstAction = 
 			fsmeEngineGetAction(engine, wantEntryAction);
 		if (NULL != firstAction) {
-			fsme_appendAction(firstAction, action);
+			added = fsme_appendAction(allocator, firstAction, action);
 		} else {
 			if (wantEntryAction) 
 			{
-				engine->entryAction = 
-					fsme_createAction(action);
+				engine->cold->entryAction = fsme_createAction(
+					allocator, action, engine->machine->id);
+				added = (boolean)(NULL != engine->cold->entryAction);
 			}
 			else
 			{
-				engine->exitAction = 
-					fsme_createAction(action);
+				engine->cold->exitAction = fsme_createAction(
+					allocator, action, engine->machine->id);
+				added = (boolean)(NULL != engine->cold->exitAction);
 			}
         }
 	}
+	return added;
 }
 
 
-static void
+static boolean
 fsme_addStateAction(fsme_engine_ptr_t engine,
 					int stateId,
 					boolean wantEntryAction,
 					fsme_func_t action)
 {
+	const fsme_allocator_t* allocator = NULL;
 	fsme_state_t* state = NULL;
 	fsme_action_ptr_t firstAction = NULL;
+	boolean added = FALSE;
 	
 	if (NULL != engine && NULL != action) {
 		state = fsmeGetStateById(engine, stateId);
-		if (NULL == state) return;
+		if (NULL == state) return FALSE;
 
+		allocator = fsmeEngineGetAllocator(engine);
+		if (!fsme_unshareActionList(allocator, wantEntryAction ? 
+			&state->entryAction : &state->exitAction)) {
+			return FALSE;
+		}
 		firstAction = fsmeStateGetAction(state, 
 			wantEntryAction);
 		if (NULL != firstAction) {
-			fsme_appendAction(firstAction, action);
+			added = fsme_appendAction(allocator, firstAction, action);
 		} else {
 			if (wantEntryAction) 
 			{
 			    state->entryAction = 
-				    fsme_createAction(action);
+				    fsme_createAction(allocator, action, stateId);
+				added = (boolean)(NULL != state->entryAction);
             }
             else
             {
 			    state->exitAction = 
-				    fsme_createAction(action);
+				    fsme_createAction(allocator, action, stateId);
+				added = (boolean)(NULL != state->exitAction);
             }
 		}
+		fsmeEngineChangeActions(engine);
 	}
+	return added;
 }
 
 
-static void
-fsme_appendAction(fsme_action_ptr_t action, 
+static boolean
+fsme_appendAction(const fsme_allocator_t* allocator,
+				  fsme_action_ptr_t action, 
 				  fsme_func_t func)
 {
 	fsme_action_ptr_t lastAction = NULL;
 	fsme_action_ptr_t newAction = NULL;
 
-	if (NULL != func && NULL != action) {
-		lastAction = fsme_getLastAction(action);
-		newAction = fsme_createAction(func);
-		lastAction->next = newAction;
-	}
+	if (NULL == func || NULL == action) return FALSE;
+
+	lastAction = fsme_getLastAction(action);
+	//the actions of a list share its id
+	newAction = fsme_createAction(allocator, func, action->id);
+	lastAction->next = newAction;
+	return (boolean)(NULL != newAction);
 }
 
 
 static void
-fsme_removeAction(fsme_action_ptr_t *head, 
+fsme_removeAction(const fsme_allocator_t* allocator,
+				  fsme_action_ptr_t *head, 
 				  fsme_func_t func)
 {
 	fsme_action_ptr_t preNode = NULL;
 	fsme_action_ptr_t curNode = NULL;
 
 	if (NULL != head && NULL != func) {
+		if (!fsme_unshareActionList(allocator, head)) return;
 		curNode = *head;
 		preNode = curNode;
 		while (curNode) {
@@ -886,7 +2810,7 @@ fsme_removeAction(fsme_action_ptr_t *head,
 				} else {
 					preNode->next = curNode->next;
 				}
-				free(curNode);
+				fsme_freeAction(allocator, curNode);
 				break;
 			};
 			preNode = curNode;
@@ -897,218 +2821,1469 @@ fsme_removeAction(fsme_action_ptr_t *head,
 
 
 static void
-fsme_clearActionList(fsme_action_ptr_t *head)
+fsme_clearActionList(const fsme_allocator_t* allocator,
+					 fsme_action_ptr_t *head)
 {
 	fsme_action_ptr_t curNode = NULL;
 	fsme_action_ptr_t preNode = NULL;
 
 	if (NULL != head) {
 		curNode = *head;
+
+		//a shared list is left to the other engines, and
+		//freed by the last one to drop it
+		if (NULL != curNode && 
+			1 != FSME_ATOMIC_LOAD(&curNode->refCount) &&
+			0 != FSME_ATOMIC_ADD(&curNode->refCount, -1)) {
+			curNode = NULL;
+		}
 		while (NULL != curNode)	{
 			preNode = curNode;
 			curNode = curNode->next;
-			free(preNode);
+			fsme_freeAction(allocator, preNode);
 		}
 		*head = NULL;
 	}
 }
 
+
+static void
+fsme_freeAction(const fsme_allocator_t* allocator,
+				fsme_action_ptr_t action)
+{
+	fsme_action_block_t* const block = action->block;
+
+	if (NULL == block) {
+		fsmeDeallocate(allocator, action, sizeof(struct fsme_action));
+	} else if (0 == --block->nodeNum) {
+		fsmeDeallocate(allocator, block, block->size);
+	}
+}
+
+
+static fsme_action_ptr_t*
+fsmeGetActionList(fsme_engine_ptr_t engine,
+				  int list)
+{
+	const int stateNum = engine->machine->stateNum;
+
+	//the machine entry and exit lists, then the entry
+	//and exit list of each state, then the list of
+	//each transition
+	if (0 == list) {
+		return &engine->cold->entryAction;
+	} else if (1 == list) {
+		return &engine->cold->exitAction;
+	}
+	list -= 2;
+	if (list < 2 * stateNum) {
+		return (0 == (list & 1)) ? 
+			&engine->stateTable[list / 2].entryAction : 
+			&engine->stateTable[list / 2].exitAction;
+	}
+	return &engine->transitionTable[list - 2 * stateNum].action;
+}
+
+
+static int
+fsmeCompareIdIndex(const void* a,
+				   const void* b)
+{
+	const int idA = ((const fsme_id_index_t*)a)->id;
+	const int idB = ((const fsme_id_index_t*)b)->id;
+
+	return (idA > idB) - (idA < idB);
+}
+
+
+static int
+fsmeFindIdIndex(const fsme_id_index_t* table,
+				int num,
+				int id)
+{
+	fsme_id_index_t key;
+	const fsme_id_index_t* found = NULL;
+
+	key.id = id;
+	found = (const fsme_id_index_t*)bsearch(&key, table, num, 
+		sizeof(fsme_id_index_t), fsmeCompareIdIndex);
+	return (NULL != found) ? found->index : -1;
+}
+
+
+static fsme_action_ptr_t
+fsme_shareActionList(fsme_action_ptr_t head)
+{
+	if (NULL != head) {
+		FSME_ATOMIC_ADD(&head->refCount, 1);
+	}
+	return head;
+}
+
+
+static boolean
+fsme_unshareActionList(const fsme_allocator_t* allocator,
+					   fsme_action_ptr_t *head)
+{
+	fsme_action_ptr_t curNode = *head;
+	fsme_action_ptr_t copy = NULL;
+	fsme_action_ptr_t *tail = &copy;
+
+	if (NULL == curNode || 1 == FSME_ATOMIC_LOAD(&curNode->refCount)) {
+		return TRUE;
+	}
+
+	//copy the list for this engine, keeping the shared
+	//one if the copy cannot be completed
+	while (NULL != curNode) {
+		*tail = fsme_createAction(allocator, 
+			curNode->action, curNode->id);
+		if (NULL == *tail) {
+			fsme_clearActionList(allocator, &copy);
+			return FALSE;
+		}
+		tail = &(*tail)->next;
+		curNode = curNode->next;
+	}
+	//the other engines may have dropped the list meanwhile
+	fsme_clearActionList(allocator, head);
+	*head = copy;
+	return TRUE;
+}
+
 static fsme_state_t*
 fsmeGetStateById(const fsme_engine_t* engine, 
 				 int id)
 {
-	fsme_state_ptr_t en_state = NULL;
+	const fsme_machine_t* machine = fsmeEngineGetMachine(engine);
 	int i;
 
-	for (i = 0; i < engine->stateNum; i++) {
-		en_state = &engine->stateTable[i];
-		if (NULL != en_state && 
-			en_state->id == id) 
-			break;
+	for (i = 0; i < machine->stateNum; i++) {
+		if (fsmeMachineGetStateId(machine, i) == id) 
+			return fsmeEngineGetState(engine, i);
 	}
-	return en_state;
+	return NULL;
 }
 
 static fsme_transition_t*
 fsmeGetTransitionById(const fsme_engine_t* engine, 
 					  int id)
 {
-	fsme_transition_t* en_transition = NULL;
+	const fsme_machine_t* machine = fsmeEngineGetMachine(engine);
 	int i;
-	for (i = 0; i < engine->transitionNum; i++)	{
-		en_transition = &engine->transitionTable[i];
-		if (NULL != en_transition && 
-			en_transition->id == id)
-			break;
+
+	for (i = 0; i < machine->transitionNum; i++)	{
+		if (fsmeMachineGetTransitionId(machine, i) == id)
+			return fsmeEngineGetTransition(engine, i);
 	}
-	return en_transition;
+	return NULL;
 }
 
 
-static fsme_engine_ptr_t
-fsmeDoNewEngine(const fsm_machine_t* stateMachine, 
-				fsme_engine_ptr_t parent)
+static fsme_index_t
+fsmeMachineGetStateIndex(const fsm_machine_t* stateMachine, 
+						 int id)
 {
-	fsme_engine_ptr_t engine = NULL;
-	const fsm_machine_t* subMachine = NULL;
+	int i;
+
+	for (i = 0; i < stateMachine->stateNum; i++) {
+		if (stateMachine->stateTable[i].id == id) 
+			return (fsme_index_t)i;
+	}
+	return FSME_INDEX_NONE;
+}
+
+
+static fsme_index_t
+fsmeMachineGetTransitionIndex(const fsm_machine_t* stateMachine, 
+							  int id)
+{
+	int i;
+
+	for (i = 0; i < stateMachine->transitionNum; i++) {
+		if (stateMachine->transitionTable[i].id == id) 
+			return (fsme_index_t)i;
+	}
+	return FSME_INDEX_NONE;
+}
+
+
+static fsme_machine_ptr_t
+fsmeDoCompileMachine(const fsm_machine_t* stateMachine)
+{
+	fsme_machine_ptr_t machine = NULL;
 	const fsm_state_t* tmpState = NULL;
 	const fsm_transition_t* tmpTransition = NULL;
-	int* triggerCountArray = NULL;
-	int eventId = 0;
+	const fsm_trigger_t* tmpTrigger = NULL;
+	const fsm_event_t* tmpEvent = NULL;
+	fsme_event_hash_t hash;
+	unsigned char width = 0;
+	unsigned char* tables = NULL;
+	size_t dispatchNum = 0;
+	size_t size = 0;
+	size_t slot = 0;
+	fsme_index_t index = FSME_INDEX_NONE;
+	fsme_index_t event = FSME_INDEX_NONE;
+	fsme_index_t source = FSME_INDEX_NONE;
+	fsme_index_t target = FSME_INDEX_NONE;
+	int eventNum = 0;
+	int symbolNum = 0;
 	int i = 0;
 
 	if (NULL == stateMachine ||
-		0 == stateMachine->stateNum ||
-		0 == stateMachine->transitionNum ||
-		0 == stateMachine->eventNum) {
+		0 >= stateMachine->stateNum ||
+		0 >= stateMachine->transitionNum ||
+		0 >= stateMachine->eventNum ||
+		FSME_INDEX_MAX < stateMachine->stateNum ||
+		FSME_INDEX_MAX < stateMachine->transitionNum ||
+		FSME_INDEX_MAX < stateMachine->eventNum) {
 		return NULL;
 	}
 
-	engine = (fsme_engine_t*)malloc(sizeof(fsme_engine_t));
-	assert(engine);
-
-	engine->id = stateMachine->id;
-	engine->stateTable = NULL;
-	engine->stateNum = 
-		stateMachine->stateNum;
-	engine->transitionTable = NULL;
-	engine->transitionNum = 
-		stateMachine->transitionNum;
-	engine->triggerTable = NULL;
-	engine->eventNum = 0;
-	engine->parent = parent;
-	engine->isSubStateMachine = FALSE;
-	engine->entryState = NULL;
-	engine->activeState = NULL;
-	engine->entryAction = NULL;
-	engine->exitAction = NULL;
-	engine->eventDisabled = FALSE;
+	//Sparse event ids are given the slots of their
+	//hash table as indexes.
+	memset(&hash, 0, sizeof(hash));
+	eventNum = stateMachine->eventNum;
+	if (stateMachine->sparseEvents) {
+		if (!fsmeBuildEventHash(stateMachine, &hash)) {
+			return NULL;
+		}
+		eventNum = hash.slotNum;
+	}
 
+	//Use 8-bit indexes whenever the machine is small
+	//enough, 16-bit ones otherwise.
+	width = (FSME_INDEX_MAX_NARROW >= stateMachine->stateNum &&
+		FSME_INDEX_MAX_NARROW >= stateMachine->transitionNum) ? 
+		1 : 2;
+	dispatchNum = (size_t)stateMachine->stateNum * eventNum;
+
+	//the hash table of the names is kept at most
+	//half full
+	i = fsmeCountSymbols(stateMachine);
+	if (0 < i) {
+		for (symbolNum = 2; symbolNum < 2 * i; symbolNum *= 2);
+	}
 
 	//////////////////////////////
-	//Create state table
+	//Allocate the machine and its tables in one block
 	//////////////////////////////
-	engine->stateTable = 
-		(fsme_state_t*)malloc(sizeof(fsme_state_t) * 
-		stateMachine->stateNum);
-	assert(engine->stateTable);
+	size = sizeof(fsme_machine_t) + 
+		sizeof(fsme_regions_t*) * stateMachine->stateNum +
+		sizeof(fsme_symbol_t) * symbolNum +
+		sizeof(int) * (stateMachine->stateNum + 
+		stateMachine->transitionNum + hash.slotNum) +
+		sizeof(unsigned int) * hash.bucketNum +
+		width * (dispatchNum + 
+		2 * (size_t)stateMachine->transitionNum) +
+		stateMachine->stateNum +
+		2 * (size_t)eventNum;
+	machine = (fsme_machine_ptr_t)fsmeAllocate(fsmeAllocator, 
+		size, FSME_ALLOC_ALIGN);
+	if (NULL == machine) {
+		fsmeDeallocate(fsmeAllocator, hash.keys, 
+			fsmeEventHashSize(hash.slotNum, hash.bucketNum));
+		return NULL;
+	}
+	memset(machine, 0, size);
+
+	machine->allocator = fsmeAllocator;
+	machine->size = size;
+	machine->id = stateMachine->id;
+	machine->refCount = 1;
+	machine->indexWidth = width;
+	machine->stateNum = (fsme_index_t)stateMachine->stateNum;
+	machine->transitionNum = 
+		(fsme_index_t)stateMachine->transitionNum;
+	machine->eventNum = (fsme_index_t)eventNum;
+	machine->definition = stateMachine;
+
+	machine->regions = (fsme_regions_t**)(machine + 1);
+	machine->symbols = (0 < symbolNum) ? (const fsme_symbol_t*)
+		(machine->regions + machine->stateNum) : NULL;
+	machine->symbolMask = (unsigned int)symbolNum - 1;
+	machine->stateIds = (const int*)
+		((const fsme_symbol_t*)(machine->regions + 
+		machine->stateNum) + symbolNum);
+	machine->transitionIds = 
+		machine->stateIds + machine->stateNum;
+	tables = (unsigned char*)
+		(machine->transitionIds + machine->transitionNum);
+	if (NULL != hash.keys) {
+		machine->eventKeys = (const int*)tables;
+		machine->eventSeeds = (const unsigned int*)
+			(machine->eventKeys + hash.slotNum);
+		machine->eventBucketNum = (fsme_index_t)hash.bucketNum;
+		memcpy((int*)machine->eventKeys, hash.keys, 
+			sizeof(int) * hash.slotNum);
+		memcpy((unsigned int*)machine->eventSeeds, hash.seeds, 
+			sizeof(unsigned int) * hash.bucketNum);
+		fsmeDeallocate(fsmeAllocator, hash.keys, 
+			fsmeEventHashSize(hash.slotNum, hash.bucketNum));
+		tables = (unsigned char*)
+			(machine->eventSeeds + machine->eventBucketNum);
+	}
+	machine->dispatchTable = tables;
+	machine->sourceState = tables + width * dispatchNum;
+	machine->targetState = (const unsigned char*)
+		machine->sourceState + width * machine->transitionNum;
 
+	//the byte tables come last, keeping the index 
+	//tables aligned
+	machine->stateHistory = (const unsigned char*)
+		machine->targetState + width * machine->transitionNum;
+	machine->eventPolicy = 
+		machine->stateHistory + machine->stateNum;
+	machine->eventPriority = 
+		machine->eventPolicy + machine->eventNum;
+
+
+	//////////////////////////////
+	//Compile states
+	//////////////////////////////
 	for (i = 0; i<stateMachine->stateNum; i++) {
 		tmpState = &stateMachine->stateTable[i];
-		engine->stateTable[i].id = 
-			tmpState->id;
-		engine->stateTable[i].isFinal = 
-			tmpState->isFinal;
-		engine->stateTable[i].entryAction = NULL; 
-		engine->stateTable[i].exitAction = NULL;
-
-		//If the state is a sub machine and it is
-		//not a final state, create sub engine.
-		subMachine = stateMachine->
-			stateTable[i].subMachine;
-		if (NULL != subMachine && 
-			!(tmpState->isFinal)) {
-			engine->stateTable[i].subEngine = 
-				fsmeDoNewEngine(subMachine, engine);
-		} else {
-			engine->stateTable[i].subEngine = NULL;
+		((int*)machine->stateIds)[i] = tmpState->id;
+		((unsigned char*)machine->stateHistory)[i] = 
+			(unsigned char)tmpState->history;
+
+		//compile the sub machine or regions of the state
+		if (!fsmeCompileRegions(machine->allocator, tmpState, 
+			&machine->regions[i])) {
+			fsmeFreeMachine(machine);
+			return NULL;
 		}
-	};
+	}
+
+	machine->entryState = fsmeMachineGetStateIndex(stateMachine, 
+		stateMachine->entryStateId);
+	if (FSME_INDEX_NONE == machine->entryState) {
+		fsmeFreeMachine(machine);
+		return NULL;
+	}
 
 
 	//////////////////////////////
-	//Set engine entry state
+	//Compile transitions
 	//////////////////////////////
-	engine->entryState = fsmeGetStateById(engine, 
-		stateMachine->entryStateId);
+	for (i = 0; i<stateMachine->transitionNum; i++) {
+		tmpTransition = &stateMachine->transitionTable[i];
+		((int*)machine->transitionIds)[i] = tmpTransition->id;
+
+		source = fsmeMachineGetStateIndex(stateMachine, 
+			tmpTransition->sourceStateId);
+		target = fsmeMachineGetStateIndex(stateMachine, 
+			tmpTransition->targetStateId);
+		if (FSME_INDEX_NONE == source || 
+			FSME_INDEX_NONE == target) {
+			fsmeFreeMachine(machine);
+			return NULL;
+		}
+		fsmeMachineSetIndex(machine, 
+			(void*)machine->sourceState, i, source);
+		fsmeMachineSetIndex(machine, 
+			(void*)machine->targetState, i, target);
+	}
 
 
 	//////////////////////////////
-	//Create transition table
+	//Compile triggers into the dispatch table
 	//////////////////////////////
-	engine->transitionTable = (fsme_transition_t*)
-		malloc(sizeof(fsme_transition_t) * 
-		stateMachine->transitionNum);
-	assert(engine->transitionTable);
+	for (i = 0; i<stateMachine->triggerNum; i++) {
+		tmpTrigger = &stateMachine->triggerTable[i];
+
+		index = fsmeMachineGetTransitionIndex(stateMachine, 
+			tmpTrigger->transitionId);
+		event = fsmeMachineGetEventIndex(machine, 
+			tmpTrigger->eventId);
+		if (FSME_INDEX_NONE == index ||
+			FSME_INDEX_NONE == event) {
+			fsmeFreeMachine(machine);
+			return NULL;
+		}
 
-	for (i = 0; i<stateMachine->transitionNum; i++) {
-		tmpTransition = &stateMachine->
-			transitionTable[i];
-		engine->transitionTable[i].id = tmpTransition->id;
-		engine->transitionTable[i].action = NULL;
-		engine->transitionTable[i].guard = NULL;
-		engine->transitionTable[i].sourceState = 
-			fsmeGetStateById(engine, 
-				tmpTransition->sourceStateId);
-		engine->transitionTable[i].targetState = 
-			fsmeGetStateById(engine, 
-				tmpTransition->targetStateId);
-	};
+		//The transition is triggered in its source state. 
+		//When several triggers compete for the same state 
+		//and event, the first one in the table wins.
+		slot = (size_t)fsmeMachineGetSourceState(machine, index) * 
+			machine->eventNum + event;
+		if (FSME_INDEX_NONE == fsmeMachineGetIndex(machine, 
+			machine->dispatchTable, slot)) {
+			fsmeMachineSetIndex(machine, 
+				(void*)machine->dispatchTable, slot, index);
+		}
+	}
 
 
 	//////////////////////////////
-	//Create trigger table
+	//Compile events
 	//////////////////////////////
-	engine->eventNum = stateMachine->eventNum;
-	engine->triggerTable = (fsme_trigger_t*)
-		malloc(sizeof(fsme_trigger_t) * 
-		stateMachine->eventNum);
-	assert(engine->triggerTable);
-
-	//Init trigger table
-	for (i = 0; i<stateMachine->eventNum; i++) {
-		engine->triggerTable[i].eventId = i;
-		engine->triggerTable[i].transitionNum = 0;
-		engine->triggerTable[i].transitions = NULL;
+	for (i = 0; i<stateMachine->eventTableNum && 
+		NULL != stateMachine->eventTable; i++) {
+		tmpEvent = &stateMachine->eventTable[i];
+		event = fsmeMachineGetEventIndex(machine, tmpEvent->id);
+		if (FSME_INDEX_NONE == event ||
+			0 > tmpEvent->priority ||
+			FSME_PRIORITY_NUM <= tmpEvent->priority) {
+			fsmeFreeMachine(machine);
+			return NULL;
+		}
+		((unsigned char*)machine->eventPolicy)[event] = 
+			(unsigned char)tmpEvent->policy;
+		((unsigned char*)machine->eventPriority)[event] = 
+			(unsigned char)tmpEvent->priority;
 	}
-	
-	//Calculate transition count for each trigger
-	triggerCountArray = (int *)malloc(sizeof(int) * 
-		stateMachine->eventNum);
-	assert(triggerCountArray);
-	memset(triggerCountArray, 0, 
-		sizeof(int) * stateMachine->eventNum);
-	for (i = 0; i<stateMachine->triggerNum; i++) {
-		eventId = stateMachine->
-			triggerTable[i].eventId;
-		engine->triggerTable[eventId].transitionNum++;
-		//Keep the count in triggerCountArray
-		triggerCountArray[eventId]++;
+
+
+	//////////////////////////////
+	//Compile names
+	//////////////////////////////
+	if (!fsmeCompileSymbols(machine, stateMachine)) {
+		fsmeFreeMachine(machine);
+		return NULL;
 	}
 
-	//Create transition group table for each trigger
-	for (i = 0; i<stateMachine->eventNum; i++) {
-		if (0 == engine->triggerTable[i].transitionNum) 
-			continue;
-		engine->triggerTable[i].transitions = 
-			(fsme_transition_t**)
-			malloc(sizeof(fsme_transition_t*) * 
-				engine->triggerTable[i].transitionNum);
-		assert(engine->triggerTable[i].transitions);
-	};
+	return machine;
+}
 
-	//Set transition mappings for each trigger
-	for (i = stateMachine->triggerNum-1; i>= 0; i--) {
-		eventId = stateMachine->
-			triggerTable[i].eventId;
-
-		if (triggerCountArray[eventId] == 0) {
-			//All transitions belonging to this trigger 
-			//have been covered, so continue.
-			continue; 
-		}
-		engine->triggerTable[eventId].
-			transitions[triggerCountArray[eventId] - 1] = 
-			fsmeGetTransitionById(engine, 
-			stateMachine->triggerTable[i].transitionId);
-		//One transition belonging to this trigger 
-		//is put into the table as an entry.
-		//Go to the next one.
-		triggerCountArray[eventId]--;
-	}	
-	free(triggerCountArray);
 
-	return engine;
+static void
+fsmeFreeMachine(fsme_machine_ptr_t machine)
+{
+	int i = 0;
+
+	for (i = 0; i < machine->stateNum; i++) {
+		fsmeFreeRegions(machine->allocator, machine->regions[i]);
+	}
+	if (NULL != machine->dwell) {
+		fsmeDeallocate(machine->allocator, machine->dwell, 
+			fsmeDwellSize(machine->stateNum));
+	}
+	fsmeDeallocate(machine->allocator, machine->ownDefinition,
+		machine->ownDefinitionSize);
+	fsmeDeallocate(machine->allocator, machine, machine->size);
+}
+
+
+static boolean
+fsmeBuildEventHash(const fsm_machine_t* stateMachine,
+				   fsme_event_hash_t* hash)
+{
+	int* ids = NULL;
+	int* start = NULL;
+	int* members = NULL;
+	unsigned char* taken = NULL;
+	unsigned int seed = 0;
+	unsigned int slot = 0;
+	boolean placed = FALSE;
+	int idNum = 0;
+	int maxSize = 0;
+	int size = 0;
+	int i = 0, j = 0, b = 0;
+
+	//The different ids of the triggers and events, 
+	//then the ids sorted by bucket and where each 
+	//bucket starts, freed when done.
+	idNum = stateMachine->triggerNum + 
+		((NULL != stateMachine->eventTable) ? 
+		stateMachine->eventTableNum : 0);
+	if (0 >= idNum) return FALSE;
+	ids = (int*)calloc(1, sizeof(int) * (3 * (size_t)idNum + 2));
+	if (NULL == ids) return FALSE;
+	members = ids + idNum;
+	start = members + idNum;
+
+	for (i = 0; i < stateMachine->triggerNum; i++) {
+		ids[i] = stateMachine->triggerTable[i].eventId;
+	}
+	for (j = 0; i < idNum; i++, j++) {
+		ids[i] = stateMachine->eventTable[j].id;
+	}
+	qsort(ids, idNum, sizeof(int), fsmeCompareIds);
+	for (i = 0, j = 0; i < idNum; i++) {
+		if (0 == j || ids[j - 1] != ids[i]) {
+			ids[j++] = ids[i];
+		}
+	}
+	idNum = j;
+	if (stateMachine->eventNum < idNum) {
+		free(ids);
+		return FALSE;
+	}
+
+	//Hash the ids into buckets of two on average, and
+	//sort them by bucket.
+	hash->bucketNum = idNum / 2 + 1;
+	for (i = 0; i < idNum; i++) {
+		start[fsmeHashRange(fsmeHashEventId(ids[i], 0), 
+			hash->bucketNum) + 1]++;
+	}
+	for (b = 0; b < hash->bucketNum; b++) {
+		if (maxSize < start[b + 1]) maxSize = start[b + 1];
+		start[b + 1] += start[b];
+	}
+	for (i = 0; i < idNum; i++) {
+		b = (int)fsmeHashRange(fsmeHashEventId(ids[i], 0), 
+			hash->bucketNum);
+		members[start[b]++] = ids[i];
+	}
+	for (b = hash->bucketNum; 0 < b; b--) {
+		start[b] = start[b - 1];
+	}
+	start[0] = 0;
+
+	//Give each bucket, the largest first, the first 
+	//seed that hashes its ids to free slots. The table
+	//has a slot per id, and grows if a bucket finds 
+	//no seed.
+	for (hash->slotNum = idNum; FSME_INDEX_MAX >= hash->slotNum; 
+		hash->slotNum += hash->slotNum / 16 + 1) {
+		hash->keys = (int*)fsmeAllocate(fsmeAllocator, 
+			fsmeEventHashSize(hash->slotNum, hash->bucketNum),
+			FSME_ALLOC_ALIGN);
+		if (NULL == hash->keys) break;
+		memset(hash->keys, 0, 
+			fsmeEventHashSize(hash->slotNum, hash->bucketNum));
+		hash->seeds = (unsigned int*)(hash->keys + hash->slotNum);
+		taken = (unsigned char*)(hash->seeds + hash->bucketNum);
+
+		placed = TRUE;
+		for (size = maxSize; placed && 0 < size; size--) {
+			for (b = 0; placed && b < hash->bucketNum; b++) {
+				if (size != start[b + 1] - start[b]) continue;
+
+				placed = FALSE;
+				for (seed = 1; !placed && 
+					FSME_EVENT_SEED_MAX >= seed; seed++) {
+					for (i = start[b]; i < start[b + 1]; i++) {
+						slot = fsmeHashRange(fsmeHashEventId(
+							members[i], seed), hash->slotNum);
+						if (taken[slot]) break;
+						taken[slot] = 1;
+						hash->keys[slot] = members[i];
+					}
+					placed = (boolean)(start[b + 1] == i);
+					if (placed) {
+						hash->seeds[b] = seed;
+						continue;
+					}
+					for (j = start[b]; j < i; j++) {
+						taken[fsmeHashRange(fsmeHashEventId(
+							members[j], seed), hash->slotNum)] = 0;
+					}
+				}
+			}
+		}
+
+		if (placed) {
+			//A free slot holds an id hashed to another 
+			//slot, so that no id is found there.
+			for (slot = 0; slot < (unsigned int)hash->slotNum; 
+				slot++) {
+				if (!taken[slot]) hash->keys[slot] = ids[0];
+			}
+			free(ids);
+			return TRUE;
+		}
+		fsmeDeallocate(fsmeAllocator, hash->keys, 
+			fsmeEventHashSize(hash->slotNum, hash->bucketNum));
+		hash->keys = NULL;
+	}
+
+	free(ids);
+	memset(hash, 0, sizeof(*hash));
+	return FALSE;
+}
+
+
+static unsigned int
+fsmeHashEventId(int id,
+				unsigned int seed)
+{
+	unsigned int hash = (unsigned int)id ^ (seed * 0x9E3779B9u);
+
+	hash ^= hash >> 16;
+	hash *= 0x85EBCA6Bu;
+	hash ^= hash >> 13;
+	hash *= 0xC2B2AE35u;
+	hash ^= hash >> 16;
+	return hash;
+}
+
+
+static fsme_index_t
+fsmeHashEvent(const fsme_machine_t* machine,
+			  int event)
+{
+	const unsigned int bucket = fsmeHashRange(
+		fsmeHashEventId(event, 0), machine->eventBucketNum);
+	const fsme_index_t slot = (fsme_index_t)fsmeHashRange(
+		fsmeHashEventId(event, machine->eventSeeds[bucket]), 
+		machine->eventNum);
+
+	return (event == machine->eventKeys[slot]) ? 
+		slot : FSME_INDEX_NONE;
+}
+
+
+static int
+fsmeCompareIds(const void* a,
+			   const void* b)
+{
+	const int idA = *(const int*)a;
+	const int idB = *(const int*)b;
+
+	return (idA > idB) - (idA < idB);
+}
+
+
+static boolean
+fsmeGetBindingId(const fsme_machine_t* machine,
+				 const fsme_binding_t* binding,
+				 fsme_symbol_kind_t kind,
+				 int* id)
+{
+	const fsme_symbol_t* symbol = NULL;
+
+	if (NULL == binding->name) {
+		*id = binding->id;
+		return TRUE;
+	}
+
+	symbol = fsmeFindSymbol(machine, kind, binding->name);
+	if (NULL == symbol) return FALSE;
+
+	*id = symbol->id;
+	return TRUE;
 }
 
 
+static int
+fsmeCountSymbols(const fsm_machine_t* stateMachine)
+{
+	int num = 0;
+	int i = 0;
+
+	for (i = 0; i < stateMachine->stateNum; i++) {
+		num += (NULL != stateMachine->stateTable[i].name);
+	}
+	for (i = 0; i < stateMachine->transitionNum; i++) {
+		num += (NULL != stateMachine->transitionTable[i].name);
+	}
+	for (i = 0; i < stateMachine->eventTableNum &&
+		NULL != stateMachine->eventTable; i++) {
+		num += (NULL != stateMachine->eventTable[i].name);
+	}
+	return num;
+}
+
+
+static boolean
+fsmeCompileSymbols(fsme_machine_ptr_t machine,
+				   const fsm_machine_t* stateMachine)
+{
+	const char* name = NULL;
+	int i = 0;
+
+	for (i = 0; i < stateMachine->stateNum; i++) {
+		name = stateMachine->stateTable[i].name;
+		if (NULL != name && !fsmeAddSymbol(machine, 
+			FSME_SYMBOL_STATE, name, stateMachine->stateTable[i].id)) {
+			return FALSE;
+		}
+	}
+	for (i = 0; i < stateMachine->transitionNum; i++) {
+		name = stateMachine->transitionTable[i].name;
+		if (NULL != name && !fsmeAddSymbol(machine, 
+			FSME_SYMBOL_TRANSITION, name, 
+			stateMachine->transitionTable[i].id)) {
+			return FALSE;
+		}
+	}
+	for (i = 0; i < stateMachine->eventTableNum &&
+		NULL != stateMachine->eventTable; i++) {
+		name = stateMachine->eventTable[i].name;
+		if (NULL != name && !fsmeAddSymbol(machine, 
+			FSME_SYMBOL_EVENT, name, stateMachine->eventTable[i].id)) {
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+
+static boolean
+fsmeAddSymbol(fsme_machine_ptr_t machine,
+			  fsme_symbol_kind_t kind,
+			  const char* name,
+			  int id)
+{
+	fsme_symbol_t* symbol = NULL;
+	const unsigned int hash = fsmeHashName(kind, name);
+	unsigned int slot = 0;
+
+	//a name is given to one thing of each kind
+	if (NULL != fsmeFindSymbol(machine, kind, name)) {
+		return FALSE;
+	}
+
+	for (slot = hash & machine->symbolMask; 
+		NULL != machine->symbols[slot].name; 
+		slot = (slot + 1) & machine->symbolMask);
+
+	symbol = (fsme_symbol_t*)&machine->symbols[slot];
+	symbol->name = name;
+	symbol->hash = hash;
+	symbol->kind = kind;
+	symbol->id = id;
+	return TRUE;
+}
+
+
+static const fsme_symbol_t*
+fsmeFindSymbol(const fsme_machine_t* machine,
+			   fsme_symbol_kind_t kind,
+			   const char* name)
+{
+	const fsme_symbol_t* symbol = NULL;
+	const unsigned int hash = fsmeHashName(kind, name);
+	unsigned int slot = 0;
+
+	if (NULL == machine->symbols) return NULL;
+
+	for (slot = hash & machine->symbolMask; 
+		NULL != machine->symbols[slot].name; 
+		slot = (slot + 1) & machine->symbolMask) {
+		symbol = &machine->symbols[slot];
+		if (hash == symbol->hash && kind == symbol->kind &&
+			0 == strcmp(name, symbol->name)) {
+			return symbol;
+		}
+	}
+	return NULL;
+}
+
+
+static unsigned int
+fsmeHashName(fsme_symbol_kind_t kind,
+			 const char* name)
+{
+	//FNV-1a, starting from the kind
+	unsigned int hash = 2166136261u ^ (unsigned int)kind;
+
+	while ('\0' != *name) {
+		hash ^= (unsigned char)*name++;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+
+static boolean
+fsmeCompileRegions(const fsme_allocator_t* allocator,
+				   const fsm_state_t* state, 
+				   fsme_regions_t** regions)
+{
+	fsme_regions_t* tmpRegions = NULL;
+	fsme_machine_ptr_t region = NULL;
+	const fsm_machine_t* subMachine = NULL;
+	boolean sparse = FALSE;
+	int regionNum = 0;
+	int eventNum = 0;
+	size_t size = 0;
+	int r = 0, i = 0, j = 0;
+
+	*regions = NULL;
+
+	//A final state never has sub machines. A plain sub 
+	//machine is handled as a state with one region.
+	if (state->isFinal) {
+		return TRUE;
+	}
+	if (NULL != state->subMachine) {
+		if (0 < state->regionNum) return FALSE;
+		regionNum = 1;
+	} else if (NULL != state->regionTable) {
+		regionNum = state->regionNum;
+	}
+	if (0 >= regionNum) {
+		return TRUE;
+	}
+	if (FSME_REGION_MAX < regionNum) {
+		return FALSE;
+	}
+
+	for (r = 0; r < regionNum; r++) {
+		subMachine = (NULL != state->subMachine) ? 
+			state->subMachine : state->regionTable[r];
+		if (NULL == subMachine) return FALSE;
+		if (eventNum < subMachine->eventNum) {
+			eventNum = subMachine->eventNum;
+		}
+		if (subMachine->sparseEvents) {
+			sparse = TRUE;
+		}
+	}
+
+	//the regions are all looked up when the event ids
+	//of one of them are sparse
+	if (sparse) {
+		eventNum = 0;
+	}
+
+	size = sizeof(fsme_regions_t) + 
+		sizeof(fsme_machine_ptr_t) * regionNum +
+		sizeof(unsigned int) * eventNum;
+	tmpRegions = (fsme_regions_t*)fsmeAllocate(allocator, 
+		size, FSME_ALLOC_ALIGN);
+	if (NULL == tmpRegions) return FALSE;
+	memset(tmpRegions, 0, size);
+	tmpRegions->size = size;
+	tmpRegions->machines = (fsme_machine_ptr_t*)(tmpRegions + 1);
+	tmpRegions->eventMask = sparse ? NULL : (unsigned int*)
+		(tmpRegions->machines + regionNum);
+	*regions = tmpRegions;
+
+	for (r = 0; r < regionNum; r++) {
+		subMachine = (NULL != state->subMachine) ? 
+			state->subMachine : state->regionTable[r];
+		region = fsmeDoCompileMachine(subMachine);
+		if (NULL == region) return FALSE;
+		tmpRegions->machines[r] = region;
+		tmpRegions->regionNum++;
+
+		//mark the events the region reacts to
+		for (i = 0; !sparse && i < region->stateNum; i++) {
+			for (j = 0; j < region->eventNum; j++) {
+				if (FSME_INDEX_NONE != 
+					fsmeMachineFindTransition(region, i, j)) {
+					tmpRegions->eventMask[j] |= 1u << r;
+				}
+			}
+		}
+	}
+	tmpRegions->eventNum = (fsme_index_t)eventNum;
+
+	return TRUE;
+}
+
+
+static void
+fsmeFreeRegions(const fsme_allocator_t* allocator,
+				fsme_regions_t* regions)
+{
+	int r = 0;
+
+	if (NULL == regions) return;
+
+	for (r = 0; r < regions->regionNum; r++) {
+		fsme_releaseMachine(regions->machines[r]);
+	}
+	fsmeDeallocate(allocator, regions, regions->size);
+}
+
+
+static fsme_engine_ptr_t
+fsmeAllocEngines(const fsme_allocator_t* allocator,
+				 int num)
+{
+	return (fsme_engine_ptr_t)fsmeAllocate(allocator, 
+		sizeof(fsme_engine_t) * num, FSME_CACHE_LINE_SIZE);
+}
+
+
+static void
+fsmeFreeEngines(const fsme_allocator_t* allocator,
+				fsme_engine_ptr_t engine,
+				int num)
+{
+	fsmeDeallocate(allocator, engine, sizeof(fsme_engine_t) * num);
+}
+
+
+static fsme_engine_ptr_t
+fsmeDoNewEngine(fsme_machine_ptr_t machine, 
+				fsme_engine_ptr_t parent,
+				const fsme_allocator_t* allocator)
+{
+	fsme_engine_ptr_t engine = NULL;
+
+	if (NULL == machine) {
+		return NULL;
+	}
+
+	engine = fsmeAllocEngines(allocator, 1);
+	if (NULL == engine) return NULL;
+
+	if (!fsmeInitEngine(engine, machine, parent, allocator, 
+		NULL, NULL)) {
+		fsmeFreeEngines(allocator, engine, 1);
+		return NULL;
+	}
+	return engine;
+}
+
+
+static boolean
+fsmeInitEngine(fsme_engine_ptr_t engine, 
+			   fsme_machine_ptr_t machine, 
+			   fsme_engine_ptr_t parent,
+			   const fsme_allocator_t* allocator,
+			   fsme_engine_slab_t* slab,
+			   unsigned char** cursor)
+{
+	const fsme_regions_t* regions = NULL;
+	fsme_engine_ptr_t subEngine = NULL;
+	int i = 0, r = 0;
+
+	//The cold part and the state and transition tables
+	//of the engine are allocated in one block, or carved
+	//from the slab of the engine.
+	if (NULL != slab) {
+		engine->cold = (fsme_engine_cold_t*)*cursor;
+		*cursor += fsmeSlabLines(fsmeEngineColdSize(machine));
+	} else {
+		engine->cold = (fsme_engine_cold_t*)fsmeAllocate(allocator, 
+			fsmeEngineColdSize(machine), FSME_ALLOC_ALIGN);
+		if (NULL == engine->cold) return FALSE;
+	}
+
+	machine->refCount++;
+	engine->machine = machine;
+	engine->stateTable = (fsme_state_t*)(engine->cold + 1);
+	engine->transitionTable = (fsme_transition_t*)
+		(engine->stateTable + machine->stateNum);
+	engine->activeState = FSME_INDEX_NONE | 
+		(NULL != parent ? FSME_STATE_SUB : 0);
+	engine->sequence = 0;
+	engine->eventDisabled = FALSE;
+	engine->observer = (NULL != parent) ? parent->observer : NULL;
+	engine->writer = NULL;
+	engine->cold->parent = parent;
+	engine->cold->allocator = allocator;
+	engine->cold->slab = slab;
+	engine->cold->slabParts = (NULL != slab) ? FSME_SLAB_TABLES : 0;
+	engine->cold->historyState = FSME_INDEX_NONE;
+	engine->cold->entryAction = NULL;
+	engine->cold->exitAction = NULL;
+	memset(&engine->cold->pending, 0, 
+		sizeof(engine->cold->pending));
+	engine->cold->chainGeneration = 0;
+	engine->cold->enteredAt = 0;
+	memset(&engine->cold->queue, 0, 
+		sizeof(engine->cold->queue));
+
+
+	//////////////////////////////
+	//Create state and transition tables
+	//////////////////////////////
+	//No actions, guards, action arrays or sub engines 
+	//yet. The tables follow each other and are cleared
+	//at once.
+	memset(engine->stateTable, 0, 
+		sizeof(fsme_state_t) * machine->stateNum +
+		sizeof(fsme_transition_t) * machine->transitionNum);
+
+
+	//////////////////////////////
+	//Create sub engines
+	//////////////////////////////
+	//If the state is a sub machine or has regions, 
+	//create the sub engines next to each other. If 
+	//that fails, the engine is finalized as far as
+	//it was built.
+	for (i = 0; i<machine->stateNum; i++) {
+		regions = fsmeMachineGetRegions(machine, i);
+		if (NULL == regions) continue;
+
+		if (NULL != slab) {
+			subEngine = (fsme_engine_ptr_t)*cursor;
+			*cursor += sizeof(fsme_engine_t) * regions->regionNum;
+		} else {
+			subEngine = fsmeAllocEngines(allocator, regions->regionNum);
+			if (NULL == subEngine) {
+				fsmeFinalizeEngine(engine);
+				return FALSE;
+			}
+		}
+		for (r = 0; r < regions->regionNum; r++) {
+			if (!fsmeInitEngine(&subEngine[r], 
+				regions->machines[r], engine, allocator, 
+				slab, cursor)) {
+				while (0 < r--) {
+					fsmeFinalizeEngine(&subEngine[r]);
+				}
+				fsmeFreeEngines(allocator, subEngine, 
+					regions->regionNum);
+				fsmeFinalizeEngine(engine);
+				return FALSE;
+			}
+		}
+		engine->stateTable[i].subEngine = subEngine;
+	};
+
+	return TRUE;
+}
+
+
+static size_t
+fsmeEngineSlabSize(const fsme_machine_t* machine)
+{
+	const fsme_regions_t* regions = NULL;
+	size_t size = fsmeSlabLines(fsmeEngineColdSize(machine));
+	int i = 0, r = 0;
+
+	//as carved by fsmeInitEngine(), the engine itself
+	//excluded
+	for (i = 0; i < machine->stateNum; i++) {
+		regions = fsmeMachineGetRegions(machine, i);
+		if (NULL == regions) continue;
+
+		size += sizeof(fsme_engine_t) * regions->regionNum;
+		for (r = 0; r < regions->regionNum; r++) {
+			size += fsmeEngineSlabSize(regions->machines[r]);
+		}
+	}
+	return size;
+}
+
+
+static void
+fsmeFinalizeEngine(fsme_engine_ptr_t engine)
+{
+	fsme_engine_ptr_t subEngine = NULL;
+	const fsme_allocator_t* const allocator = 
+		fsmeEngineGetAllocator(engine);
+	const fsme_machine_t* machine = engine->machine;
+	int i = 0, r = 0;
+
+	//clear all registered actions, with the array of
+	//a transition left suspended
+	fsmeCancelTransition(engine);
+	fsme_clearActions(engine);
+
+	//release the sub engines; those carved from a slab
+	//go with it
+	for (i=0; i<engine->machine->stateNum; i++) {
+		subEngine = engine->stateTable[i].subEngine;
+		if (NULL != subEngine)
+		{
+			for (r = 0; r < fsmeMachineGetRegionNum(
+				engine->machine, i); r++) {
+				fsmeFinalizeEngine(&subEngine[r]);
+			}
+			if (0 == (engine->cold->slabParts & FSME_SLAB_TABLES)) {
+				fsmeFreeEngines(allocator, subEngine, 
+					fsmeMachineGetRegionNum(engine->machine, i));
+			}
+		}
+	}
+
+	//release the event queue, the cold part and the tables
+	for (i = 0; i < FSME_PRIORITY_NUM; i++) {
+		fsmeDeallocate(allocator, engine->cold->queue[i].events,
+			sizeof(fsme_queued_event_t) * 
+			engine->cold->queue[i].capacity);
+	}
+	if (0 == (engine->cold->slabParts & FSME_SLAB_TABLES)) {
+		fsmeDeallocate(allocator, engine->cold, 
+			fsmeEngineColdSize(machine));
+	}
+
+	//release the machine
+	fsme_releaseMachine((fsme_machine_ptr_t)machine);
+}
+
+
+static boolean
+fsmeCopyEngine(fsme_engine_ptr_t engine, 
+			   fsme_engine_ptr_t prototype,
+			   boolean withState)
+{
+	const fsme_machine_t* machine = engine->machine;
+	int i = 0, r = 0;
+
+	//a transition in progress cannot be copied
+	if (withState && (prototype->eventDisabled || 
+		FSME_PHASE_NONE != fsmeEngineGetPending(prototype)->phase)) {
+		return FALSE;
+	}
+
+	engine->observer = prototype->observer;
+	engine->cold->entryAction = 
+		fsme_shareActionList(prototype->cold->entryAction);
+	engine->cold->exitAction = 
+		fsme_shareActionList(prototype->cold->exitAction);
+
+	for (i = 0; i < machine->stateNum; i++) {
+		engine->stateTable[i].entryAction = 
+			fsme_shareActionList(prototype->stateTable[i].entryAction);
+		engine->stateTable[i].exitAction = 
+			fsme_shareActionList(prototype->stateTable[i].exitAction);
+		for (r = 0; r < fsmeMachineGetRegionNum(machine, i); r++) {
+			if (!fsmeCopyEngine(&engine->stateTable[i].subEngine[r], 
+				&prototype->stateTable[i].subEngine[r], withState)) {
+				return FALSE;
+			}
+		}
+	}
+
+	for (i = 0; i < machine->transitionNum; i++) {
+		engine->transitionTable[i].guard = 
+			prototype->transitionTable[i].guard;
+		engine->transitionTable[i].action = 
+			fsme_shareActionList(prototype->transitionTable[i].action);
+	}
+
+	if (withState) {
+		fsmeEngineSetActiveState(engine, 
+			fsmeEngineGetActiveState(prototype));
+		engine->cold->historyState = prototype->cold->historyState;
+	}
+	return TRUE;
+}
+
+
+static void
+fsmeResetEngine(fsme_engine_ptr_t engine,
+				boolean keepActions)
+{
+	const fsme_machine_t* machine = engine->machine;
+	int i = 0, r = 0;
+
+	for (i = 0; i < machine->stateNum; i++) {
+		for (r = 0; r < fsmeMachineGetRegionNum(machine, i); r++) {
+			fsmeResetEngine(&engine->stateTable[i].subEngine[r], 
+				keepActions);
+		}
+	}
+
+	//the queue keeps its buffers
+	fsmeCancelTransition(engine);
+	fsmeClearQueue(engine);
+	engine->cold->historyState = FSME_INDEX_NONE;
+	engine->cold->enteredAt = 0;
+
+	if (!keepActions) {
+		fsme_clearActions(engine);
+		for (i = 0; i < machine->transitionNum; i++) {
+			engine->transitionTable[i].guard = NULL;
+		}
+		FSME_ATOMIC_STORE_PTR(&engine->observer, NULL);
+	}
+
+	//Not started and not frozen. The generation is 
+	//counted up, so that a thread that read the old 
+	//state word in fsme_postEventConcurrent() fails 
+	//its CAS.
+	FSME_ATOMIC_STORE(&engine->activeState, 
+		((FSME_ATOMIC_LOAD(&engine->activeState) & 
+		~(FSME_STATE_MASK | FSME_STATE_FROZEN)) | 
+		FSME_INDEX_NONE) + FSME_STATE_GENERATION);
+}
+
+
+static boolean
+fsmeMigrateEngine(fsme_engine_ptr_t engine,
+				  fsme_engine_ptr_t old,
+				  fsme_stateMapFuncPtr_t mapFunc,
+				  void* context)
+{
+	const fsme_machine_t* machine = engine->machine;
+	const fsme_machine_t* oldMachine = old->machine;
+	const fsme_event_queue_t* queue = NULL;
+	const fsme_queued_event_t* queued = NULL;
+	fsme_transition_t* transition = NULL;
+	fsme_index_t oldActive = fsmeEngineGetActiveState(old);
+	fsme_index_t active = FSME_INDEX_NONE;
+	fsme_index_t index = FSME_INDEX_NONE;
+	int i = 0, r = 0;
+
+	//The active state, by id or as mapped by the caller.
+	//It must have the regions its sub engines move to.
+	if (FSME_INDEX_NONE != oldActive) {
+		active = fsmeMigrateState(machine, oldMachine, oldActive,
+			mapFunc, context);
+		if (FSME_INDEX_NONE == active ||
+			fsmeMachineGetRegionNum(machine, active) != 
+			fsmeMachineGetRegionNum(oldMachine, oldActive)) {
+			return FALSE;
+		}
+		for (r = 0; r < fsmeMachineGetRegionNum(machine, active); r++) {
+			if (!fsmeMigrateEngine(
+				&engine->stateTable[active].subEngine[r],
+				&old->stateTable[oldActive].subEngine[r],
+				mapFunc, context)) {
+				return FALSE;
+			}
+		}
+	}
+
+	//The registrations, by id. The sub engines of the
+	//other states are not started, they only take 
+	//theirs and their history.
+	engine->observer = old->observer;
+	engine->cold->entryAction = 
+		fsme_shareActionList(old->cold->entryAction);
+	engine->cold->exitAction = 
+		fsme_shareActionList(old->cold->exitAction);
+
+	for (i = 0; i < oldMachine->stateNum; i++) {
+		if (NULL == old->stateTable[i].entryAction &&
+			NULL == old->stateTable[i].exitAction &&
+			0 == fsmeMachineGetRegionNum(oldMachine, i)) {
+			continue;
+		}
+		index = fsmeMigrateState(machine, oldMachine, i, NULL, NULL);
+		if (FSME_INDEX_NONE == index) continue;
+
+		engine->stateTable[index].entryAction = 
+			fsme_shareActionList(old->stateTable[i].entryAction);
+		engine->stateTable[index].exitAction = 
+			fsme_shareActionList(old->stateTable[i].exitAction);
+		if (index == active || 
+			fsmeMachineGetRegionNum(machine, index) != 
+			fsmeMachineGetRegionNum(oldMachine, i)) {
+			continue;
+		}
+		for (r = 0; r < fsmeMachineGetRegionNum(machine, index); r++) {
+			if (!fsmeMigrateEngine(
+				&engine->stateTable[index].subEngine[r],
+				&old->stateTable[i].subEngine[r], 
+				mapFunc, context)) {
+				return FALSE;
+			}
+		}
+	}
+
+	for (i = 0; i < oldMachine->transitionNum; i++) {
+		if (!fsmeTransitionHasGuard(&old->transitionTable[i]) &&
+			!fsmeTransitionHasAction(&old->transitionTable[i])) {
+			continue;
+		}
+		transition = fsmeGetTransitionById(engine, 
+			fsmeMachineGetTransitionId(oldMachine, i));
+		if (NULL == transition) continue;
+
+		transition->guard = old->transitionTable[i].guard;
+		transition->action = 
+			fsme_shareActionList(old->transitionTable[i].action);
+	}
+
+	//the queued events go to the lanes of the new version
+	for (i = 0; i < FSME_PRIORITY_NUM; i++) {
+		queue = &old->cold->queue[i];
+		for (r = 0; r < queue->count; r++) {
+			queued = &queue->events[
+				(queue->head + r) % queue->capacity];
+			fsmeQueueEvent(engine, queued->event, 
+				queued->inContext, queued->outContext);
+		}
+	}
+
+	if (FSME_INDEX_NONE != old->cold->historyState) {
+		engine->cold->historyState = fsmeMigrateState(machine, 
+			oldMachine, old->cold->historyState, NULL, NULL);
+	}
+	engine->cold->enteredAt = old->cold->enteredAt;
+	fsmeEngineSetActiveState(engine, active);
+	return TRUE;
+}
+
+
+static fsme_index_t
+fsmeMigrateState(const fsme_machine_t* machine,
+				 const fsme_machine_t* old,
+				 fsme_index_t state,
+				 fsme_stateMapFuncPtr_t mapFunc,
+				 void* context)
+{
+	int id = fsmeMachineGetStateId(old, state);
+	fsme_index_t i = 0;
+
+	for (;;) {
+		for (i = 0; i < machine->stateNum; i++) {
+			if (fsmeMachineGetStateId(machine, i) == id) {
+				return i;
+			}
+		}
+
+		//ask the caller once
+		if (NULL == mapFunc) {
+			return FSME_INDEX_NONE;
+		}
+		id = mapFunc(id, context);
+		mapFunc = NULL;
+	}
+}
+
+
+static void
+fsmeAdoptSubEngines(fsme_engine_ptr_t engine)
+{
+	const fsme_machine_t* machine = engine->machine;
+	int i = 0, r = 0;
+
+	for (i = 0; i < machine->stateNum; i++) {
+		for (r = 0; r < fsmeMachineGetRegionNum(machine, i); r++) {
+			engine->stateTable[i].subEngine[r].cold->parent = engine;
+		}
+	}
+}
+
+
+static void*
+fsmeDefaultAlloc(size_t size, size_t align, void* context)
+{
+	void* mem = NULL;
+
+	(void)context;
+#if defined(_WIN32)
+	mem = _aligned_malloc(size, align);
+#else
+	if (FSME_ALLOC_ALIGN >= align) {
+		mem = malloc(size);
+	} else if (0 != posix_memalign(&mem, align, size)) {
+		mem = NULL;
+	}
+#endif
+	return mem;
+}
+
+
+static void
+fsmeDefaultDealloc(void* mem, size_t size, void* context)
+{
+	(void)size;
+	(void)context;
+#if defined(_WIN32)
+	_aligned_free(mem);
+#else
+	free(mem);
+#endif
+}
+
+
+static unsigned long long
+fsmeDefaultClock(void)
+{
+	struct timespec now;
+
+#if defined(_WIN32)
+	timespec_get(&now, TIME_UTC);
+#else
+	clock_gettime(CLOCK_MONOTONIC, &now);
+#endif
+	return (unsigned long long)now.tv_sec * 1000000000ULL + 
+		(unsigned long long)now.tv_nsec;
+}
+
+
+static void
+fsmeDwellEnter(fsme_engine_ptr_t engine)
+{
+	const fsme_dwell_t* dwell = (const fsme_dwell_t*)
+		FSME_ATOMIC_LOAD_PTR(&engine->machine->dwell);
+
+	//kept one up, so that 0 means not taken
+	engine->cold->enteredAt = dwell->clock() + 1;
+}
+
+
+static void
+fsmeDwellExit(fsme_engine_ptr_t engine,
+			  fsme_index_t state)
+{
+	const fsme_dwell_t* dwell = (const fsme_dwell_t*)
+		FSME_ATOMIC_LOAD_PTR(&engine->machine->dwell);
+	unsigned long long* counters = NULL;
+	unsigned long long now = 0;
+	unsigned long long ticks = 0;
+	int bucket = 0;
+
+	//entered before tracking was turned on
+	if (0 == engine->cold->enteredAt) return;
+
+	now = dwell->clock();
+	if (now >= engine->cold->enteredAt - 1) {
+		ticks = now - (engine->cold->enteredAt - 1);
+	}
+	engine->cold->enteredAt = 0;
+
+	//bucket of floor(log2(ticks))
+	if (0 != ticks) {
+#if defined(_MSC_VER) && defined(_WIN64)
+		unsigned long index = 0;
+		_BitScanReverse64(&index, ticks);
+		bucket = (int)index;
+#elif defined(_MSC_VER)
+		unsigned long index = 0;
+		if (_BitScanReverse(&index, (unsigned long)(ticks >> 32))) {
+			bucket = (int)index + 32;
+		} else {
+			_BitScanReverse(&index, (unsigned long)ticks);
+			bucket = (int)index;
+		}
+#else
+		bucket = 63 - __builtin_clzll(ticks);
+#endif
+	}
+
+	counters = dwell->counters + 
+		(size_t)state * (FSME_DWELL_BUCKET_NUM + 1);
+	FSME_ATOMIC_ADD64(&counters[bucket], 1);
+	FSME_ATOMIC_ADD64(&counters[FSME_DWELL_BUCKET_NUM], ticks);
+}
+
+
+#ifdef FSME_DEBUG
+static void
+fsmeDebugEnterState(fsme_engine_ptr_t engine, int id, void* context)
+{
+	(void)context;
+	fprintf(stdout, 
+		"[FSME_DEBUG]: Engine(id=%d) entered state(id=%d). \n", 
+		engine->machine->id, id);
+}
+
+
+static void
+fsmeDebugExitState(fsme_engine_ptr_t engine, int id, void* context)
+{
+	(void)context;
+	fprintf(stdout, 
+		"[FSME_DEBUG]: Engine(id=%d) exited state(id=%d). \n", 
+		engine->machine->id, id);
+}
+
+
+static void
+fsmeDebugTransition(fsme_engine_ptr_t engine, int id, void* context)
+{
+	(void)context;
+	fprintf(stdout, 
+		"[FSME_DEBUG]: Engine(id=%d) takes transition(id=%d). \n", 
+		engine->machine->id, id);
+}
+
+
+static void
+fsmeDebugInvalidEvent(fsme_engine_ptr_t engine, int id, void* context)
+{
+	(void)context;
+	fprintf(stdout, 
+		"[FSME_DEBUG]: Engine(id=%d) got invalid event(id=%d). \n", 
+		engine->machine->id, id);
+}
+
+
+static void
+fsmeDebugGuardFailure(fsme_engine_ptr_t engine, int id, void* context)
+{
+	(void)engine;
+	(void)context;
+	fprintf(stdout, 
+		"[FSME_DEBUG]: Transition(id=%d) guard check failed. \n", 
+		id);
+}
+#endif
@@ -0,0 +1,307 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+#include "fsme_arena.h"
+
+
+/* ------------------- Local Macros -------------------------------- */
+/**
+ * Blocks of up to this many cache lines are kept in
+ * free lists by size; larger ones in one list.
+ */
+#define FSME_ARENA_CLASS_NUM		64
+
+/**
+ * Size the arena is rounded to when huge pages are used
+ */
+#define FSME_ARENA_HUGE_PAGE_SIZE	(2 * 1024 * 1024)
+
+/**
+ * mbind() policy, as in <numaif.h>
+ */
+#define FSME_ARENA_MPOL_BIND		2
+
+#define fsmeArenaLines(size)	\
+	(((size) + FSME_CACHE_LINE_SIZE - 1) / FSME_CACHE_LINE_SIZE)
+
+
+
+/* ------------------- local type definitions --------------------- */
+/* a free block, stored in the block itself */
+typedef struct fsme_arena_block
+{
+	struct fsme_arena_block*	next;
+	size_t						lines;
+} fsme_arena_block_t;
+
+struct fsme_arena
+{
+	pthread_mutex_t				lock;
+	unsigned char*				base;
+	size_t						size;
+	size_t						used;
+	int							node;
+
+	/* free blocks of 1 to FSME_ARENA_CLASS_NUM lines */
+	fsme_arena_block_t*			freeLists[FSME_ARENA_CLASS_NUM];
+
+	/* free blocks of more lines */
+	fsme_arena_block_t*			largeBlocks;
+
+	/* the arena as an allocator */
+	fsme_allocator_t			allocator;
+};
+
+
+
+/* ------------------- Local Function Prototypes ------------------- */
+static boolean
+fsmeArenaBind(void* base,
+			  size_t size,
+			  int node);
+static void*
+fsmeArenaAllocHook(size_t size,
+				   size_t align,
+				   void* context);
+static void
+fsmeArenaDeallocHook(void* mem,
+					 size_t size,
+					 void* context);
+
+
+
+/* -------------- Global Function Definitions -------------------- */
+fsme_arena_ptr_t
+fsme_newArena(size_t size,
+			  int node,
+			  unsigned int flags)
+{
+	fsme_arena_ptr_t arena = NULL;
+	void* base = MAP_FAILED;
+	int mapFlags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+	if (0 == size ||
+		FSME_ARENA_MAX_NODE <= node) {
+		return NULL;
+	}
+
+	if (0 != (flags & (FSME_ARENA_HUGE_PAGES | FSME_ARENA_HUGETLB))) {
+		size = (size + FSME_ARENA_HUGE_PAGE_SIZE - 1) /
+			FSME_ARENA_HUGE_PAGE_SIZE * FSME_ARENA_HUGE_PAGE_SIZE;
+	}
+#if defined(MAP_HUGETLB)
+	if (0 != (flags & FSME_ARENA_HUGETLB)) {
+		mapFlags |= MAP_HUGETLB;
+	}
+#endif
+
+	base = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		mapFlags, -1, 0);
+	if (MAP_FAILED == base) {
+		return NULL;
+	}
+
+#if defined(MADV_HUGEPAGE)
+	if (0 != (flags & FSME_ARENA_HUGE_PAGES)) {
+		madvise(base, size, MADV_HUGEPAGE);
+	}
+#endif
+
+	arena = (fsme_arena_ptr_t)calloc(1, sizeof(struct fsme_arena));
+	if (NULL == arena) {
+		munmap(base, size);
+		return NULL;
+	}
+
+	pthread_mutex_init(&arena->lock, NULL);
+	arena->base = (unsigned char*)base;
+	arena->size = size;
+	arena->used = 0;
+	arena->allocator.alloc = fsmeArenaAllocHook;
+	arena->allocator.dealloc = fsmeArenaDeallocHook;
+	arena->allocator.context = arena;
+
+	//bind the pages before they are first touched
+	arena->node = FSME_ARENA_NO_NODE;
+	if (0 <= node && fsmeArenaBind(base, size, node)) {
+		arena->node = node;
+	}
+
+	return arena;
+}
+
+
+void
+fsme_deleteArena(fsme_arena_ptr_t arena)
+{
+	if (NULL == arena) return;
+
+	munmap(arena->base, arena->size);
+	pthread_mutex_destroy(&arena->lock);
+	free(arena);
+}
+
+
+void*
+fsme_arenaAlloc(fsme_arena_ptr_t arena,
+				size_t size)
+{
+	const size_t lines = fsmeArenaLines(size);
+	fsme_arena_block_t** prev = NULL;
+	fsme_arena_block_t* block = NULL;
+	void* mem = NULL;
+
+	if (NULL == arena || 0 == lines) return NULL;
+
+	pthread_mutex_lock(&arena->lock);
+
+	//reuse a free block of the same size
+	if (FSME_ARENA_CLASS_NUM >= lines) {
+		block = arena->freeLists[lines - 1];
+		if (NULL != block) {
+			arena->freeLists[lines - 1] = block->next;
+		}
+	} else {
+		for (prev = &arena->largeBlocks; NULL != *prev;
+			prev = &(*prev)->next) {
+			if (lines == (*prev)->lines) {
+				block = *prev;
+				*prev = block->next;
+				break;
+			}
+		}
+	}
+
+	if (NULL != block) {
+		mem = block;
+	} else if (arena->used + lines * FSME_CACHE_LINE_SIZE <=
+		arena->size) {
+		mem = arena->base + arena->used;
+		arena->used += lines * FSME_CACHE_LINE_SIZE;
+	}
+
+	pthread_mutex_unlock(&arena->lock);
+
+	return mem;
+}
+
+
+void
+fsme_arenaFree(fsme_arena_ptr_t arena,
+			   void* mem,
+			   size_t size)
+{
+	const size_t lines = fsmeArenaLines(size);
+	fsme_arena_block_t* block = (fsme_arena_block_t*)mem;
+
+	if (NULL == arena || NULL == mem) return;
+
+	pthread_mutex_lock(&arena->lock);
+
+	block->lines = lines;
+	if (FSME_ARENA_CLASS_NUM >= lines) {
+		block->next = arena->freeLists[lines - 1];
+		arena->freeLists[lines - 1] = block;
+	} else {
+		block->next = arena->largeBlocks;
+		arena->largeBlocks = block;
+	}
+
+	pthread_mutex_unlock(&arena->lock);
+}
+
+
+const fsme_allocator_t*
+fsme_arenaGetAllocator(fsme_arena_ptr_t arena)
+{
+	if (NULL == arena) return NULL;
+
+	return &arena->allocator;
+}
+
+
+fsme_engine_ptr_t
+fsme_newEngineInArena(fsme_machine_ptr_t machine,
+					  fsme_arena_ptr_t arena)
+{
+	return fsme_newEngineWithAllocator(machine, 
+		fsme_arenaGetAllocator(arena));
+}
+
+
+int
+fsme_arenaGetNode(fsme_arena_ptr_t arena)
+{
+	if (NULL == arena) return FSME_ARENA_NO_NODE;
+
+	return arena->node;
+}
+
+
+int
+fsme_currentNode(void)
+{
+#if defined(__linux__) && defined(SYS_getcpu)
+	unsigned int cpu = 0;
+	unsigned int node = 0;
+
+	if (0 == syscall(SYS_getcpu, &cpu, &node, NULL)) {
+		return (int)node;
+	}
+#endif
+	return 0;
+}
+
+
+
+/* -------------- Local Function Definitions -------------------- */
+static boolean
+fsmeArenaBind(void* base,
+			  size_t size,
+			  int node)
+{
+#if defined(__linux__) && defined(SYS_mbind)
+	unsigned long mask[FSME_ARENA_MAX_NODE / (8 * sizeof(unsigned long))];
+
+	memset(mask, 0, sizeof(mask));
+	mask[node / (8 * sizeof(unsigned long))] |=
+		1UL << (node % (8 * sizeof(unsigned long)));
+
+	//called directly, so that libnuma is not needed
+	return (boolean)(0 == syscall(SYS_mbind, base, size,
+		FSME_ARENA_MPOL_BIND, mask, sizeof(mask) * 8 + 1, 0));
+#else
+	return FALSE;
+#endif
+}
+
+
+static void*
+fsmeArenaAllocHook(size_t size,
+				   size_t align,
+				   void* context)
+{
+	//blocks are aligned to cache lines
+	if (FSME_CACHE_LINE_SIZE < align) return NULL;
+
+	return fsme_arenaAlloc((fsme_arena_ptr_t)context, size);
+}
+
+
+static void
+fsmeArenaDeallocHook(void* mem,
+					 size_t size,
+					 void* context)
+{
+	fsme_arenaFree((fsme_arena_ptr_t)context, mem, size);
+}
@@ -0,0 +1,142 @@
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "fsme_bump.h"
+
+
+/* ------------------- local type definitions --------------------- */
+struct fsme_bump_arena
+{
+	unsigned char*				base;
+	size_t						size;
+	size_t						used;
+	size_t						peak;
+
+	/* the buffer follows the arena */
+	boolean						ownBuffer;
+
+	/* the arena as an allocator */
+	fsme_allocator_t			allocator;
+};
+
+
+
+/* ------------------- Local Function Prototypes ------------------- */
+static void*
+fsmeBumpAlloc(size_t size,
+			  size_t align,
+			  void* context);
+static void
+fsmeBumpDealloc(void* mem,
+				size_t size,
+				void* context);
+
+
+
+/* -------------- Global Function Definitions -------------------- */
+fsme_bump_arena_ptr_t
+fsme_newBumpArena(void* buffer,
+				  size_t size)
+{
+	fsme_bump_arena_ptr_t arena = NULL;
+
+	if (0 == size) return NULL;
+
+	//an arena of its own buffer is allocated with it
+	arena = (fsme_bump_arena_ptr_t)malloc(
+		sizeof(struct fsme_bump_arena) + ((NULL == buffer) ? size : 0));
+	if (NULL == arena) return NULL;
+
+	arena->ownBuffer = (boolean)(NULL == buffer);
+	arena->base = arena->ownBuffer ? 
+		(unsigned char*)(arena + 1) : (unsigned char*)buffer;
+	arena->size = size;
+	arena->used = 0;
+	arena->peak = 0;
+	arena->allocator.alloc = fsmeBumpAlloc;
+	arena->allocator.dealloc = fsmeBumpDealloc;
+	arena->allocator.context = arena;
+
+	return arena;
+}
+
+
+void
+fsme_deleteBumpArena(fsme_bump_arena_ptr_t arena)
+{
+	free(arena);
+}
+
+
+const fsme_allocator_t*
+fsme_bumpArenaGetAllocator(fsme_bump_arena_ptr_t arena)
+{
+	if (NULL == arena) return NULL;
+
+	return &arena->allocator;
+}
+
+
+void
+fsme_bumpArenaReset(fsme_bump_arena_ptr_t arena)
+{
+	if (NULL == arena) return;
+
+	arena->used = 0;
+	arena->peak = 0;
+}
+
+
+size_t
+fsme_bumpArenaGetUsed(fsme_bump_arena_ptr_t arena)
+{
+	return (NULL != arena) ? arena->used : 0;
+}
+
+
+size_t
+fsme_bumpArenaGetPeak(fsme_bump_arena_ptr_t arena)
+{
+	return (NULL != arena) ? arena->peak : 0;
+}
+
+
+
+/* -------------- Local Function Definitions -------------------- */
+static void*
+fsmeBumpAlloc(size_t size,
+			  size_t align,
+			  void* context)
+{
+	fsme_bump_arena_ptr_t const arena = (fsme_bump_arena_ptr_t)context;
+	const uintptr_t start = (uintptr_t)(arena->base + arena->used);
+	size_t offset = 0;
+
+	//align the address, not the offset, as the buffer
+	//may be aligned to less
+	offset = (size_t)(((start + align - 1) & ~(uintptr_t)(align - 1)) -
+		(uintptr_t)arena->base);
+	if (offset > arena->size || size > arena->size - offset) {
+		return NULL;
+	}
+
+	arena->used = offset + size;
+	if (arena->peak < arena->used) {
+		arena->peak = arena->used;
+	}
+	return arena->base + offset;
+}
+
+
+static void
+fsmeBumpDealloc(void* mem,
+				size_t size,
+				void* context)
+{
+	fsme_bump_arena_ptr_t const arena = (fsme_bump_arena_ptr_t)context;
+
+	//only the last block can be given back
+	if ((unsigned char*)mem + size == arena->base + arena->used) {
+		arena->used = (size_t)((unsigned char*)mem - arena->base);
+	}
+}
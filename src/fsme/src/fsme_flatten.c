@@ -0,0 +1,624 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "fsme.h"
+#include "fsme_flatten.h"
+
+
+/* ------------------- Local Macros -------------------------------- */
+#define fsmeFlatGetSubEngine(engine, state)	\
+	((engine)->stateTable[state].subEngine)
+
+#define fsmeFlatHasSubEngine(engine, state)	\
+	(0 < fsmeMachineGetRegionNum((engine)->machine, state))
+
+
+
+/* ------------------- local type definitions --------------------- */
+/* A leaf configuration: the active state of every
+ * nesting level. The last one is FSME_INDEX_NONE if
+ * the sub machine of that level has reached its
+ * final state. */
+typedef struct fsme_flat_config
+{
+	int						depth;
+	fsme_index_t			states[FSME_FLATTEN_DEPTH_MAX];
+} fsme_flat_config_t;
+
+/* a transition of the flat machine */
+typedef struct fsme_flat_transition
+{
+	int						source;
+	int						target;
+	int						event;
+	fsme_guardFuncPtr_t		guard;
+	fsme_action_ptr_t		action;
+} fsme_flat_transition_t;
+
+/* an action list being built, with the allocator of
+ * the flat engine. failed is set if a copy could not 
+ * be allocated. */
+typedef struct fsme_flat_list
+{
+	fsme_action_ptr_t		head;
+	fsme_action_ptr_t*		tail;
+	const fsme_allocator_t*	allocator;
+	boolean					failed;
+} fsme_flat_list_t;
+
+/* what the flat machine is built from */
+typedef struct fsme_flat_work
+{
+	/* the hierarchical engine */
+	fsme_engine_ptr_t		engine;
+
+	/* leaf configurations, in depth first order */
+	fsme_flat_config_t*		configs;
+	int						configNum;
+	int						configCapacity;
+
+	fsme_flat_transition_t*	transitions;
+	int						transitionNum;
+	int						transitionCapacity;
+
+	/* largest number of events of the machines */
+	int						eventNum;
+
+	/* a table or an action list of a transition is
+	 * incomplete */
+	boolean					failed;
+} fsme_flat_work_t;
+
+
+
+/* ------------------- Local Function Prototypes ------------------- */
+static boolean
+fsmeFlatCheck(const fsme_machine_t* machine,
+			  int depth,
+			  int* eventNum);
+static void
+fsmeFlatCollect(fsme_flat_work_t* work,
+				fsme_engine_ptr_t engine,
+				fsme_flat_config_t* config,
+				int level);
+static int
+fsmeFlatCompare(const void* a,
+				const void* b);
+static int
+fsmeFlatFind(const fsme_flat_work_t* work,
+			 const fsme_flat_config_t* config);
+static fsme_engine_ptr_t
+fsmeFlatGetEngine(const fsme_flat_work_t* work,
+				  const fsme_flat_config_t* config,
+				  int level);
+static void
+fsmeFlatInitList(fsme_flat_list_t* list,
+				 const fsme_allocator_t* allocator);
+static void
+fsmeFlatCopyActions(fsme_flat_list_t* list,
+					fsme_action_ptr_t action);
+static void
+fsmeFlatFreeActions(const fsme_allocator_t* allocator,
+					fsme_action_ptr_t action);
+static void
+fsmeFlatExitEngine(fsme_flat_list_t* list,
+				   const fsme_flat_config_t* config,
+				   fsme_engine_ptr_t engine,
+				   int level);
+static void
+fsmeFlatEnterState(fsme_flat_list_t* list,
+				   fsme_flat_config_t* config,
+				   fsme_engine_ptr_t engine,
+				   int level,
+				   fsme_index_t state);
+static void
+fsmeFlatAddTransition(fsme_flat_work_t* work,
+					  int source,
+					  int event);
+static fsm_machine_t*
+fsmeFlatBuildMachine(const fsme_flat_work_t* work,
+					 int entryConfig,
+					 size_t* size);
+
+
+
+/* -------------- Global Function Definitions -------------------- */
+fsme_engine_ptr_t
+fsme_newFlatEngine(fsme_engine_ptr_t engine)
+{
+	fsme_flat_work_t work;
+	fsme_flat_config_t config;
+	fsme_flat_list_t entryList;
+	fsme_flat_list_t exitList;
+	fsm_machine_t* definition = NULL;
+	size_t definitionSize = 0;
+	fsme_machine_ptr_t machine = NULL;
+	fsme_engine_ptr_t flat = NULL;
+	int entryConfig = 0;
+	int i = 0, e = 0;
+
+	if (NULL == engine || NULL != engine->cold->parent) {
+		return NULL;
+	}
+
+	memset(&work, 0, sizeof(work));
+	work.engine = engine;
+	if (!fsmeFlatCheck(engine->machine, 1, &work.eventNum)) {
+		return NULL;
+	}
+
+	//////////////////////////////
+	//Collect the leaf configurations
+	//////////////////////////////
+	memset(&config, 0, sizeof(config));
+	fsmeFlatCollect(&work, engine, &config, 0);
+	if (work.failed) {
+		free(work.configs);
+		return NULL;
+	}
+	qsort(work.configs, work.configNum, sizeof(fsme_flat_config_t),
+		fsmeFlatCompare);
+
+	//Starting the flat engine runs the entry actions of
+	//the whole initial configuration.
+	fsmeFlatInitList(&entryList, engine->cold->allocator);
+	fsmeFlatCopyActions(&entryList, engine->cold->entryAction);
+	memset(&config, 0, sizeof(config));
+	fsmeFlatEnterState(&entryList, &config, engine, 0,
+		engine->machine->entryState);
+	entryConfig = fsmeFlatFind(&work, &config);
+
+	//////////////////////////////
+	//Resolve every event in every configuration,
+	//in order of the event ids
+	//////////////////////////////
+	if (FSME_INDEX_MAX >= work.configNum && 0 <= entryConfig) {
+		for (e = 0; e < work.eventNum && !work.failed; e++) {
+			for (i = 0; i < work.configNum; i++) {
+				fsmeFlatAddTransition(&work, i, e);
+			}
+		}
+		if (!work.failed) {
+			definition = fsmeFlatBuildMachine(&work, entryConfig,
+				&definitionSize);
+			machine = fsme_compileMachine(definition);
+		}
+	}
+
+	if (NULL != machine) {
+		//the compiled machine owns the flat definition
+		machine->ownDefinition = definition;
+		machine->ownDefinitionSize = definitionSize;
+		flat = fsme_newEngineWithAllocator(machine, 
+			engine->cold->allocator);
+		fsme_releaseMachine(machine);
+	} else {
+		fsmeDeallocate(fsme_getAllocator(), definition, 
+			definitionSize);
+	}
+
+	fsmeFlatInitList(&exitList, engine->cold->allocator);
+	fsmeFlatCopyActions(&exitList, engine->cold->exitAction);
+	if (NULL != flat && !work.failed && 
+		!entryList.failed && !exitList.failed) {
+		flat->cold->entryAction = entryList.head;
+		flat->cold->exitAction = exitList.head;
+		for (i = 0; i < work.transitionNum; i++) {
+			flat->transitionTable[i].guard = work.transitions[i].guard;
+			flat->transitionTable[i].action = work.transitions[i].action;
+		}
+	} else {
+		fsme_deleteEngine(flat);
+		flat = NULL;
+		fsmeFlatFreeActions(engine->cold->allocator, entryList.head);
+		fsmeFlatFreeActions(engine->cold->allocator, exitList.head);
+		for (i = 0; i < work.transitionNum; i++) {
+			fsmeFlatFreeActions(engine->cold->allocator, 
+				work.transitions[i].action);
+		}
+	}
+
+	free(work.configs);
+	free(work.transitions);
+
+	return flat;
+}
+
+
+
+/* -------------- Local Function Definitions -------------------- */
+static boolean
+fsmeFlatCheck(const fsme_machine_t* machine,
+			  int depth,
+			  int* eventNum)
+{
+	const fsme_regions_t* regions = NULL;
+	int i = 0;
+
+	//the flat machine takes the event ids of all
+	//levels as its indexes
+	if (FSME_FLATTEN_DEPTH_MAX < depth ||
+		NULL != machine->eventKeys) {
+		return FALSE;
+	}
+	if (*eventNum < machine->eventNum) {
+		*eventNum = machine->eventNum;
+	}
+
+	for (i = 0; i < machine->stateNum; i++) {
+		regions = fsmeMachineGetRegions(machine, i);
+		if (NULL == regions) continue;
+
+		//the history of a sub machine is only known
+		//when the engine runs
+		if (1 < regions->regionNum ||
+			FSM_HISTORY_NONE != fsmeMachineGetStateHistory(machine, i) ||
+			!fsmeFlatCheck(regions->machines[0], depth + 1, eventNum)) {
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+
+static void
+fsmeFlatCollect(fsme_flat_work_t* work,
+				fsme_engine_ptr_t engine,
+				fsme_flat_config_t* config,
+				int level)
+{
+	const fsme_machine_t* machine = engine->machine;
+	fsme_flat_config_t* configs = NULL;
+	fsme_index_t i = 0;
+
+	for (i = 0; i <= machine->stateNum && !work->failed; i++) {
+		if (machine->stateNum == i) {
+			//A sub machine in its final state has exited,
+			//the top-level one stops in it.
+			if (0 == level) break;
+			config->states[level] = FSME_INDEX_NONE;
+		} else {
+			if (0 < level && fsmeMachineStateIsFinal(machine, i)) {
+				continue;
+			}
+			config->states[level] = i;
+			if (fsmeFlatHasSubEngine(engine, i)) {
+				fsmeFlatCollect(work, fsmeFlatGetSubEngine(engine, i),
+					config, level + 1);
+				continue;
+			}
+		}
+
+		if (work->configNum == work->configCapacity) {
+			configs = (fsme_flat_config_t*)realloc(work->configs,
+				sizeof(fsme_flat_config_t) * ((0 < work->configCapacity) ?
+				2 * work->configCapacity : 16));
+			if (NULL == configs) {
+				work->failed = TRUE;
+				return;
+			}
+			work->configs = configs;
+			work->configCapacity = (0 < work->configCapacity) ?
+				2 * work->configCapacity : 16;
+		}
+		config->depth = level + 1;
+		work->configs[work->configNum++] = *config;
+	}
+}
+
+
+static int
+fsmeFlatCompare(const void* a,
+				const void* b)
+{
+	const fsme_flat_config_t* configA = (const fsme_flat_config_t*)a;
+	const fsme_flat_config_t* configB = (const fsme_flat_config_t*)b;
+	int i = 0;
+
+	for (i = 0; i < configA->depth && i < configB->depth; i++) {
+		if (configA->states[i] != configB->states[i]) {
+			return (configA->states[i] < configB->states[i]) ? -1 : 1;
+		}
+	}
+	return configA->depth - configB->depth;
+}
+
+
+static int
+fsmeFlatFind(const fsme_flat_work_t* work,
+			 const fsme_flat_config_t* config)
+{
+	const fsme_flat_config_t* found = (const fsme_flat_config_t*)
+		bsearch(config, work->configs, work->configNum,
+		sizeof(fsme_flat_config_t), fsmeFlatCompare);
+
+	return (NULL != found) ? (int)(found - work->configs) : -1;
+}
+
+
+static fsme_engine_ptr_t
+fsmeFlatGetEngine(const fsme_flat_work_t* work,
+				  const fsme_flat_config_t* config,
+				  int level)
+{
+	fsme_engine_ptr_t engine = work->engine;
+	int i = 0;
+
+	for (i = 0; i < level; i++) {
+		engine = fsmeFlatGetSubEngine(engine, config->states[i]);
+	}
+	return engine;
+}
+
+
+static void
+fsmeFlatInitList(fsme_flat_list_t* list,
+				 const fsme_allocator_t* allocator)
+{
+	list->head = NULL;
+	list->tail = &list->head;
+	list->allocator = allocator;
+	list->failed = FALSE;
+}
+
+
+static void
+fsmeFlatCopyActions(fsme_flat_list_t* list,
+					fsme_action_ptr_t action)
+{
+	fsme_action_ptr_t copy = NULL;
+
+	for (; NULL != action; action = action->next) {
+		copy = (fsme_action_ptr_t)fsmeAllocate(list->allocator,
+			sizeof(struct fsme_action), FSME_ALLOC_ALIGN);
+		if (NULL == copy) {
+			list->failed = TRUE;
+			return;
+		}
+		copy->action = action->action;
+		copy->id = action->id;
+		copy->refCount = 1;
+		copy->block = NULL;
+		copy->next = NULL;
+
+		*list->tail = copy;
+		list->tail = &copy->next;
+	}
+}
+
+
+static void
+fsmeFlatFreeActions(const fsme_allocator_t* allocator,
+					fsme_action_ptr_t action)
+{
+	fsme_action_ptr_t next = NULL;
+
+	for (; NULL != action; action = next) {
+		next = action->next;
+		fsmeDeallocate(allocator, action, sizeof(struct fsme_action));
+	}
+}
+
+
+static void
+fsmeFlatExitEngine(fsme_flat_list_t* list,
+				   const fsme_flat_config_t* config,
+				   fsme_engine_ptr_t engine,
+				   int level)
+{
+	const fsme_index_t state = config->states[level];
+
+	//As fsmeExitEngine(): the running sub engine of the
+	//active state first, then the engine itself. The
+	//active state does not run its exit actions.
+	if (FSME_INDEX_NONE != state &&
+		fsmeFlatHasSubEngine(engine, state) &&
+		FSME_INDEX_NONE != config->states[level + 1]) {
+		fsmeFlatExitEngine(list, config,
+			fsmeFlatGetSubEngine(engine, state), level + 1);
+	}
+	fsmeFlatCopyActions(list, engine->cold->exitAction);
+}
+
+
+static void
+fsmeFlatEnterState(fsme_flat_list_t* list,
+				   fsme_flat_config_t* config,
+				   fsme_engine_ptr_t engine,
+				   int level,
+				   fsme_index_t state)
+{
+	fsme_engine_ptr_t subEngine = NULL;
+
+	//As fsmeEnterState(): the entry actions of the
+	//state, then its sub engine from its init state.
+	config->states[level] = state;
+	config->depth = level + 1;
+	fsmeFlatCopyActions(list, engine->stateTable[state].entryAction);
+
+	if (fsmeFlatHasSubEngine(engine, state)) {
+		subEngine = fsmeFlatGetSubEngine(engine, state);
+		fsmeFlatCopyActions(list, subEngine->cold->entryAction);
+		fsmeFlatEnterState(list, config, subEngine, level + 1,
+			subEngine->machine->entryState);
+	}
+
+	//A sub engine entering its final state exits. The
+	//flat engine exits by itself in a top-level one.
+	if (0 < level && fsmeMachineStateIsFinal(engine->machine, state)) {
+		fsmeFlatCopyActions(list, engine->cold->exitAction);
+		config->states[level] = FSME_INDEX_NONE;
+	}
+}
+
+
+static void
+fsmeFlatAddTransition(fsme_flat_work_t* work,
+					  int source,
+					  int event)
+{
+	const fsme_flat_config_t* config = &work->configs[source];
+	fsme_flat_config_t target;
+	fsme_flat_transition_t* transitions = NULL;
+	fsme_flat_transition_t* transition = NULL;
+	fsme_flat_list_t list;
+	fsme_engine_ptr_t engine = NULL;
+	fsme_index_t index = FSME_INDEX_NONE;
+	fsme_index_t state = FSME_INDEX_NONE;
+	int level = 0;
+
+	//the innermost engine with a transition takes it
+	for (level = config->depth - 1; 0 <= level; level--) {
+		state = config->states[level];
+		engine = fsmeFlatGetEngine(work, config, level);
+		if (FSME_INDEX_NONE != state &&
+			event < engine->machine->eventNum) {
+			index = fsmeMachineFindTransition(engine->machine,
+				state, event);
+			if (FSME_INDEX_NONE != index) break;
+		}
+	}
+	if (0 > level) return;
+
+	//As fsmeProcessTransition(): exit the sub engine of
+	//the source state, which may have finished already,
+	//then the source state itself.
+	fsmeFlatInitList(&list, work->engine->cold->allocator);
+	if (fsmeFlatHasSubEngine(engine, state)) {
+		fsmeFlatExitEngine(&list, config,
+			fsmeFlatGetSubEngine(engine, state), level + 1);
+	}
+	fsmeFlatCopyActions(&list, engine->stateTable[state].exitAction);
+	fsmeFlatCopyActions(&list, engine->transitionTable[index].action);
+
+	//the levels above the transition stay as they are
+	target = *config;
+	fsmeFlatEnterState(&list, &target, engine, level,
+		fsmeMachineGetTargetState(engine->machine, index));
+
+	if (work->transitionNum == work->transitionCapacity) {
+		transitions = (fsme_flat_transition_t*)
+			realloc(work->transitions, sizeof(fsme_flat_transition_t) *
+			((0 < work->transitionCapacity) ?
+			2 * work->transitionCapacity : 16));
+		if (NULL == transitions) {
+			fsmeFlatFreeActions(list.allocator, list.head);
+			work->failed = TRUE;
+			return;
+		}
+		work->transitions = transitions;
+		work->transitionCapacity = (0 < work->transitionCapacity) ?
+			2 * work->transitionCapacity : 16;
+	}
+	transition = &work->transitions[work->transitionNum++];
+	transition->source = source;
+	transition->target = fsmeFlatFind(work, &target);
+	transition->event = event;
+	transition->guard = engine->transitionTable[index].guard;
+	transition->action = list.head;
+	work->failed |= list.failed || 0 > transition->target;
+}
+
+
+static fsm_machine_t*
+fsmeFlatBuildMachine(const fsme_flat_work_t* work,
+					 int entryConfig,
+					 size_t* size)
+{
+	const fsm_machine_t* definition = work->engine->machine->definition;
+	const fsme_flat_config_t* config = NULL;
+	fsm_machine_t* flat = NULL;
+	fsm_state_t* states = NULL;
+	fsm_transition_t* transitions = NULL;
+	fsm_trigger_t* triggers = NULL;
+	fsm_event_t* events = NULL;
+	int* stateIds = NULL;
+	int i = 0;
+
+	//////////////////////////////
+	//Allocate the machine and its tables in one block,
+	//with the allocator it is compiled with
+	//////////////////////////////
+	*size = sizeof(fsm_machine_t) +
+		sizeof(fsm_state_t) * work->configNum +
+		sizeof(fsm_transition_t) * work->transitionNum +
+		sizeof(fsm_trigger_t) * work->transitionNum +
+		sizeof(fsm_event_t) * definition->eventTableNum +
+		sizeof(int) * work->configNum;
+	flat = (fsm_machine_t*)fsmeAllocate(fsme_getAllocator(), 
+		*size, FSME_ALLOC_ALIGN);
+	if (NULL == flat) return NULL;
+	memset(flat, 0, *size);
+	states = (fsm_state_t*)(flat + 1);
+	transitions = (fsm_transition_t*)(states + work->configNum);
+	triggers = (fsm_trigger_t*)(transitions + work->transitionNum);
+	events = (fsm_event_t*)(triggers + work->transitionNum);
+	stateIds = (int*)(events + definition->eventTableNum);
+
+	//The tables have const members, so every entry is
+	//built aside and copied in.
+	for (i = 0; i < work->configNum; i++) {
+		config = &work->configs[i];
+		stateIds[i] = i;
+		if (1 == config->depth && fsmeMachineStateIsFinal(
+			work->engine->machine, config->states[0])) {
+			stateIds[i] = FSME_FINAL_STATE_ID;
+		}
+		{
+			fsm_state_t state = {
+				stateIds[i],
+				(boolean)(FSME_FINAL_STATE_ID == stateIds[i]),
+				NULL,
+				FSM_HISTORY_NONE,
+				NULL,
+				0,
+				NULL
+			};
+			memcpy(&states[i], &state, sizeof(fsm_state_t));
+		}
+	}
+
+	//transitions are already in order of their event
+	for (i = 0; i < work->transitionNum; i++) {
+		fsm_transition_t transition = {
+			i,
+			stateIds[work->transitions[i].source],
+			stateIds[work->transitions[i].target],
+			NULL
+		};
+		fsm_trigger_t trigger = {
+			stateIds[work->transitions[i].source],
+			work->transitions[i].event,
+			i
+		};
+		memcpy(&transitions[i], &transition, sizeof(fsm_transition_t));
+		memcpy(&triggers[i], &trigger, sizeof(fsm_trigger_t));
+	}
+
+	if (0 < definition->eventTableNum &&
+		NULL != definition->eventTable) {
+		memcpy(events, definition->eventTable,
+			sizeof(fsm_event_t) * definition->eventTableNum);
+	}
+
+	{
+		fsm_machine_t machine = {
+			definition->id,
+			states,
+			work->configNum,
+			transitions,
+			work->transitionNum,
+			work->eventNum,
+			triggers,
+			work->transitionNum,
+			stateIds[entryConfig],
+			(NULL != definition->eventTable) ? events : NULL,
+			(NULL != definition->eventTable) ?
+				definition->eventTableNum : 0,
+			FALSE
+		};
+		memcpy(flat, &machine, sizeof(fsm_machine_t));
+	}
+
+	return flat;
+}
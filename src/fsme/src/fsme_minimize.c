@@ -0,0 +1,714 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fsme.h"
+#include "fsme_minimize.h"
+
+
+/* ------------------- Local Macros -------------------------------- */
+#define fsmeMinStateHasRegions(state)	\
+	(NULL != (state)->subMachine || NULL != (state)->regionTable)
+
+
+
+/* ------------------- local type definitions --------------------- */
+/* an id and the position it is found at */
+typedef struct fsme_min_id
+{
+	int						id;
+	int						index;
+} fsme_min_id_t;
+
+/* the keys of a state or transition, see fsmeMinRank() */
+typedef struct fsme_min_row
+{
+	const uintptr_t*		keys;
+	int						num;
+	int						index;
+} fsme_min_row_t;
+
+/* what is known of the machine being minimized */
+typedef struct fsme_min_work
+{
+	const fsm_machine_t*	stateMachine;
+
+	/* ids sorted, with their positions */
+	fsme_min_id_t*			stateIds;
+	fsme_min_id_t*			transitionIds;
+
+	/* source and target state of each transition */
+	int*					source;
+	int*					target;
+
+	/* transition of each state and event, -1 if none */
+	int*					dispatch;
+
+	/* class of each state, -1 if it is unreachable */
+	int*					classes;
+
+	/* first state of each class */
+	int*					reps;
+
+	/* is the transition in the minimized machine */
+	boolean*				kept;
+
+	int						entryState;
+} fsme_min_work_t;
+
+
+
+/* ------------------- Local Function Prototypes ------------------- */
+static int
+fsmeMinCompareIds(const void* a,
+				  const void* b);
+static int
+fsmeMinFindIndex(const fsme_min_id_t* ids,
+				 int num,
+				 int id);
+static int
+fsmeMinCompareRows(const void* a,
+				   const void* b);
+static int
+fsmeMinRank(fsme_min_row_t* rows,
+			int num,
+			int* ranks);
+static boolean
+fsmeMinResolve(fsme_min_work_t* work);
+static boolean
+fsmeMinReach(fsme_min_work_t* work);
+static uintptr_t*
+fsmeMinActionRow(uintptr_t head,
+				 fsme_action_ptr_t first,
+				 fsme_action_ptr_t second,
+				 int* num);
+static boolean
+fsmeMinActionKeys(fsme_engine_ptr_t actions,
+				  const fsm_machine_t* stateMachine,
+				  int* stateKeys,
+				  int* transitionKeys);
+static int
+fsmeMinMerge(fsme_min_work_t* work,
+			 const int* stateKeys,
+			 const int* transitionKeys);
+static fsm_machine_t*
+fsmeMinBuild(fsme_min_work_t* work);
+static void
+fsmeMinMapIds(const fsme_min_work_t* work,
+			  int* stateIdMap,
+			  int* transitionIdMap);
+
+
+
+/* -------------- Global Function Definitions -------------------- */
+fsm_machine_t*
+fsme_minimizeMachine(const fsm_machine_t* stateMachine,
+					 fsme_engine_ptr_t actions,
+					 unsigned int flags,
+					 int* stateIdMap,
+					 int* transitionIdMap)
+{
+	fsm_machine_t* minimized = NULL;
+	fsme_min_work_t work;
+	int* stateKeys = NULL;
+	int* transitionKeys = NULL;
+	boolean merged = TRUE;
+
+	if (NULL == stateMachine ||
+		0 >= stateMachine->stateNum ||
+		0 >= stateMachine->transitionNum ||
+		0 >= stateMachine->eventNum ||
+		stateMachine->sparseEvents ||
+		(NULL != actions &&
+		actions->machine->definition != stateMachine)) {
+		return NULL;
+	}
+
+	work.stateMachine = stateMachine;
+	work.stateIds = (fsme_min_id_t*)
+		malloc(sizeof(fsme_min_id_t) * stateMachine->stateNum);
+	work.transitionIds = (fsme_min_id_t*)
+		malloc(sizeof(fsme_min_id_t) * stateMachine->transitionNum);
+	work.source = (int*)malloc(sizeof(int) * stateMachine->transitionNum);
+	work.target = (int*)malloc(sizeof(int) * stateMachine->transitionNum);
+	work.dispatch = (int*)malloc(sizeof(int) *
+		(size_t)stateMachine->stateNum * stateMachine->eventNum);
+	work.classes = (int*)malloc(sizeof(int) * stateMachine->stateNum);
+	work.reps = (int*)malloc(sizeof(int) * stateMachine->stateNum);
+	work.kept = (boolean*)
+		calloc(stateMachine->transitionNum, sizeof(boolean));
+	work.entryState = -1;
+
+	//nothing is minimized if memory runs out
+	if (NULL != work.stateIds && NULL != work.transitionIds &&
+		NULL != work.source && NULL != work.target &&
+		NULL != work.dispatch && NULL != work.classes &&
+		NULL != work.reps && NULL != work.kept &&
+		fsmeMinResolve(&work) && fsmeMinReach(&work)) {
+		if (0 != (flags & FSME_MINIMIZE_MERGE)) {
+			stateKeys = (int*)
+				calloc(stateMachine->stateNum, sizeof(int));
+			transitionKeys = (int*)
+				calloc(stateMachine->transitionNum, sizeof(int));
+			merged = (boolean)(NULL != stateKeys && 
+				NULL != transitionKeys &&
+				(NULL == actions || fsmeMinActionKeys(actions, 
+				stateMachine, stateKeys, transitionKeys)) &&
+				0 <= fsmeMinMerge(&work, stateKeys, transitionKeys));
+			free(stateKeys);
+			free(transitionKeys);
+		}
+
+		if (merged) {
+			minimized = fsmeMinBuild(&work);
+		}
+		if (NULL != minimized) {
+			fsmeMinMapIds(&work, stateIdMap, transitionIdMap);
+		}
+	}
+
+	free(work.stateIds);
+	free(work.transitionIds);
+	free(work.source);
+	free(work.target);
+	free(work.dispatch);
+	free(work.classes);
+	free(work.reps);
+	free(work.kept);
+
+	return minimized;
+}
+
+
+void
+fsme_deleteMinimizedMachine(fsm_machine_t* stateMachine)
+{
+	//the tables are in the same block
+	free(stateMachine);
+}
+
+
+
+/* -------------- Local Function Definitions -------------------- */
+static int
+fsmeMinCompareIds(const void* a,
+				  const void* b)
+{
+	const fsme_min_id_t* idA = (const fsme_min_id_t*)a;
+	const fsme_min_id_t* idB = (const fsme_min_id_t*)b;
+
+	if (idA->id != idB->id) {
+		return (idA->id < idB->id) ? -1 : 1;
+	}
+	//the first of duplicate ids wins, as when compiled
+	return idA->index - idB->index;
+}
+
+
+static int
+fsmeMinFindIndex(const fsme_min_id_t* ids,
+				 int num,
+				 int id)
+{
+	int low = 0, high = num;
+	int mid = 0;
+
+	while (low < high) {
+		mid = low + (high - low) / 2;
+		if (ids[mid].id < id) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+	return (low < num && ids[low].id == id) ? ids[low].index : -1;
+}
+
+
+static int
+fsmeMinCompareRows(const void* a,
+				   const void* b)
+{
+	const fsme_min_row_t* rowA = (const fsme_min_row_t*)a;
+	const fsme_min_row_t* rowB = (const fsme_min_row_t*)b;
+	int i = 0;
+
+	for (i = 0; i < rowA->num && i < rowB->num; i++) {
+		if (rowA->keys[i] != rowB->keys[i]) {
+			return (rowA->keys[i] < rowB->keys[i]) ? -1 : 1;
+		}
+	}
+	return rowA->num - rowB->num;
+}
+
+
+static int
+fsmeMinRank(fsme_min_row_t* rows,
+			int num,
+			int* ranks)
+{
+	int rank = 0;
+	int i = 0;
+
+	//equal rows get the same rank
+	qsort(rows, num, sizeof(fsme_min_row_t), fsmeMinCompareRows);
+	for (i = 0; i < num; i++) {
+		if (0 < i && 0 != fsmeMinCompareRows(&rows[i - 1], &rows[i])) {
+			rank++;
+		}
+		ranks[rows[i].index] = rank;
+	}
+	return (0 < num) ? rank + 1 : 0;
+}
+
+
+static boolean
+fsmeMinResolve(fsme_min_work_t* work)
+{
+	const fsm_machine_t* stateMachine = work->stateMachine;
+	const fsm_trigger_t* tmpTrigger = NULL;
+	const int eventNum = stateMachine->eventNum;
+	size_t slot = 0;
+	int i = 0, t = 0;
+
+	//////////////////////////////
+	//Resolve ids to positions
+	//////////////////////////////
+	for (i = 0; i < stateMachine->stateNum; i++) {
+		work->stateIds[i].id = stateMachine->stateTable[i].id;
+		work->stateIds[i].index = i;
+	}
+	qsort(work->stateIds, stateMachine->stateNum,
+		sizeof(fsme_min_id_t), fsmeMinCompareIds);
+	for (i = 0; i < stateMachine->transitionNum; i++) {
+		work->transitionIds[i].id = stateMachine->transitionTable[i].id;
+		work->transitionIds[i].index = i;
+	}
+	qsort(work->transitionIds, stateMachine->transitionNum,
+		sizeof(fsme_min_id_t), fsmeMinCompareIds);
+
+	work->entryState = fsmeMinFindIndex(work->stateIds,
+		stateMachine->stateNum, stateMachine->entryStateId);
+	if (0 > work->entryState) return FALSE;
+
+	for (t = 0; t < stateMachine->transitionNum; t++) {
+		work->source[t] = fsmeMinFindIndex(work->stateIds,
+			stateMachine->stateNum,
+			stateMachine->transitionTable[t].sourceStateId);
+		work->target[t] = fsmeMinFindIndex(work->stateIds,
+			stateMachine->stateNum,
+			stateMachine->transitionTable[t].targetStateId);
+		if (0 > work->source[t] || 0 > work->target[t]) {
+			return FALSE;
+		}
+	}
+
+	//////////////////////////////
+	//Build the dispatch table the way the machine is
+	//compiled: the first trigger of a state and an
+	//event wins, the others are dead.
+	//////////////////////////////
+	for (slot = 0; slot < (size_t)stateMachine->stateNum * eventNum;
+		slot++) {
+		work->dispatch[slot] = -1;
+	}
+	for (i = 0; i < stateMachine->triggerNum; i++) {
+		tmpTrigger = &stateMachine->triggerTable[i];
+		t = fsmeMinFindIndex(work->transitionIds,
+			stateMachine->transitionNum, tmpTrigger->transitionId);
+		if (0 > t ||
+			0 > tmpTrigger->eventId ||
+			eventNum <= tmpTrigger->eventId) {
+			return FALSE;
+		}
+		slot = (size_t)work->source[t] * eventNum +
+			tmpTrigger->eventId;
+		if (0 > work->dispatch[slot]) {
+			work->dispatch[slot] = t;
+		}
+	}
+
+	return TRUE;
+}
+
+
+static boolean
+fsmeMinReach(fsme_min_work_t* work)
+{
+	const int eventNum = work->stateMachine->eventNum;
+	int* stack = NULL;
+	int top = 0;
+	int i = 0, e = 0, t = 0;
+
+	//Every reachable state starts in a class of its own.
+	for (i = 0; i < work->stateMachine->stateNum; i++) {
+		work->classes[i] = -1;
+	}
+
+	stack = (int*)malloc(sizeof(int) * work->stateMachine->stateNum);
+	if (NULL == stack) return FALSE;
+
+	work->classes[work->entryState] = work->entryState;
+	stack[top++] = work->entryState;
+	while (0 < top) {
+		i = stack[--top];
+		for (e = 0; e < eventNum; e++) {
+			t = work->dispatch[(size_t)i * eventNum + e];
+			if (0 <= t && 0 > work->classes[work->target[t]]) {
+				work->classes[work->target[t]] = work->target[t];
+				stack[top++] = work->target[t];
+			}
+		}
+	}
+
+	free(stack);
+	return TRUE;
+}
+
+
+static uintptr_t*
+fsmeMinActionRow(uintptr_t head,
+				 fsme_action_ptr_t first,
+				 fsme_action_ptr_t second,
+				 int* num)
+{
+	fsme_action_ptr_t action = NULL;
+	uintptr_t* keys = NULL;
+	int firstNum = 0, secondNum = 0;
+	int i = 0;
+
+	for (action = first; NULL != action; action = action->next) {
+		firstNum++;
+	}
+	for (action = second; NULL != action; action = action->next) {
+		secondNum++;
+	}
+
+	//the length of the first list keeps the two apart
+	*num = 2 + firstNum + secondNum;
+	keys = (uintptr_t*)malloc(sizeof(uintptr_t) * (*num));
+	if (NULL == keys) return NULL;
+
+	keys[i++] = head;
+	keys[i++] = (uintptr_t)firstNum;
+	for (action = first; NULL != action; action = action->next) {
+		keys[i++] = (uintptr_t)action->action;
+	}
+	for (action = second; NULL != action; action = action->next) {
+		keys[i++] = (uintptr_t)action->action;
+	}
+	return keys;
+}
+
+
+static boolean
+fsmeMinActionKeys(fsme_engine_ptr_t actions,
+				  const fsm_machine_t* stateMachine,
+				  int* stateKeys,
+				  int* transitionKeys)
+{
+	fsme_min_row_t* rows = NULL;
+	const int num = (stateMachine->stateNum >
+		stateMachine->transitionNum) ?
+		stateMachine->stateNum : stateMachine->transitionNum;
+	boolean built = TRUE;
+	int done = 0;
+	int i = 0;
+
+	rows = (fsme_min_row_t*)malloc(sizeof(fsme_min_row_t) * num);
+	if (NULL == rows) return FALSE;
+
+	//states with the same entry and exit actions
+	for (done = 0; done < stateMachine->stateNum; done++) {
+		rows[done].keys = fsmeMinActionRow(0,
+			actions->stateTable[done].entryAction,
+			actions->stateTable[done].exitAction,
+			&rows[done].num);
+		if (NULL == rows[done].keys) break;
+		rows[done].index = done;
+	}
+	built = (boolean)(stateMachine->stateNum == done);
+	if (built) {
+		fsmeMinRank(rows, stateMachine->stateNum, stateKeys);
+	}
+	for (i = 0; i < done; i++) {
+		free((void*)rows[i].keys);
+	}
+
+	//transitions with the same guard and actions
+	for (done = 0; built && done < stateMachine->transitionNum; done++) {
+		rows[done].keys = fsmeMinActionRow(
+			(uintptr_t)actions->transitionTable[done].guard,
+			actions->transitionTable[done].action,
+			NULL,
+			&rows[done].num);
+		if (NULL == rows[done].keys) break;
+		rows[done].index = done;
+	}
+	built = (boolean)(built && stateMachine->transitionNum == done);
+	if (built) {
+		fsmeMinRank(rows, stateMachine->transitionNum, transitionKeys);
+	}
+	for (i = 0; i < done; i++) {
+		free((void*)rows[i].keys);
+	}
+
+	free(rows);
+	return built;
+}
+
+
+static int
+fsmeMinMerge(fsme_min_work_t* work,
+			 const int* stateKeys,
+			 const int* transitionKeys)
+{
+	const fsm_machine_t* stateMachine = work->stateMachine;
+	const int* dispatch = work->dispatch;
+	const int* target = work->target;
+	int* classes = work->classes;
+	const fsm_state_t* tmpState = NULL;
+	const int eventNum = stateMachine->eventNum;
+	const int width = 1 + 2 * eventNum;
+	fsme_min_row_t* rows = NULL;
+	uintptr_t* keys = NULL;
+	uintptr_t* row = NULL;
+	int* ranks = NULL;
+	int classNum = 0, lastNum = -1;
+	int num = 0;
+	int i = 0, e = 0, t = 0;
+
+	rows = (fsme_min_row_t*)
+		malloc(sizeof(fsme_min_row_t) * stateMachine->stateNum);
+	keys = (uintptr_t*)malloc(sizeof(uintptr_t) *
+		width * stateMachine->stateNum);
+	ranks = (int*)malloc(sizeof(int) * stateMachine->stateNum);
+	if (NULL == rows || NULL == keys || NULL == ranks) {
+		free(rows);
+		free(keys);
+		free(ranks);
+		return -1;
+	}
+
+	//Start from the states that look alike on their
+	//own. A state with a sub machine or regions is
+	//only equivalent to itself.
+	for (i = 0; i < stateMachine->stateNum; i++) {
+		if (0 > classes[i]) continue;
+		tmpState = &stateMachine->stateTable[i];
+		row = &keys[(size_t)num * width];
+		row[0] = (uintptr_t)tmpState->isFinal;
+		row[1] = fsmeMinStateHasRegions(tmpState) ?
+			(uintptr_t)i + 1 : 0;
+		row[2] = (uintptr_t)stateKeys[i];
+		rows[num].keys = row;
+		rows[num].num = 3;
+		rows[num].index = i;
+		num++;
+	}
+	classNum = fsmeMinRank(rows, num, ranks);
+
+	//Split the classes until the states of each one take
+	//equivalent transitions to equivalent targets on
+	//every event. Classes are only ever split, so the
+	//partition is stable once their number stops growing.
+	while (classNum != lastNum) {
+		lastNum = classNum;
+		num = 0;
+		for (i = 0; i < stateMachine->stateNum; i++) {
+			if (0 > classes[i]) continue;
+			row = &keys[(size_t)num * width];
+			row[0] = (uintptr_t)ranks[i];
+			for (e = 0; e < eventNum; e++) {
+				t = dispatch[(size_t)i * eventNum + e];
+				row[1 + 2 * e] = (0 <= t) ?
+					(uintptr_t)ranks[target[t]] + 1 : 0;
+				row[2 + 2 * e] = (0 <= t) ?
+					(uintptr_t)transitionKeys[t] : 0;
+			}
+			rows[num].keys = row;
+			rows[num].num = width;
+			rows[num].index = i;
+			num++;
+		}
+		classNum = fsmeMinRank(rows, num, ranks);
+	}
+
+	for (i = 0; i < stateMachine->stateNum; i++) {
+		if (0 <= classes[i]) {
+			classes[i] = ranks[i];
+		}
+	}
+
+	free(rows);
+	free(keys);
+	free(ranks);
+	return classNum;
+}
+
+
+static fsm_machine_t*
+fsmeMinBuild(fsme_min_work_t* work)
+{
+	const fsm_machine_t* stateMachine = work->stateMachine;
+	const int eventNum = stateMachine->eventNum;
+	const int* classes = work->classes;
+	int* reps = work->reps;
+	fsm_machine_t* minimized = NULL;
+	fsm_state_t* states = NULL;
+	fsm_transition_t* transitions = NULL;
+	fsm_trigger_t* triggers = NULL;
+	fsm_event_t* events = NULL;
+	int stateNum = 0, transitionNum = 0, triggerNum = 0;
+	int i = 0, e = 0, t = 0;
+
+	//every class is represented by its first state
+	for (i = 0; i < stateMachine->stateNum; i++) {
+		reps[i] = -1;
+	}
+	for (i = 0; i < stateMachine->stateNum; i++) {
+		if (0 <= classes[i] && 0 > reps[classes[i]]) {
+			reps[classes[i]] = i;
+			stateNum++;
+		}
+	}
+
+	//only the transitions of the representatives are kept
+	for (i = 0; i < stateMachine->stateNum; i++) {
+		if (0 > classes[i] || i != reps[classes[i]]) continue;
+		for (e = 0; e < eventNum; e++) {
+			t = work->dispatch[(size_t)i * eventNum + e];
+			if (0 <= t) {
+				if (!work->kept[t]) transitionNum++;
+				work->kept[t] = TRUE;
+				triggerNum++;
+			}
+		}
+	}
+	if (0 == transitionNum) {
+		return NULL;
+	}
+
+	//////////////////////////////
+	//Allocate the machine and its tables in one block
+	//////////////////////////////
+	minimized = (fsm_machine_t*)calloc(1, sizeof(fsm_machine_t) +
+		sizeof(fsm_state_t) * stateNum +
+		sizeof(fsm_transition_t) * transitionNum +
+		sizeof(fsm_trigger_t) * triggerNum +
+		sizeof(fsm_event_t) * stateMachine->eventTableNum);
+	if (NULL == minimized) return NULL;
+	states = (fsm_state_t*)(minimized + 1);
+	transitions = (fsm_transition_t*)(states + stateNum);
+	triggers = (fsm_trigger_t*)(transitions + transitionNum);
+	events = (fsm_event_t*)(triggers + triggerNum);
+
+	//The tables have const members, so every entry is
+	//built aside and copied in.
+	stateNum = 0;
+	for (i = 0; i < stateMachine->stateNum; i++) {
+		if (0 <= classes[i] && i == reps[classes[i]]) {
+			memcpy(&states[stateNum++],
+				&stateMachine->stateTable[i], sizeof(fsm_state_t));
+		}
+	}
+
+	transitionNum = 0;
+	for (t = 0; t < stateMachine->transitionNum; t++) {
+		if (work->kept[t]) {
+			fsm_transition_t transition = {
+				stateMachine->transitionTable[t].id,
+				stateMachine->transitionTable[t].sourceStateId,
+				stateMachine->stateTable[
+					reps[classes[work->target[t]]]].id,
+				stateMachine->transitionTable[t].name
+			};
+			memcpy(&transitions[transitionNum++],
+				&transition, sizeof(fsm_transition_t));
+		}
+	}
+
+	//triggers are kept in order of their event id
+	triggerNum = 0;
+	for (e = 0; e < eventNum; e++) {
+		for (i = 0; i < stateMachine->stateNum; i++) {
+			if (0 > classes[i] || i != reps[classes[i]]) continue;
+			t = work->dispatch[(size_t)i * eventNum + e];
+			if (0 <= t) {
+				fsm_trigger_t trigger = {
+					stateMachine->stateTable[i].id,
+					e,
+					stateMachine->transitionTable[t].id
+				};
+				memcpy(&triggers[triggerNum++],
+					&trigger, sizeof(fsm_trigger_t));
+			}
+		}
+	}
+
+	if (0 < stateMachine->eventTableNum &&
+		NULL != stateMachine->eventTable) {
+		memcpy(events, stateMachine->eventTable,
+			sizeof(fsm_event_t) * stateMachine->eventTableNum);
+	}
+
+	{
+		fsm_machine_t machine = {
+			stateMachine->id,
+			states,
+			stateNum,
+			transitions,
+			transitionNum,
+			eventNum,
+			triggers,
+			triggerNum,
+			stateMachine->stateTable[
+				reps[classes[work->entryState]]].id,
+			(NULL != stateMachine->eventTable) ? events : NULL,
+			(NULL != stateMachine->eventTable) ?
+				stateMachine->eventTableNum : 0,
+			FALSE
+		};
+		memcpy(minimized, &machine, sizeof(fsm_machine_t));
+	}
+
+	return minimized;
+}
+
+
+static void
+fsmeMinMapIds(const fsme_min_work_t* work,
+			  int* stateIdMap,
+			  int* transitionIdMap)
+{
+	const fsm_machine_t* stateMachine = work->stateMachine;
+	const int eventNum = stateMachine->eventNum;
+	const int* classes = work->classes;
+	const int* reps = work->reps;
+	int i = 0, e = 0, t = 0;
+
+	for (i = 0; i < stateMachine->stateNum && NULL != stateIdMap; i++) {
+		stateIdMap[i] = (0 <= classes[i]) ?
+			stateMachine->stateTable[reps[classes[i]]].id :
+			FSME_MINIMIZE_REMOVED;
+	}
+
+	if (NULL == transitionIdMap) return;
+
+	//A live transition maps to the one the representative
+	//of its source takes on the same event.
+	for (t = 0; t < stateMachine->transitionNum; t++) {
+		transitionIdMap[t] = FSME_MINIMIZE_REMOVED;
+	}
+	for (i = 0; i < stateMachine->stateNum; i++) {
+		if (0 > classes[i]) continue;
+		for (e = 0; e < eventNum; e++) {
+			t = work->dispatch[(size_t)i * eventNum + e];
+			if (0 <= t && FSME_MINIMIZE_REMOVED == transitionIdMap[t]) {
+				transitionIdMap[t] = stateMachine->transitionTable[
+					work->dispatch[(size_t)reps[classes[i]] *
+					eventNum + e]].id;
+			}
+		}
+	}
+}
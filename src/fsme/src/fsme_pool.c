@@ -0,0 +1,125 @@
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "fsme.h"
+#include "fsme_pool.h"
+
+
+/* ------------------- Local Macros -------------------------------- */
+#define fsmePoolSize(capacity)	\
+	(sizeof(struct fsme_pool) + sizeof(fsme_engine_ptr_t) * (capacity))
+
+
+
+/* ------------------- local type definitions --------------------- */
+struct fsme_pool
+{
+	pthread_mutex_t			lock;
+	fsme_engine_ptr_t		prototype;
+
+	/* the allocator of the prototype, the pool is
+	 * allocated with */
+	const fsme_allocator_t*	allocator;
+
+	/* the engines held, used as a stack */
+	fsme_engine_ptr_t*		engines;
+	int						num;
+	int						capacity;
+};
+
+
+
+/* -------------- Global Function Definitions -------------------- */
+fsme_pool_ptr_t
+fsme_newPool(fsme_engine_ptr_t prototype,
+			 int capacity)
+{
+	fsme_pool_ptr_t pool = NULL;
+
+	if (NULL == prototype || NULL != fsme_getParent(prototype) ||
+		0 > capacity) {
+		return NULL;
+	}
+
+	//the stack of engines follows the pool
+	pool = (fsme_pool_ptr_t)fsmeAllocate(prototype->cold->allocator,
+		fsmePoolSize(capacity), FSME_ALLOC_ALIGN);
+	if (NULL == pool) return NULL;
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pool->prototype = prototype;
+	pool->allocator = prototype->cold->allocator;
+	pool->engines = (fsme_engine_ptr_t*)(pool + 1);
+	pool->capacity = capacity;
+	pool->num = 0;
+
+	//the pool starts with fewer engines if memory runs out
+	while (pool->num < capacity) {
+		pool->engines[pool->num] = fsme_cloneEngine(prototype, FALSE);
+		if (NULL == pool->engines[pool->num]) break;
+		pool->num++;
+	}
+
+	return pool;
+}
+
+
+void
+fsme_deletePool(fsme_pool_ptr_t pool)
+{
+	int i = 0;
+
+	if (NULL == pool) return;
+
+	for (i = 0; i < pool->num; i++) {
+		fsme_deleteEngine(pool->engines[i]);
+	}
+	pthread_mutex_destroy(&pool->lock);
+	fsmeDeallocate(pool->allocator, pool, fsmePoolSize(pool->capacity));
+}
+
+
+fsme_engine_ptr_t
+fsme_poolAcquire(fsme_pool_ptr_t pool)
+{
+	fsme_engine_ptr_t engine = NULL;
+
+	if (NULL == pool) return NULL;
+
+	pthread_mutex_lock(&pool->lock);
+	if (0 < pool->num) {
+		engine = pool->engines[--pool->num];
+	} else {
+		engine = fsme_cloneEngine(pool->prototype, FALSE);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return engine;
+}
+
+
+fsme_return_t
+fsme_poolRelease(fsme_pool_ptr_t pool,
+				 fsme_engine_ptr_t engine)
+{
+	fsme_return_t retVal = FSME_OK;
+
+	if (NULL == pool || NULL == engine) return FSME_FORBIDDEN;
+
+	//The reset fails while the engine processes an
+	//event, e.g. if it is given back from one of its
+	//actions. It must not be deleted then, and stays
+	//with the caller.
+	retVal = fsme_resetEngine(engine, TRUE);
+	if (FSME_OK != retVal) return retVal;
+
+	pthread_mutex_lock(&pool->lock);
+	if (pool->num < pool->capacity) {
+		pool->engines[pool->num++] = engine;
+	} else {
+		fsme_deleteEngine(engine);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return FSME_OK;
+}
@@ -0,0 +1,628 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fsme.h"
+#include "fsme_arena.h"
+#include "fsme_registry.h"
+
+
+/* ------------------- Local Macros -------------------------------- */
+/**
+ * Number of keys looked ahead by fsme_registryFindBulk()
+ */
+#define FSME_REGISTRY_PREFETCH_DISTANCE	8
+
+/**
+ * Smallest number of slots of a shard
+ */
+#define FSME_REGISTRY_MIN_SLOTS			8
+
+#if defined(__GNUC__)
+#define fsmeRegistryPrefetch(addr)	__builtin_prefetch(addr)
+#else
+#define fsmeRegistryPrefetch(addr)
+#endif
+
+//A shard grows when it is more than 70% full, which
+//keeps probe sequences short.
+#define fsmeShardIsFull(shard, count)	\
+	((count) * 10 > ((shard)->mask + 1) * 7)
+
+#define fsmeRegistryGetShard(registry, hash)	\
+	(&(registry)->shards[((hash) >> 32) & (registry)->shardMask])
+
+
+
+/* ------------------- local type definitions --------------------- */
+/* a slot of a shard, free if engine is NULL */
+typedef struct fsme_registry_entry
+{
+	fsme_key_t				key;
+	fsme_engine_ptr_t		engine;
+} fsme_registry_entry_t;
+
+/* a shard, kept on its own cache line */
+typedef struct fsme_registry_shard
+{
+	FSME_CACHE_ALIGNED
+	pthread_mutex_t			lock;
+	fsme_registry_entry_t*	entries;
+	size_t					mask;
+	size_t					count;
+} fsme_registry_shard_t;
+
+struct fsme_registry
+{
+	fsme_registry_shard_t*	shards;
+	size_t					shardMask;
+
+	/* the machine the engines are created from */
+	fsme_machine_ptr_t		machine;
+
+	/* serializes engine creation and deletion, which
+	 * update the reference count of the machine */
+	pthread_mutex_t			machineLock;
+
+	/* per-node arenas, indexed by node */
+	fsme_arena_ptr_t*		arenas;
+	int						arenaNum;
+
+	fsme_registryInitFunc_t	initFunc;
+	void*					userData;
+};
+
+
+
+/* ------------------- Local Function Prototypes ------------------- */
+static fsme_key_t
+fsmeRegistryHash(fsme_key_t key);
+static size_t
+fsmeRegistryRoundUp(size_t num);
+static boolean
+fsmeShardInit(fsme_registry_shard_t* shard,
+			  size_t slotNum);
+static fsme_registry_entry_t*
+fsmeShardFind(fsme_registry_shard_t* shard,
+			  fsme_key_t key,
+			  fsme_key_t hash);
+static boolean
+fsmeShardInsert(fsme_registry_shard_t* shard,
+				fsme_key_t key,
+				fsme_key_t hash,
+				fsme_engine_ptr_t engine);
+static void
+fsmeShardPlace(fsme_registry_shard_t* shard,
+			   fsme_key_t key,
+			   fsme_key_t hash,
+			   fsme_engine_ptr_t engine);
+static boolean
+fsmeShardGrow(fsme_registry_shard_t* shard);
+static void
+fsmeShardErase(fsme_registry_shard_t* shard,
+			   fsme_registry_entry_t* entry);
+static fsme_engine_ptr_t
+fsmeRegistryCreate(fsme_registry_ptr_t registry,
+				   fsme_registry_shard_t* shard,
+				   fsme_key_t key,
+				   fsme_key_t hash);
+static void
+fsmeRegistryDeleteEngine(fsme_registry_ptr_t registry,
+						 fsme_engine_ptr_t engine);
+
+
+
+/* -------------- Global Function Definitions -------------------- */
+fsme_registry_ptr_t
+fsme_newRegistry(fsme_machine_ptr_t machine,
+				 int shardNum,
+				 size_t capacity,
+				 fsme_registryInitFunc_t initFunc,
+				 void* userData)
+{
+	fsme_registry_ptr_t registry = NULL;
+	void* mem = NULL;
+	size_t num = 0;
+	size_t slotNum = 0;
+	size_t i = 0;
+
+	if (NULL == machine) {
+		return NULL;
+	}
+
+	num = fsmeRegistryRoundUp(0 < shardNum ?
+		(size_t)shardNum : FSME_REGISTRY_SHARD_NUM);
+
+	//size the shards so that the expected sessions
+	//fit below the load limit
+	slotNum = fsmeRegistryRoundUp(capacity / num * 10 / 7 + 1);
+	if (FSME_REGISTRY_MIN_SLOTS > slotNum) {
+		slotNum = FSME_REGISTRY_MIN_SLOTS;
+	}
+
+	registry = (fsme_registry_ptr_t)malloc(sizeof(struct fsme_registry));
+	if (NULL == registry) return NULL;
+
+	if (0 != posix_memalign(&mem, FSME_CACHE_LINE_SIZE,
+		sizeof(fsme_registry_shard_t) * num)) {
+		free(registry);
+		return NULL;
+	}
+
+	registry->shards = (fsme_registry_shard_t*)mem;
+	registry->shardMask = num - 1;
+	for (i = 0; i < num; i++) {
+		if (!fsmeShardInit(&registry->shards[i], slotNum)) {
+			while (0 < i--) {
+				free(registry->shards[i].entries);
+				pthread_mutex_destroy(&registry->shards[i].lock);
+			}
+			free(mem);
+			free(registry);
+			return NULL;
+		}
+	}
+
+	//the registry keeps its own reference
+	machine->refCount++;
+	registry->machine = machine;
+	pthread_mutex_init(&registry->machineLock, NULL);
+	registry->arenas = NULL;
+	registry->arenaNum = 0;
+	registry->initFunc = initFunc;
+	registry->userData = userData;
+
+	return registry;
+}
+
+
+void
+fsme_deleteRegistry(fsme_registry_ptr_t registry)
+{
+	fsme_registry_shard_t* shard = NULL;
+	size_t i = 0, j = 0;
+
+	if (NULL == registry) return;
+
+	for (i = 0; i <= registry->shardMask; i++) {
+		shard = &registry->shards[i];
+		for (j = 0; j <= shard->mask; j++) {
+			if (NULL != shard->entries[j].engine) {
+				fsme_deleteEngine(shard->entries[j].engine);
+			}
+		}
+		free(shard->entries);
+		pthread_mutex_destroy(&shard->lock);
+	}
+	free(registry->shards);
+
+	pthread_mutex_destroy(&registry->machineLock);
+	fsme_releaseMachine(registry->machine);
+	free(registry->arenas);
+	free(registry);
+}
+
+
+boolean
+fsme_registrySetArenas(fsme_registry_ptr_t registry,
+					   fsme_arena_ptr_t const* arenas,
+					   int arenaNum)
+{
+	if (NULL == registry) return FALSE;
+
+	free(registry->arenas);
+	registry->arenas = NULL;
+	registry->arenaNum = 0;
+
+	if (NULL == arenas || 0 >= arenaNum) return TRUE;
+
+	registry->arenas = (fsme_arena_ptr_t*)
+		malloc(sizeof(fsme_arena_ptr_t) * arenaNum);
+	if (NULL == registry->arenas) return FALSE;
+
+	memcpy(registry->arenas, arenas, 
+		sizeof(fsme_arena_ptr_t) * arenaNum);
+	registry->arenaNum = arenaNum;
+	return TRUE;
+}
+
+
+fsme_engine_ptr_t
+fsme_registryFind(fsme_registry_ptr_t registry,
+				  fsme_key_t key)
+{
+	const fsme_key_t hash = fsmeRegistryHash(key);
+	fsme_registry_shard_t* shard = NULL;
+	fsme_registry_entry_t* entry = NULL;
+	fsme_engine_ptr_t engine = NULL;
+
+	if (NULL == registry) return NULL;
+
+	shard = fsmeRegistryGetShard(registry, hash);
+	pthread_mutex_lock(&shard->lock);
+	entry = fsmeShardFind(shard, key, hash);
+	if (NULL != entry) {
+		engine = entry->engine;
+	}
+	pthread_mutex_unlock(&shard->lock);
+
+	return engine;
+}
+
+
+size_t
+fsme_registryFindBulk(fsme_registry_ptr_t registry,
+					  const fsme_key_t* keys,
+					  size_t num,
+					  fsme_engine_ptr_t* engines)
+{
+	const fsme_registry_shard_t* ahead = NULL;
+	fsme_key_t hash = 0;
+	size_t found = 0;
+	size_t i = 0;
+
+	if (NULL == registry || NULL == keys || NULL == engines) {
+		return 0;
+	}
+
+	for (i = 0; i < num; i++) {
+		//Prefetch the home slot of a key further on. The
+		//table is read without its lock, which is fine
+		//for a hint: the lookup itself is done locked.
+		if (i + FSME_REGISTRY_PREFETCH_DISTANCE < num) {
+			hash = fsmeRegistryHash(
+				keys[i + FSME_REGISTRY_PREFETCH_DISTANCE]);
+			ahead = fsmeRegistryGetShard(registry, hash);
+			fsmeRegistryPrefetch(&ahead->entries[hash & ahead->mask]);
+		}
+
+		engines[i] = fsme_registryFind(registry, keys[i]);
+		if (NULL != engines[i]) {
+			found++;
+		}
+	}
+
+	return found;
+}
+
+
+fsme_engine_ptr_t
+fsme_registryGet(fsme_registry_ptr_t registry,
+				 fsme_key_t key)
+{
+	const fsme_key_t hash = fsmeRegistryHash(key);
+	fsme_registry_shard_t* shard = NULL;
+	fsme_registry_entry_t* entry = NULL;
+	fsme_engine_ptr_t engine = NULL;
+
+	if (NULL == registry) return NULL;
+
+	shard = fsmeRegistryGetShard(registry, hash);
+	pthread_mutex_lock(&shard->lock);
+	entry = fsmeShardFind(shard, key, hash);
+	if (NULL != entry) {
+		engine = entry->engine;
+	} else {
+		engine = fsmeRegistryCreate(registry, shard, key, hash);
+	}
+	pthread_mutex_unlock(&shard->lock);
+
+	return engine;
+}
+
+
+fsme_return_t
+fsme_registryPostEvent(fsme_registry_ptr_t registry,
+					   fsme_key_t key,
+					   int event,
+					   const void* inContext,
+					   void* outContext)
+{
+	const fsme_key_t hash = fsmeRegistryHash(key);
+	fsme_registry_shard_t* shard = NULL;
+	fsme_registry_entry_t* entry = NULL;
+	fsme_engine_ptr_t engine = NULL;
+	fsme_return_t retVal = FSME_OK;
+
+	if (NULL == registry) {
+		return FSME_ERROR_FATAL;
+	}
+
+	shard = fsmeRegistryGetShard(registry, hash);
+	pthread_mutex_lock(&shard->lock);
+	entry = fsmeShardFind(shard, key, hash);
+	if (NULL != entry) {
+		engine = entry->engine;
+	} else {
+		engine = fsmeRegistryCreate(registry, shard, key, hash);
+	}
+	retVal = fsme_postEvent(engine, event, inContext, outContext);
+	pthread_mutex_unlock(&shard->lock);
+
+	return retVal;
+}
+
+
+boolean
+fsme_registryRemove(fsme_registry_ptr_t registry,
+					fsme_key_t key)
+{
+	const fsme_key_t hash = fsmeRegistryHash(key);
+	fsme_registry_shard_t* shard = NULL;
+	fsme_registry_entry_t* entry = NULL;
+	fsme_engine_ptr_t engine = NULL;
+
+	if (NULL == registry) return FALSE;
+
+	shard = fsmeRegistryGetShard(registry, hash);
+	pthread_mutex_lock(&shard->lock);
+	entry = fsmeShardFind(shard, key, hash);
+	if (NULL != entry) {
+		engine = entry->engine;
+		fsmeShardErase(shard, entry);
+	}
+	pthread_mutex_unlock(&shard->lock);
+
+	if (NULL == engine) {
+		return FALSE;
+	}
+	fsmeRegistryDeleteEngine(registry, engine);
+	return TRUE;
+}
+
+
+size_t
+fsme_registrySize(fsme_registry_ptr_t registry)
+{
+	size_t size = 0;
+	size_t i = 0;
+
+	if (NULL == registry) return 0;
+
+	for (i = 0; i <= registry->shardMask; i++) {
+		pthread_mutex_lock(&registry->shards[i].lock);
+		size += registry->shards[i].count;
+		pthread_mutex_unlock(&registry->shards[i].lock);
+	}
+	return size;
+}
+
+
+size_t
+fsme_registryPublish(fsme_registry_ptr_t registry,
+					 fsme_machine_ptr_t machine,
+					 fsme_stateMapFuncPtr_t mapFunc,
+					 void* context)
+{
+	fsme_registry_shard_t* shard = NULL;
+	fsme_engine_ptr_t retired = NULL;
+	size_t failed = 0;
+	size_t i = 0, j = 0;
+
+	if (NULL == registry || NULL == machine) return 0;
+
+	pthread_mutex_lock(&registry->machineLock);
+	machine->refCount++;
+	fsme_releaseMachine(registry->machine);
+	registry->machine = machine;
+	pthread_mutex_unlock(&registry->machineLock);
+
+	//The events of a session are processed with its
+	//shard locked, so nothing reads the old tables
+	//once the engine is migrated.
+	for (i = 0; i <= registry->shardMask; i++) {
+		shard = &registry->shards[i];
+		pthread_mutex_lock(&shard->lock);
+		for (j = 0; j <= shard->mask; j++) {
+			if (NULL == shard->entries[j].engine) continue;
+
+			pthread_mutex_lock(&registry->machineLock);
+			retired = fsme_migrateEngine(shard->entries[j].engine,
+				machine, mapFunc, context);
+			if (NULL != retired) {
+				fsme_deleteEngine(retired);
+			} else {
+				failed++;
+			}
+			pthread_mutex_unlock(&registry->machineLock);
+		}
+		pthread_mutex_unlock(&shard->lock);
+	}
+	return failed;
+}
+
+
+
+/* -------------- Local Function Definitions -------------------- */
+static fsme_key_t
+fsmeRegistryHash(fsme_key_t key)
+{
+	//mix all bits of the key, so that sequential keys
+	//spread over shards and slots
+	key ^= key >> 30;
+	key *= 0xbf58476d1ce4e5b9ULL;
+	key ^= key >> 27;
+	key *= 0x94d049bb133111ebULL;
+	key ^= key >> 31;
+	return key;
+}
+
+
+static size_t
+fsmeRegistryRoundUp(size_t num)
+{
+	size_t rtn = 1;
+
+	while (rtn < num) {
+		rtn <<= 1;
+	}
+	return rtn;
+}
+
+
+static boolean
+fsmeShardInit(fsme_registry_shard_t* shard,
+			  size_t slotNum)
+{
+	shard->entries = (fsme_registry_entry_t*)
+		calloc(slotNum, sizeof(fsme_registry_entry_t));
+	if (NULL == shard->entries) return FALSE;
+
+	pthread_mutex_init(&shard->lock, NULL);
+	shard->mask = slotNum - 1;
+	shard->count = 0;
+	return TRUE;
+}
+
+
+static fsme_registry_entry_t*
+fsmeShardFind(fsme_registry_shard_t* shard,
+			  fsme_key_t key,
+			  fsme_key_t hash)
+{
+	size_t i = hash & shard->mask;
+
+	//linear probing up to the first free slot
+	while (NULL != shard->entries[i].engine) {
+		if (key == shard->entries[i].key) {
+			return &shard->entries[i];
+		}
+		i = (i + 1) & shard->mask;
+	}
+	return NULL;
+}
+
+
+static boolean
+fsmeShardInsert(fsme_registry_shard_t* shard,
+				fsme_key_t key,
+				fsme_key_t hash,
+				fsme_engine_ptr_t engine)
+{
+	if (fsmeShardIsFull(shard, shard->count + 1) &&
+		!fsmeShardGrow(shard)) {
+		return FALSE;
+	}
+
+	fsmeShardPlace(shard, key, hash, engine);
+	return TRUE;
+}
+
+
+static void
+fsmeShardPlace(fsme_registry_shard_t* shard,
+			   fsme_key_t key,
+			   fsme_key_t hash,
+			   fsme_engine_ptr_t engine)
+{
+	size_t i = hash & shard->mask;
+
+	while (NULL != shard->entries[i].engine) {
+		i = (i + 1) & shard->mask;
+	}
+	shard->entries[i].key = key;
+	shard->entries[i].engine = engine;
+	shard->count++;
+}
+
+
+static boolean
+fsmeShardGrow(fsme_registry_shard_t* shard)
+{
+	fsme_registry_entry_t* const entries = shard->entries;
+	fsme_registry_entry_t* grown = NULL;
+	const size_t slotNum = shard->mask + 1;
+	size_t i = 0;
+
+	//the shard keeps its table if a larger one cannot
+	//be allocated
+	grown = (fsme_registry_entry_t*)
+		calloc(slotNum * 2, sizeof(fsme_registry_entry_t));
+	if (NULL == grown) return FALSE;
+
+	shard->entries = grown;
+	shard->mask = slotNum * 2 - 1;
+	shard->count = 0;
+
+	for (i = 0; i < slotNum; i++) {
+		if (NULL != entries[i].engine) {
+			fsmeShardPlace(shard, entries[i].key,
+				fsmeRegistryHash(entries[i].key),
+				entries[i].engine);
+		}
+	}
+	free(entries);
+	return TRUE;
+}
+
+
+static void
+fsmeShardErase(fsme_registry_shard_t* shard,
+			   fsme_registry_entry_t* entry)
+{
+	size_t i = (size_t)(entry - shard->entries);
+	size_t j = i;
+	size_t home = 0;
+
+	//Shift the following entries of the probe sequence
+	//back instead of leaving a tombstone, so that
+	//lookups never get slower after removals.
+	for (;;) {
+		j = (j + 1) & shard->mask;
+		if (NULL == shard->entries[j].engine) break;
+
+		//an entry can fill the hole unless its home
+		//slot lies cyclically in (i, j]
+		home = fsmeRegistryHash(shard->entries[j].key) &
+			shard->mask;
+		if ((i < j) ? (home <= i || home > j) :
+			(home <= i && home > j)) {
+			shard->entries[i] = shard->entries[j];
+			i = j;
+		}
+	}
+	shard->entries[i].engine = NULL;
+	shard->count--;
+}
+
+
+static fsme_engine_ptr_t
+fsmeRegistryCreate(fsme_registry_ptr_t registry,
+				   fsme_registry_shard_t* shard,
+				   fsme_key_t key,
+				   fsme_key_t hash)
+{
+	fsme_engine_ptr_t engine = NULL;
+	fsme_arena_ptr_t arena = NULL;
+
+	//allocate the engine on the node of this thread
+	if (0 < registry->arenaNum) {
+		arena = registry->arenas[
+			fsme_currentNode() % registry->arenaNum];
+	}
+
+	pthread_mutex_lock(&registry->machineLock);
+	engine = fsme_newEngineInArena(registry->machine, arena);
+	pthread_mutex_unlock(&registry->machineLock);
+	if (NULL == engine) return NULL;
+
+	if (!fsmeShardInsert(shard, key, hash, engine)) {
+		fsmeRegistryDeleteEngine(registry, engine);
+		return NULL;
+	}
+
+	if (NULL != registry->initFunc) {
+		registry->initFunc(key, engine, registry->userData);
+	}
+	return engine;
+}
+
+
+static void
+fsmeRegistryDeleteEngine(fsme_registry_ptr_t registry,
+						 fsme_engine_ptr_t engine)
+{
+	pthread_mutex_lock(&registry->machineLock);
+	fsme_deleteEngine(engine);
+	pthread_mutex_unlock(&registry->machineLock);
+}
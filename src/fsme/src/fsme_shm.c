@@ -0,0 +1,811 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "fsme.h"
+#include "fsme_pool.h"
+#include "fsme_shm.h"
+
+
+/* ------------------- Local Macros -------------------------------- */
+/**
+ * Tags the header of a segment, "FSMS"
+ */
+#define FSME_SHM_MAGIC			0x534D5346u
+
+/**
+ * Version of the layout of a segment
+ */
+#define FSME_SHM_LAYOUT			1
+
+/**
+ * Times a process spins on the lock of an engine
+ * before it yields, and checks whether the holder
+ * of the lock has exited.
+ */
+#define FSME_SHM_SPIN_MAX		1024
+
+/**
+ * Times a reader tries to get a consistent copy of
+ * an engine being written before it gives up.
+ */
+#define FSME_SHM_READ_MAX		(16 * FSME_SHM_SPIN_MAX)
+
+#define fsmeShmGetRecord(store, index)	\
+	((fsme_shm_record_t*)((unsigned char*)(store)->header + \
+	FSME_CACHE_LINE_SIZE + (size_t)(index) * (store)->header->recordSize))
+
+#define fsmeShmGetSlots(record)	\
+	((unsigned int*)((record) + 1))
+
+//A slot holds the active state of an engine in the
+//low half, its history state in the high half.
+#define fsmeShmSlot(state, history)	\
+	((unsigned int)(state) | ((unsigned int)(history) << 16))
+
+#define fsmeShmSlotGetState(slot)	\
+	((fsme_index_t)((slot) & 0xFFFFu))
+
+#define fsmeShmSlotGetHistory(slot)	\
+	((fsme_index_t)((slot) >> 16))
+
+#define fsmeShmIndexIsValid(machine, index)	\
+	(FSME_INDEX_NONE == (index) || (machine)->stateNum > (index))
+
+
+
+/* ------------------- local type definitions --------------------- */
+/* the header of a segment, on its own cache line */
+typedef struct fsme_shm_header
+{
+	unsigned int			magic;
+	unsigned int			layout;
+
+	/* the machine the segment was created for */
+	unsigned long long		fingerprint;
+
+	int						engineNum;
+	int						slotNum;
+	size_t					recordSize;
+	size_t					size;
+} fsme_shm_header_t;
+
+/* the record of an engine, followed by one slot per
+ * engine and sub engine, depth first */
+typedef struct fsme_shm_record
+{
+	/* pid of the process processing an event, 0 if none */
+	unsigned int			lock;
+
+	/* pid of the process that claimed the engine, 0 if none */
+	unsigned int			owner;
+
+	/* odd while the slots are written */
+	unsigned int			sequence;
+
+	unsigned int			reserved;
+} fsme_shm_record_t;
+
+typedef enum
+{
+	FSME_SHM_START = 0,
+	FSME_SHM_POST
+} fsme_shm_op_t;
+
+struct fsme_shm_store
+{
+	fsme_shm_header_t*		header;
+	const fsme_machine_t*	machine;
+
+	/* local engines events are processed with */
+	fsme_pool_ptr_t			pool;
+
+	/* the allocator of the prototype, the store is
+	 * allocated with */
+	const fsme_allocator_t*	allocator;
+
+	/* pid of this process, the value of its locks */
+	unsigned int			pid;
+};
+
+/* a record the calling thread processes an event of,
+ * on its stack; the actions of the event may process
+ * events of other records */
+typedef struct fsme_shm_held
+{
+	const fsme_shm_record_t*		record;
+	const struct fsme_shm_held*		next;
+} fsme_shm_held_t;
+
+
+
+/* ------------------- Local Function Prototypes ------------------- */
+static fsme_shm_store_ptr_t
+fsmeShmNewStore(fsme_shm_header_t* header,
+				fsme_engine_ptr_t prototype);
+static fsme_return_t
+fsmeShmDispatch(fsme_shm_store_ptr_t store,
+				int index,
+				fsme_shm_op_t op,
+				int event,
+				const void* inContext,
+				void* outContext);
+static int
+fsmeShmCountSlots(const fsme_machine_t* machine);
+static unsigned long long
+fsmeShmFingerprint(const fsme_machine_t* machine,
+				   unsigned long long hash);
+static unsigned long long
+fsmeShmHash(unsigned long long hash,
+			int value);
+static void
+fsmeShmLock(fsme_shm_store_ptr_t store,
+			fsme_shm_record_t* record);
+static boolean
+fsmeShmLockUnclaimed(fsme_shm_store_ptr_t store,
+					 fsme_shm_record_t* record);
+static boolean
+fsmeShmIsAlive(unsigned int pid);
+static boolean
+fsmeShmLoad(fsme_engine_ptr_t engine,
+			const unsigned int* slots,
+			int* cursor);
+static void
+fsmeShmStore(fsme_engine_ptr_t engine,
+			 unsigned int* slots,
+			 int* cursor);
+static int
+fsmeShmReadPath(const fsme_machine_t* machine,
+				const unsigned int* slots,
+				int* cursor,
+				int* stateIds,
+				int num,
+				int maxNum);
+
+static boolean
+fsmeShmIsHeld(const fsme_shm_record_t* record);
+
+/* the records the calling thread processes events of,
+ * which its actions must not wait for */
+static FSME_THREAD_LOCAL const fsme_shm_held_t* fsmeShmHeld = NULL;
+
+
+
+/* -------------- Global Function Definitions -------------------- */
+fsme_shm_store_ptr_t
+fsme_newShmStore(const char* name,
+				 fsme_engine_ptr_t prototype,
+				 int engineNum)
+{
+	fsme_shm_header_t* header = NULL;
+	fsme_shm_store_ptr_t store = NULL;
+	unsigned int* slots = NULL;
+	void* base = MAP_FAILED;
+	size_t recordSize = 0;
+	size_t size = 0;
+	int slotNum = 0;
+	int fd = -1;
+	int i = 0, j = 0;
+
+	if (NULL == name || NULL == prototype ||
+		NULL != fsme_getParent(prototype) || 0 >= engineNum) {
+		return NULL;
+	}
+
+	//each record on cache lines of its own
+	slotNum = fsmeShmCountSlots(prototype->machine);
+	recordSize = (sizeof(fsme_shm_record_t) +
+		sizeof(unsigned int) * slotNum + FSME_CACHE_LINE_SIZE - 1) /
+		FSME_CACHE_LINE_SIZE * FSME_CACHE_LINE_SIZE;
+	if ((size_t)engineNum >
+		((size_t)-1 - FSME_CACHE_LINE_SIZE) / recordSize) {
+		return NULL;
+	}
+	size = FSME_CACHE_LINE_SIZE + recordSize * engineNum;
+
+	fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (0 > fd) return NULL;
+	if (0 == ftruncate(fd, (off_t)size)) {
+		base = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			MAP_SHARED, fd, 0);
+	}
+	close(fd);
+	if (MAP_FAILED == base) {
+		shm_unlink(name);
+		return NULL;
+	}
+
+	//The pages are zero: no engine is locked or
+	//claimed. None is started either.
+	header = (fsme_shm_header_t*)base;
+	header->layout = FSME_SHM_LAYOUT;
+	header->fingerprint = fsmeShmFingerprint(prototype->machine,
+		0xcbf29ce484222325ULL);
+	header->engineNum = engineNum;
+	header->slotNum = slotNum;
+	header->recordSize = recordSize;
+	header->size = size;
+	for (i = 0; i < engineNum; i++) {
+		slots = fsmeShmGetSlots((fsme_shm_record_t*)
+			((unsigned char*)base + FSME_CACHE_LINE_SIZE +
+			(size_t)i * recordSize));
+		for (j = 0; j < slotNum; j++) {
+			slots[j] = fsmeShmSlot(FSME_INDEX_NONE, FSME_INDEX_NONE);
+		}
+	}
+
+	//tagged last, so that a process mapping the
+	//segment meanwhile does not use it
+	FSME_ATOMIC_STORE(&header->magic, FSME_SHM_MAGIC);
+
+	store = fsmeShmNewStore(header, prototype);
+	if (NULL == store) {
+		munmap(base, size);
+		shm_unlink(name);
+	}
+	return store;
+}
+
+
+fsme_shm_store_ptr_t
+fsme_openShmStore(const char* name,
+				  fsme_engine_ptr_t prototype)
+{
+	fsme_shm_header_t* header = NULL;
+	fsme_shm_store_ptr_t store = NULL;
+	struct stat st;
+	void* base = MAP_FAILED;
+	int fd = -1;
+
+	if (NULL == name || NULL == prototype ||
+		NULL != fsme_getParent(prototype)) {
+		return NULL;
+	}
+
+	fd = shm_open(name, O_RDWR, 0);
+	if (0 > fd) return NULL;
+	if (0 == fstat(fd, &st) &&
+		FSME_CACHE_LINE_SIZE <= (size_t)st.st_size) {
+		base = mmap(NULL, (size_t)st.st_size,
+			PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	}
+	close(fd);
+	if (MAP_FAILED == base) return NULL;
+
+	//the segment must have been made for the same
+	//machine, by a process of the same layout
+	header = (fsme_shm_header_t*)base;
+	if (FSME_SHM_MAGIC == FSME_ATOMIC_LOAD(&header->magic) &&
+		FSME_SHM_LAYOUT == header->layout &&
+		(size_t)st.st_size == header->size &&
+		fsmeShmCountSlots(prototype->machine) == header->slotNum &&
+		fsmeShmFingerprint(prototype->machine,
+		0xcbf29ce484222325ULL) == header->fingerprint) {
+		store = fsmeShmNewStore(header, prototype);
+	}
+	if (NULL == store) {
+		munmap(base, (size_t)st.st_size);
+	}
+	return store;
+}
+
+
+void
+fsme_closeShmStore(fsme_shm_store_ptr_t store)
+{
+	if (NULL == store) return;
+
+	fsme_deletePool(store->pool);
+	munmap(store->header, store->header->size);
+	fsmeDeallocate(store->allocator, store, 
+		sizeof(struct fsme_shm_store));
+}
+
+
+boolean
+fsme_unlinkShmStore(const char* name)
+{
+	if (NULL == name) return FALSE;
+
+	return (boolean)(0 == shm_unlink(name));
+}
+
+
+int
+fsme_shmGetEngineNum(fsme_shm_store_ptr_t store)
+{
+	if (NULL == store) return 0;
+
+	return store->header->engineNum;
+}
+
+
+fsme_return_t
+fsme_shmStartEngine(fsme_shm_store_ptr_t store,
+					int index,
+					const void* inContext,
+					void* outContext)
+{
+	return fsmeShmDispatch(store, index, FSME_SHM_START, 0,
+		inContext, outContext);
+}
+
+
+fsme_return_t
+fsme_shmPostEvent(fsme_shm_store_ptr_t store,
+				  int index,
+				  int event,
+				  const void* inContext,
+				  void* outContext)
+{
+	return fsmeShmDispatch(store, index, FSME_SHM_POST, event,
+		inContext, outContext);
+}
+
+
+fsme_return_t
+fsme_shmResetEngine(fsme_shm_store_ptr_t store,
+					int index)
+{
+	fsme_shm_record_t* record = NULL;
+	unsigned int* slots = NULL;
+	int i = 0;
+
+	if (NULL == store || 0 > index ||
+		store->header->engineNum <= index) {
+		return FSME_ERROR_FATAL;
+	}
+
+	record = fsmeShmGetRecord(store, index);
+	if (fsmeShmIsHeld(record)) {
+		return FSME_ENGINE_FROZEN;
+	}
+	if (!fsmeShmLockUnclaimed(store, record)) {
+		return FSME_FORBIDDEN;
+	}
+
+	slots = fsmeShmGetSlots(record);
+	FSME_ATOMIC_STORE(&record->sequence, record->sequence + 1);
+	for (i = 0; i < store->header->slotNum; i++) {
+		FSME_ATOMIC_STORE(&slots[i],
+			fsmeShmSlot(FSME_INDEX_NONE, FSME_INDEX_NONE));
+	}
+	FSME_ATOMIC_STORE(&record->sequence, record->sequence + 1);
+	FSME_ATOMIC_STORE(&record->lock, 0);
+	return FSME_OK;
+}
+
+
+int
+fsme_shmGetStatePath(fsme_shm_store_ptr_t store,
+					 int index,
+					 int* stateIds,
+					 int maxNum)
+{
+	fsme_shm_record_t* record = NULL;
+	unsigned int sequence = 0;
+	unsigned int holder = 0;
+	int cursor = 0;
+	int num = 0;
+	int tries = 0;
+
+	if (NULL == store || 0 > index ||
+		store->header->engineNum <= index ||
+		NULL == stateIds || 0 >= maxNum) {
+		return 0;
+	}
+
+	//the path is consistent if the sequence is even
+	//and unchanged after it is read
+	record = fsmeShmGetRecord(store, index);
+	for (tries = 1; tries <= FSME_SHM_READ_MAX; tries++) {
+		sequence = FSME_ATOMIC_LOAD(&record->sequence);
+		if (0 == (sequence & 1)) {
+			cursor = 0;
+			num = fsmeShmReadPath(store->machine,
+				fsmeShmGetSlots(record), &cursor,
+				stateIds, 0, maxNum);
+			if (FSME_ATOMIC_LOAD(&record->sequence) == sequence) {
+				return num;
+			}
+		} else if (0 == tries % FSME_SHM_SPIN_MAX) {
+			//A writer that exited leaves the sequence odd
+			//until its lock is taken over, which makes
+			//the sequence even again.
+			holder = FSME_ATOMIC_LOAD(&record->lock);
+			if (0 != holder && !fsmeShmIsAlive(holder)) {
+				fsmeShmLock(store, record);
+				FSME_ATOMIC_STORE(&record->lock, 0);
+			}
+		}
+		FSME_CPU_RELAX();
+	}
+	return 0;
+}
+
+
+boolean
+fsme_shmClaimEngine(fsme_shm_store_ptr_t store,
+					int index)
+{
+	fsme_shm_record_t* record = NULL;
+	unsigned int owner = 0;
+
+	if (NULL == store || 0 > index ||
+		store->header->engineNum <= index) {
+		return FALSE;
+	}
+
+	record = fsmeShmGetRecord(store, index);
+	for (;;) {
+		owner = FSME_ATOMIC_LOAD(&record->owner);
+		if (store->pid == owner) return TRUE;
+		if (0 != owner && fsmeShmIsAlive(owner)) return FALSE;
+		if (FSME_ATOMIC_CAS(&record->owner, owner, store->pid)) {
+			return TRUE;
+		}
+	}
+}
+
+
+void
+fsme_shmReleaseEngine(fsme_shm_store_ptr_t store,
+					  int index)
+{
+	fsme_shm_record_t* record = NULL;
+
+	if (NULL == store || 0 > index ||
+		store->header->engineNum <= index) {
+		return;
+	}
+
+	record = fsmeShmGetRecord(store, index);
+	FSME_ATOMIC_CAS(&record->owner, store->pid, 0);
+}
+
+
+
+/* -------------- Local Function Definitions -------------------- */
+static fsme_shm_store_ptr_t
+fsmeShmNewStore(fsme_shm_header_t* header,
+				fsme_engine_ptr_t prototype)
+{
+	fsme_shm_store_ptr_t store = NULL;
+
+	store = (fsme_shm_store_ptr_t)fsmeAllocate(prototype->cold->allocator,
+		sizeof(struct fsme_shm_store), FSME_ALLOC_ALIGN);
+	if (NULL == store) return NULL;
+
+	store->allocator = prototype->cold->allocator;
+	store->pool = fsme_newPool(prototype, FSME_SHM_POOL_SIZE);
+	if (NULL == store->pool) {
+		fsmeDeallocate(store->allocator, store,
+			sizeof(struct fsme_shm_store));
+		return NULL;
+	}
+	store->header = header;
+	store->machine = prototype->machine;
+	store->pid = (unsigned int)getpid();
+	return store;
+}
+
+
+static fsme_return_t
+fsmeShmDispatch(fsme_shm_store_ptr_t store,
+				int index,
+				fsme_shm_op_t op,
+				int event,
+				const void* inContext,
+				void* outContext)
+{
+	fsme_shm_record_t* record = NULL;
+	fsme_shm_held_t held;
+	fsme_engine_ptr_t engine = NULL;
+	int cursor = 0;
+	fsme_return_t retVal = FSME_OK;
+
+	if (NULL == store || 0 > index ||
+		store->header->engineNum <= index) {
+		return FSME_ERROR_FATAL;
+	}
+
+	//called by an action of the engine: the thread
+	//would wait for itself
+	record = fsmeShmGetRecord(store, index);
+	if (fsmeShmIsHeld(record)) {
+		return FSME_ENGINE_FROZEN;
+	}
+	engine = fsme_poolAcquire(store->pool);
+	if (NULL == engine) {
+		return FSME_ERROR_FATAL;
+	}
+
+	//Process the event on the local engine, in the
+	//states read from the record, and write them back.
+	if (!fsmeShmLockUnclaimed(store, record)) {
+		fsme_poolRelease(store->pool, engine);
+		return FSME_FORBIDDEN;
+	}
+	held.record = record;
+	held.next = fsmeShmHeld;
+	fsmeShmHeld = &held;
+	if (!fsmeShmLoad(engine, fsmeShmGetSlots(record), &cursor)) {
+		retVal = FSME_ERROR_FATAL;
+	} else {
+		if (FSME_SHM_START == op) {
+			retVal = fsme_startEngine(engine, inContext, outContext);
+		} else {
+			retVal = fsme_postEvent(engine, event,
+				inContext, outContext);
+		}
+
+		//A suspended transition could not be resumed 
+		//from the record, which is left as it was; the
+		//local engine drops it when it is reset.
+		if (FSME_ACTION_PENDING == retVal) {
+			retVal = FSME_FORBIDDEN;
+		} else {
+			cursor = 0;
+			FSME_ATOMIC_STORE(&record->sequence, 
+				record->sequence + 1);
+			fsmeShmStore(engine, fsmeShmGetSlots(record), &cursor);
+			FSME_ATOMIC_STORE(&record->sequence, 
+				record->sequence + 1);
+		}
+	}
+	fsmeShmHeld = held.next;
+	FSME_ATOMIC_STORE(&record->lock, 0);
+
+	fsme_poolRelease(store->pool, engine);
+	return retVal;
+}
+
+
+static int
+fsmeShmCountSlots(const fsme_machine_t* machine)
+{
+	const fsme_regions_t* regions = NULL;
+	int num = 1;
+	int i = 0, r = 0;
+
+	for (i = 0; i < machine->stateNum; i++) {
+		regions = fsmeMachineGetRegions(machine, i);
+		if (NULL == regions) continue;
+
+		for (r = 0; r < regions->regionNum; r++) {
+			num += fsmeShmCountSlots(regions->machines[r]);
+		}
+	}
+	return num;
+}
+
+
+static unsigned long long
+fsmeShmFingerprint(const fsme_machine_t* machine,
+				   unsigned long long hash)
+{
+	const fsme_regions_t* regions = NULL;
+	int i = 0, r = 0, e = 0;
+
+	//Everything the slots and the dispatch depend on:
+	//the states, the transitions, the dispatch table
+	//and the sub machines, in the order of the slots.
+	hash = fsmeShmHash(hash, machine->stateNum);
+	hash = fsmeShmHash(hash, machine->transitionNum);
+	hash = fsmeShmHash(hash, machine->eventNum);
+	for (i = 0; i < machine->transitionNum; i++) {
+		hash = fsmeShmHash(hash,
+			fsmeMachineGetTransitionId(machine, i));
+		hash = fsmeShmHash(hash,
+			fsmeMachineGetSourceState(machine, i));
+		hash = fsmeShmHash(hash,
+			fsmeMachineGetTargetState(machine, i));
+	}
+	if (NULL != machine->eventKeys) {
+		for (e = 0; e < machine->eventNum; e++) {
+			hash = fsmeShmHash(hash, machine->eventKeys[e]);
+		}
+	}
+	for (i = 0; i < machine->stateNum; i++) {
+		hash = fsmeShmHash(hash, fsmeMachineGetStateId(machine, i));
+		hash = fsmeShmHash(hash,
+			fsmeMachineGetStateHistory(machine, i));
+		for (e = 0; e < machine->eventNum; e++) {
+			hash = fsmeShmHash(hash,
+				fsmeMachineFindTransition(machine, i, e));
+		}
+
+		regions = fsmeMachineGetRegions(machine, i);
+		hash = fsmeShmHash(hash,
+			fsmeMachineGetRegionNum(machine, i));
+		for (r = 0; NULL != regions && r < regions->regionNum; r++) {
+			hash = fsmeShmFingerprint(regions->machines[r], hash);
+		}
+	}
+	return hash;
+}
+
+
+static unsigned long long
+fsmeShmHash(unsigned long long hash,
+			int value)
+{
+	unsigned int bits = (unsigned int)value;
+	int i = 0;
+
+	//FNV-1a over the bytes of the value
+	for (i = 0; i < 4; i++) {
+		hash ^= (bits >> (8 * i)) & 0xFF;
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+
+static void
+fsmeShmLock(fsme_shm_store_ptr_t store,
+			fsme_shm_record_t* record)
+{
+	unsigned int holder = 0;
+	unsigned int sequence = 0;
+	int spins = 0;
+
+	for (spins = 1; ; spins++) {
+		holder = FSME_ATOMIC_LOAD(&record->lock);
+		if (0 == holder) {
+			if (FSME_ATOMIC_CAS(&record->lock, 0, store->pid)) {
+				return;
+			}
+		} else if (0 != spins % FSME_SHM_SPIN_MAX) {
+			FSME_CPU_RELAX();
+		} else if (fsmeShmIsAlive(holder)) {
+			sched_yield();
+		} else if (FSME_ATOMIC_CAS(&record->lock, holder,
+			store->pid)) {
+			//The holder exited. If it was writing the
+			//slots, they may be mixed; the sequence is
+			//made even again for the readers.
+			sequence = FSME_ATOMIC_LOAD(&record->sequence);
+			if (0 != (sequence & 1)) {
+				FSME_ATOMIC_STORE(&record->sequence, sequence + 1);
+			}
+			return;
+		}
+	}
+}
+
+
+static boolean
+fsmeShmLockUnclaimed(fsme_shm_store_ptr_t store,
+					 fsme_shm_record_t* record)
+{
+	unsigned int owner = FSME_ATOMIC_LOAD(&record->owner);
+
+	if (0 != owner && store->pid != owner) return FALSE;
+
+	//claimed by another process while this one waited
+	//for the lock
+	fsmeShmLock(store, record);
+	owner = FSME_ATOMIC_LOAD(&record->owner);
+	if (0 != owner && store->pid != owner) {
+		FSME_ATOMIC_STORE(&record->lock, 0);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+
+static boolean
+fsmeShmIsHeld(const fsme_shm_record_t* record)
+{
+	const fsme_shm_held_t* held = NULL;
+
+	for (held = fsmeShmHeld; NULL != held; held = held->next) {
+		if (held->record == record) return TRUE;
+	}
+	return FALSE;
+}
+
+
+static boolean
+fsmeShmIsAlive(unsigned int pid)
+{
+	return (boolean)(0 == kill((pid_t)pid, 0) || EPERM == errno);
+}
+
+
+static boolean
+fsmeShmLoad(fsme_engine_ptr_t engine,
+			const unsigned int* slots,
+			int* cursor)
+{
+	const fsme_machine_t* machine = engine->machine;
+	const unsigned int slot = FSME_ATOMIC_LOAD(&slots[(*cursor)++]);
+	const fsme_index_t state = fsmeShmSlotGetState(slot);
+	const fsme_index_t history = fsmeShmSlotGetHistory(slot);
+	int i = 0, r = 0;
+
+	//another process may have written anything
+	if (!fsmeShmIndexIsValid(machine, state) ||
+		!fsmeShmIndexIsValid(machine, history)) {
+		return FALSE;
+	}
+
+	//the local engine is not shared
+	FSME_ATOMIC_STORE(&engine->activeState,
+		(FSME_ATOMIC_LOAD(&engine->activeState) &
+		~FSME_STATE_MASK) | state);
+	engine->cold->historyState = history;
+
+	for (i = 0; i < machine->stateNum; i++) {
+		for (r = 0; r < fsmeMachineGetRegionNum(machine, i); r++) {
+			if (!fsmeShmLoad(&engine->stateTable[i].subEngine[r],
+				slots, cursor)) {
+				return FALSE;
+			}
+		}
+	}
+	return TRUE;
+}
+
+
+static void
+fsmeShmStore(fsme_engine_ptr_t engine,
+			 unsigned int* slots,
+			 int* cursor)
+{
+	const fsme_machine_t* machine = engine->machine;
+	int i = 0, r = 0;
+
+	FSME_ATOMIC_STORE(&slots[(*cursor)++], fsmeShmSlot(
+		FSME_ATOMIC_LOAD(&engine->activeState) & FSME_STATE_MASK,
+		engine->cold->historyState));
+
+	for (i = 0; i < machine->stateNum; i++) {
+		for (r = 0; r < fsmeMachineGetRegionNum(machine, i); r++) {
+			fsmeShmStore(&engine->stateTable[i].subEngine[r],
+				slots, cursor);
+		}
+	}
+}
+
+
+static int
+fsmeShmReadPath(const fsme_machine_t* machine,
+				const unsigned int* slots,
+				int* cursor,
+				int* stateIds,
+				int num,
+				int maxNum)
+{
+	const fsme_regions_t* regions = NULL;
+	const fsme_index_t state =
+		fsmeShmSlotGetState(FSME_ATOMIC_LOAD(&slots[(*cursor)++]));
+	int i = 0, r = 0;
+
+	if (FSME_INDEX_NONE != state && machine->stateNum > state &&
+		num < maxNum) {
+		stateIds[num++] = fsmeMachineGetStateId(machine, state);
+	}
+
+	//the sub engines of the other states are skipped
+	for (i = 0; i < machine->stateNum; i++) {
+		regions = fsmeMachineGetRegions(machine, i);
+		if (NULL == regions) continue;
+
+		for (r = 0; r < regions->regionNum; r++) {
+			if (i == state) {
+				num = fsmeShmReadPath(regions->machines[r], slots,
+					cursor, stateIds, num, maxNum);
+			} else {
+				*cursor += fsmeShmCountSlots(regions->machines[r]);
+			}
+		}
+	}
+	return num;
+}
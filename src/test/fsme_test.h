@@ -0,0 +1,35 @@
+/* ---------------------------------------------------------
+ * Test helpers
+ *
+ * A test program checks its conditions with FSME_CHECK()
+ * and returns fsme_testResult() from main(), so that
+ * ctest sees the failures.
+ * ---------------------------------------------------------*/
+#ifndef FSME_TEST_H
+#define FSME_TEST_H
+
+
+#include <stdio.h>
+
+
+
+/* --------------- MACROS --------------- */
+#define FSME_CHECK(condition)											\
+	do																	\
+	{																	\
+		if (!(condition))												\
+		{																\
+			printf("%s:%d: check failed: %s\n",						\
+				   __FILE__, __LINE__, #condition);						\
+			fsmeTestFailures++;											\
+		}																\
+	} while (0)
+
+#define fsme_testResult()	(0 == fsmeTestFailures ? 0 : 1)
+
+
+
+/* ------------------- local variables ---------------------------- */
+static int fsmeTestFailures = 0;
+
+#endif
@@ -0,0 +1,340 @@
+#include <stdio.h>
+
+#include "fsm.h"
+#include "fsme_test.h"
+
+
+/*--------- MEDIA region --------------*/
+typedef enum
+{
+	MEDIA_S_OFF,
+	MEDIA_S_ON
+} media_state_t;
+
+typedef enum
+{
+	MEDIA_T_OFF_TO_ON,
+	MEDIA_T_ON_TO_OFF
+} media_transition_t;
+
+static const fsm_state_t MEDIA_STATES[] =
+{
+	{ MEDIA_S_OFF,	FALSE,	NULL },
+	{ MEDIA_S_ON,	FALSE,	NULL }
+};
+
+static const fsm_transition_t MEDIA_TRANSITIONS[] =
+{
+	{ MEDIA_T_OFF_TO_ON,	MEDIA_S_OFF,	MEDIA_S_ON },
+	{ MEDIA_T_ON_TO_OFF,	MEDIA_S_ON,		MEDIA_S_OFF }
+};
+
+/*--------- SIGNAL region --------------*/
+typedef enum
+{
+	SIGNAL_S_IDLE,
+	SIGNAL_S_RINGING
+} signal_state_t;
+
+typedef enum
+{
+	SIGNAL_T_IDLE_TO_RINGING,
+	SIGNAL_T_RINGING_TO_IDLE
+} signal_transition_t;
+
+static const fsm_state_t SIGNAL_STATES[] =
+{
+	{ SIGNAL_S_IDLE,	FALSE,	NULL },
+	{ SIGNAL_S_RINGING,	FALSE,	NULL }
+};
+
+static const fsm_transition_t SIGNAL_TRANSITIONS[] =
+{
+	{ SIGNAL_T_IDLE_TO_RINGING,	SIGNAL_S_IDLE,		SIGNAL_S_RINGING },
+	{ SIGNAL_T_RINGING_TO_IDLE,	SIGNAL_S_RINGING,	SIGNAL_S_IDLE }
+};
+
+/*--------- events of the regions --------------*/
+typedef enum
+{
+	CALL_E_TOGGLE = 0,
+	CALL_E_ANSWER
+} call_event_t;
+#define CALL_EVENT_NUM 2
+
+static const fsm_trigger_t MEDIA_TRIGGERS[] =
+{
+	{ MEDIA_S_OFF,	CALL_E_TOGGLE,	MEDIA_T_OFF_TO_ON },
+	{ MEDIA_S_ON,	CALL_E_TOGGLE,	MEDIA_T_ON_TO_OFF }
+};
+
+static const fsm_trigger_t SIGNAL_TRIGGERS[] =
+{
+	{ SIGNAL_S_IDLE,	CALL_E_TOGGLE,	SIGNAL_T_IDLE_TO_RINGING },
+	{ SIGNAL_S_RINGING,	CALL_E_ANSWER,	SIGNAL_T_RINGING_TO_IDLE }
+};
+
+static const fsm_machine_t MEDIA_MACHINE[] =
+{
+	{
+		/* id */				2,
+		/* stateTable */		MEDIA_STATES,
+		/* stateNum */			sizeof(MEDIA_STATES)/sizeof(MEDIA_STATES[0]),
+		/* transitionTable */	MEDIA_TRANSITIONS,
+		/* transitionNum */		sizeof(MEDIA_TRANSITIONS)/sizeof(MEDIA_TRANSITIONS[0]),
+		/* eventNum */			CALL_EVENT_NUM,
+		/* triggerTable */		MEDIA_TRIGGERS,
+		/* triggerNum */		sizeof(MEDIA_TRIGGERS)/sizeof(MEDIA_TRIGGERS[0]),
+		/* entryState */		MEDIA_S_OFF
+	}
+};
+
+static const fsm_machine_t SIGNAL_MACHINE[] =
+{
+	{
+		/* id */				3,
+		/* stateTable */		SIGNAL_STATES,
+		/* stateNum */			sizeof(SIGNAL_STATES)/sizeof(SIGNAL_STATES[0]),
+		/* transitionTable */	SIGNAL_TRANSITIONS,
+		/* transitionNum */		sizeof(SIGNAL_TRANSITIONS)/sizeof(SIGNAL_TRANSITIONS[0]),
+		/* eventNum */			CALL_EVENT_NUM,
+		/* triggerTable */		SIGNAL_TRIGGERS,
+		/* triggerNum */		sizeof(SIGNAL_TRIGGERS)/sizeof(SIGNAL_TRIGGERS[0]),
+		/* entryState */		SIGNAL_S_IDLE
+	}
+};
+
+/*--------- CALL machine --------------*/
+typedef enum
+{
+	CALL_S_SETUP,
+	CALL_S_ACTIVE
+} call_state_t;
+
+typedef enum
+{
+	CALL_T_SETUP_TO_ACTIVE
+} call_transition_t;
+
+typedef enum
+{
+	CALL_REGION_MEDIA,
+	CALL_REGION_SIGNAL
+} call_region_t;
+
+static const fsm_machine_t* const CALL_REGIONS[] =
+{
+	MEDIA_MACHINE,
+	SIGNAL_MACHINE
+};
+
+static const fsm_state_t CALL_STATES[] =
+{
+	{ CALL_S_SETUP,		FALSE,	NULL },
+	{ CALL_S_ACTIVE,	FALSE,	NULL,	FSM_HISTORY_NONE,	CALL_REGIONS,	2 }
+};
+
+static const fsm_transition_t CALL_TRANSITIONS[] =
+{
+	{ CALL_T_SETUP_TO_ACTIVE,	CALL_S_SETUP,	CALL_S_ACTIVE }
+};
+
+static const fsm_trigger_t CALL_TRIGGERS[] =
+{
+	{ CALL_S_SETUP,	CALL_E_TOGGLE,	CALL_T_SETUP_TO_ACTIVE }
+};
+
+static const fsm_machine_t CALL_MACHINE[] =
+{
+	{
+		/* id */				1,
+		/* stateTable */		CALL_STATES,
+		/* stateNum */			sizeof(CALL_STATES)/sizeof(CALL_STATES[0]),
+		/* transitionTable */	CALL_TRANSITIONS,
+		/* transitionNum */		sizeof(CALL_TRANSITIONS)/sizeof(CALL_TRANSITIONS[0]),
+		/* eventNum */			1,
+		/* triggerTable */		CALL_TRIGGERS,
+		/* triggerNum */		sizeof(CALL_TRIGGERS)/sizeof(CALL_TRIGGERS[0]),
+		/* entryState */		CALL_S_SETUP
+	}
+};
+
+
+
+/* ------------------- local macros ------------------------------- */
+#define TRACE_MAX		16
+
+/* trace codes: step * 10 + region */
+#define TRACE_EXIT		10
+#define TRACE_ACTION	20
+#define TRACE_ENTRY		30
+
+
+
+/* ------------------- local variables ---------------------------- */
+static fsme_engine_ptr_t mediaEngine = NULL;
+static fsme_engine_ptr_t signalEngine = NULL;
+
+static int trace[TRACE_MAX];
+static int traceNum = 0;
+
+static int suspendCount = 0;
+static fsme_engine_ptr_t suspended = NULL;
+static fsme_return_t postedInGuard = FSME_OK;
+
+
+
+/* ------------------- actions ------------------------------------ */
+static void traceStep(int code)
+{
+	if (traceNum < TRACE_MAX)
+	{
+		trace[traceNum++] = code;
+	}
+}
+
+
+static void onMediaExit(int id, const void* inContext, void* outContext)
+{
+	(void)id;
+	(void)inContext;
+	(void)outContext;
+	traceStep(TRACE_EXIT + CALL_REGION_MEDIA);
+}
+
+
+static void onMediaToggle(int id, const void* inContext, void* outContext)
+{
+	fsme_pending_t pending;
+
+	(void)id;
+	(void)inContext;
+	(void)outContext;
+	traceStep(TRACE_ACTION + CALL_REGION_MEDIA);
+
+	pending = fsme_suspendTransition(mediaEngine);
+	suspendCount++;
+	suspended = pending.engine;
+}
+
+
+static void onMediaEntry(int id, const void* inContext, void* outContext)
+{
+	(void)id;
+	(void)inContext;
+	(void)outContext;
+	traceStep(TRACE_ENTRY + CALL_REGION_MEDIA);
+}
+
+
+static void onSignalExit(int id, const void* inContext, void* outContext)
+{
+	(void)id;
+	(void)inContext;
+	(void)outContext;
+	traceStep(TRACE_EXIT + CALL_REGION_SIGNAL);
+}
+
+
+static void onSignalToggle(int id, const void* inContext, void* outContext)
+{
+	(void)id;
+	(void)inContext;
+	(void)outContext;
+	traceStep(TRACE_ACTION + CALL_REGION_SIGNAL);
+}
+
+
+static void onSignalEntry(int id, const void* inContext, void* outContext)
+{
+	(void)id;
+	(void)inContext;
+	(void)outContext;
+	traceStep(TRACE_ENTRY + CALL_REGION_SIGNAL);
+}
+
+
+static boolean signalGuard(int id, const void* inContext, void* outContext)
+{
+	(void)id;
+	(void)inContext;
+	(void)outContext;
+
+	postedInGuard = fsme_postEvent(mediaEngine, CALL_E_TOGGLE, NULL, NULL);
+	return TRUE;
+}
+
+
+
+/* ------------------- tests -------------------------------------- */
+static void testBroadcastSuspend(void)
+{
+	static const int expected[] =
+	{
+		TRACE_EXIT + CALL_REGION_MEDIA,
+		TRACE_EXIT + CALL_REGION_SIGNAL,
+		TRACE_ACTION + CALL_REGION_MEDIA,
+		TRACE_ACTION + CALL_REGION_SIGNAL,
+		TRACE_ENTRY + CALL_REGION_MEDIA,
+		TRACE_ENTRY + CALL_REGION_SIGNAL
+	};
+	fsme_engine_ptr_t call = fsme_newEngine(CALL_MACHINE);
+	int i;
+
+	FSME_CHECK(NULL != call);
+	FSME_CHECK(FSME_OK == fsme_startEngine(call, NULL, NULL));
+	FSME_CHECK(FSME_OK == fsme_postEvent(call, CALL_E_TOGGLE, NULL, NULL));
+
+	mediaEngine = fsme_getRegionEngine(call, CALL_S_ACTIVE, CALL_REGION_MEDIA);
+	signalEngine = fsme_getRegionEngine(call, CALL_S_ACTIVE, CALL_REGION_SIGNAL);
+	FSME_CHECK(NULL != mediaEngine && NULL != signalEngine);
+
+	fsme_addStateExitAction(mediaEngine, MEDIA_S_OFF, onMediaExit);
+	fsme_addTransitionAction(mediaEngine, MEDIA_T_OFF_TO_ON, onMediaToggle);
+	fsme_addTransitionAction(mediaEngine, MEDIA_T_ON_TO_OFF, onMediaToggle);
+	fsme_addStateEntryAction(mediaEngine, MEDIA_S_ON, onMediaEntry);
+	fsme_addStateExitAction(signalEngine, SIGNAL_S_IDLE, onSignalExit);
+	fsme_addTransitionAction(signalEngine, SIGNAL_T_IDLE_TO_RINGING, onSignalToggle);
+	fsme_addStateEntryAction(signalEngine, SIGNAL_S_RINGING, onSignalEntry);
+	fsme_setGuard(signalEngine, SIGNAL_T_IDLE_TO_RINGING, signalGuard);
+
+	/* the suspension is refused and both regions complete their transitions */
+	FSME_CHECK(FSME_OK == fsme_broadcastEvent(call, CALL_E_TOGGLE, NULL, NULL));
+	FSME_CHECK(1 == suspendCount);
+	FSME_CHECK(NULL == suspended);
+	FSME_CHECK(FSME_ENGINE_FROZEN == postedInGuard);
+	FSME_CHECK(MEDIA_S_ON == fsme_getCurrentStateId(mediaEngine));
+	FSME_CHECK(SIGNAL_S_RINGING == fsme_getCurrentStateId(signalEngine));
+
+	/* all exits, then all transition actions, then all entries */
+	FSME_CHECK(sizeof(expected)/sizeof(expected[0]) == (size_t)traceNum);
+	for (i = 0; i < traceNum; i++)
+	{
+		FSME_CHECK(expected[i] == trace[i]);
+	}
+
+	/* the regions are unfrozen afterwards */
+	FSME_CHECK(FSME_OK == fsme_postEvent(signalEngine, CALL_E_ANSWER, NULL, NULL));
+	FSME_CHECK(SIGNAL_S_IDLE == fsme_getCurrentStateId(signalEngine));
+
+	/* and the next broadcast is processed alike */
+	postedInGuard = FSME_OK;
+	FSME_CHECK(FSME_OK == fsme_broadcastEvent(call, CALL_E_TOGGLE, NULL, NULL));
+	FSME_CHECK(2 == suspendCount);
+	FSME_CHECK(NULL == suspended);
+	FSME_CHECK(FSME_ENGINE_FROZEN == postedInGuard);
+	FSME_CHECK(MEDIA_S_OFF == fsme_getCurrentStateId(mediaEngine));
+	FSME_CHECK(SIGNAL_S_RINGING == fsme_getCurrentStateId(signalEngine));
+
+	fsme_deleteEngine(call);
+	mediaEngine = NULL;
+	signalEngine = NULL;
+}
+
+
+int main()
+{
+	testBroadcastSuspend();
+
+	return fsme_testResult();
+}
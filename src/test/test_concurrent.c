@@ -0,0 +1,165 @@
+#include <pthread.h>
+#include <stdio.h>
+
+#include "fsm.h"
+#include "fsme_test.h"
+
+
+/*--------- machine --------------*/
+typedef enum
+{
+	LINK_S_DOWN,
+	LINK_S_UP
+} link_state_t;
+
+typedef enum
+{
+	LINK_T_DOWN_TO_UP,
+	LINK_T_UP_TO_DOWN
+} link_transition_t;
+
+typedef enum
+{
+	LINK_E_UP = 0,
+	LINK_E_DOWN
+} link_event_t;
+#define LINK_EVENT_NUM 2
+
+static const fsm_state_t LINK_STATES[] =
+{
+	{ LINK_S_DOWN,	FALSE,	NULL },
+	{ LINK_S_UP,	FALSE,	NULL }
+};
+
+static const fsm_transition_t LINK_TRANSITIONS[] =
+{
+	{ LINK_T_DOWN_TO_UP,	LINK_S_DOWN,	LINK_S_UP },
+	{ LINK_T_UP_TO_DOWN,	LINK_S_UP,		LINK_S_DOWN }
+};
+
+static const fsm_trigger_t LINK_TRIGGERS[] =
+{
+	{ LINK_S_DOWN,	LINK_E_UP,		LINK_T_DOWN_TO_UP },
+	{ LINK_S_UP,	LINK_E_DOWN,	LINK_T_UP_TO_DOWN }
+};
+
+static const fsm_machine_t LINK_MACHINE[] =
+{
+	{
+		/* id */				1,
+		/* stateTable */		LINK_STATES,
+		/* stateNum */			sizeof(LINK_STATES)/sizeof(LINK_STATES[0]),
+		/* transitionTable */	LINK_TRANSITIONS,
+		/* transitionNum */		sizeof(LINK_TRANSITIONS)/sizeof(LINK_TRANSITIONS[0]),
+		/* eventNum */			LINK_EVENT_NUM,
+		/* triggerTable */		LINK_TRIGGERS,
+		/* triggerNum */		sizeof(LINK_TRIGGERS)/sizeof(LINK_TRIGGERS[0]),
+		/* entryState */		LINK_S_DOWN
+	}
+};
+
+#define THREAD_NUM		4
+#define POST_NUM		10000
+
+
+
+/* ------------------- local variables ---------------------------- */
+static fsme_engine_ptr_t link = NULL;
+static fsme_return_t postedInAction = FSME_OK;
+static int actionCount = 0;
+
+
+
+/* ------------------- actions ------------------------------------ */
+static void onUp(int id, const void* inContext, void* outContext)
+{
+	(void)id;
+	(void)inContext;
+	(void)outContext;
+
+	actionCount++;
+	postedInAction = fsme_postEventConcurrent(link, LINK_E_DOWN, NULL, NULL);
+}
+
+
+static void* postEvents(void* arg)
+{
+	int i;
+
+	(void)arg;
+	for (i = 0; i < POST_NUM; i++)
+	{
+		fsme_postEventConcurrent(link, (i & 1) ? LINK_E_DOWN : LINK_E_UP, NULL, NULL);
+	}
+	return NULL;
+}
+
+
+
+/* ------------------- tests -------------------------------------- */
+static void testPostFromAction(void)
+{
+	link = fsme_newEngine(LINK_MACHINE);
+	FSME_CHECK(NULL != link);
+	fsme_addTransitionAction(link, LINK_T_DOWN_TO_UP, onUp);
+	FSME_CHECK(FSME_OK == fsme_startEngine(link, NULL, NULL));
+
+	/* the engine is locked by the outer call: the inner one is refused */
+	FSME_CHECK(FSME_OK == fsme_postEventConcurrent(link, LINK_E_UP, NULL, NULL));
+	FSME_CHECK(1 == actionCount);
+	FSME_CHECK(FSME_ENGINE_FROZEN == postedInAction);
+	FSME_CHECK(LINK_S_UP == fsme_getCurrentStateId(link));
+
+	/* the same from fsme_postEvent() */
+	FSME_CHECK(FSME_OK == fsme_postEventConcurrent(link, LINK_E_DOWN, NULL, NULL));
+	postedInAction = FSME_OK;
+	FSME_CHECK(FSME_OK == fsme_postEvent(link, LINK_E_UP, NULL, NULL));
+	FSME_CHECK(2 == actionCount);
+	FSME_CHECK(FSME_ENGINE_FROZEN == postedInAction);
+
+	/* and the engine is not left locked */
+	FSME_CHECK(FSME_OK == fsme_postEventConcurrent(link, LINK_E_DOWN, NULL, NULL));
+	FSME_CHECK(LINK_S_DOWN == fsme_getCurrentStateId(link));
+
+	fsme_deleteEngine(link);
+	link = NULL;
+}
+
+
+static void testPostFromThreads(void)
+{
+	pthread_t threads[THREAD_NUM];
+	int state;
+	int i;
+
+	link = fsme_newEngine(LINK_MACHINE);
+	FSME_CHECK(NULL != link);
+	FSME_CHECK(FSME_OK == fsme_startEngine(link, NULL, NULL));
+
+	for (i = 0; i < THREAD_NUM; i++)
+	{
+		FSME_CHECK(0 == pthread_create(&threads[i], NULL, postEvents, NULL));
+	}
+	for (i = 0; i < THREAD_NUM; i++)
+	{
+		pthread_join(threads[i], NULL);
+	}
+
+	/* the engine is consistent and unlocked afterwards */
+	state = fsme_getCurrentStateId(link);
+	FSME_CHECK(LINK_S_DOWN == state || LINK_S_UP == state);
+	FSME_CHECK(FSME_OK == fsme_postEventConcurrent(link,
+			   (LINK_S_UP == state) ? LINK_E_DOWN : LINK_E_UP, NULL, NULL));
+
+	fsme_deleteEngine(link);
+	link = NULL;
+}
+
+
+int main()
+{
+	testPostFromAction();
+	testPostFromThreads();
+
+	return fsme_testResult();
+}
@@ -0,0 +1,460 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "fsm.h"
+#include "fsme_flatten.h"
+#include "fsme_minimize.h"
+#include "fsme_test.h"
+#include "groupcall_machine.h"
+
+
+/* ------------------- local macros ------------------------------- */
+#define SEQUENCE_NUM		64
+#define SEQUENCE_LENGTH		48
+#define TRACE_MAX			(SEQUENCE_LENGTH * 16)
+
+/* trace codes: kind * 1000 + id */
+#define TRACE_KIND			1000
+
+/* kinds of trace entries */
+#define KIND_START			1
+#define KIND_STATE_ENTRY	2
+#define KIND_STATE_EXIT		3
+#define KIND_TRANSITION		4
+#define KIND_SUB_ENTRY		5
+#define KIND_SUB_EXIT		6
+#define KIND_SUB_TRANSITION	7
+#define KIND_RESULT			8
+
+#define fsmeTestCode(kind, id)	((kind) * TRACE_KIND + (id))
+
+
+
+/* ------------------- local type definitions --------------------- */
+typedef struct
+{
+	int		codes[TRACE_MAX];
+	int		num;
+} trace_t;
+
+/* id maps of a minimized machine and its sub machine */
+typedef struct
+{
+	const int*	stateIdMap;
+	const int*	transitionIdMap;
+	const int*	subStateIdMap;
+	const int*	subTransitionIdMap;
+} id_maps_t;
+
+
+
+/* ------------------- local variables ---------------------------- */
+static trace_t* trace = NULL;
+
+
+
+/* ------------------- actions ------------------------------------ */
+static void traceCode(int code)
+{
+	if (trace->num < TRACE_MAX)
+	{
+		trace->codes[trace->num++] = code;
+	}
+}
+
+
+static void onStart(int id, const void* inContext, void* outContext)
+{
+	(void)inContext;
+	(void)outContext;
+	traceCode(fsmeTestCode(KIND_START, id));
+}
+
+
+static void onStateEntry(int id, const void* inContext, void* outContext)
+{
+	(void)inContext;
+	(void)outContext;
+	traceCode(fsmeTestCode(KIND_STATE_ENTRY, id));
+}
+
+
+static void onStateExit(int id, const void* inContext, void* outContext)
+{
+	(void)inContext;
+	(void)outContext;
+	traceCode(fsmeTestCode(KIND_STATE_EXIT, id));
+}
+
+
+static void onTransition(int id, const void* inContext, void* outContext)
+{
+	(void)inContext;
+	(void)outContext;
+	traceCode(fsmeTestCode(KIND_TRANSITION, id));
+}
+
+
+static void onSubEntry(int id, const void* inContext, void* outContext)
+{
+	(void)inContext;
+	(void)outContext;
+	traceCode(fsmeTestCode(KIND_SUB_ENTRY, id));
+}
+
+
+static void onSubExit(int id, const void* inContext, void* outContext)
+{
+	(void)inContext;
+	(void)outContext;
+	traceCode(fsmeTestCode(KIND_SUB_EXIT, id));
+}
+
+
+static void onSubTransition(int id, const void* inContext, void* outContext)
+{
+	(void)inContext;
+	(void)outContext;
+	traceCode(fsmeTestCode(KIND_SUB_TRANSITION, id));
+}
+
+
+static boolean affiliationGuard(int id, const void* inContext, void* outContext)
+{
+	(void)id;
+	(void)outContext;
+	return (*((const int*)inContext) ? TRUE : FALSE);
+}
+
+
+
+/* ------------------- helpers ------------------------------------ */
+/**
+ * The new id of the entry at index of a table, or
+ * the id itself without map.
+ */
+static int mapId(const int* idMap, int index, int id)
+{
+	return (NULL != idMap) ? idMap[index] : id;
+}
+
+
+/**
+ * Whether an id of a minimized machine already got
+ * its actions from an earlier entry of the table.
+ */
+static boolean isMapped(const int* idMap, int index)
+{
+	int i;
+
+	if (NULL == idMap)
+	{
+		return FALSE;
+	}
+	if (FSME_MINIMIZE_REMOVED == idMap[index])
+	{
+		return TRUE;
+	}
+	for (i = 0; i < index; i++)
+	{
+		if (idMap[i] == idMap[index])
+		{
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+
+static void addActions(fsme_engine_ptr_t engine,
+					   const fsm_machine_t* machine,
+					   const int* stateIdMap,
+					   const int* transitionIdMap,
+					   boolean isSub)
+{
+	int i;
+	int id;
+
+	if (!isSub)
+	{
+		fsme_addMachineEntryAction(engine, onStart);
+	}
+
+	for (i = 0; i < machine->stateNum; i++)
+	{
+		if (isMapped(stateIdMap, i))
+		{
+			continue;
+		}
+		id = mapId(stateIdMap, i, machine->stateTable[i].id);
+		fsme_addStateEntryAction(engine, id, isSub ? onSubEntry : onStateEntry);
+		fsme_addStateExitAction(engine, id, isSub ? onSubExit : onStateExit);
+	}
+
+	for (i = 0; i < machine->transitionNum; i++)
+	{
+		if (isMapped(transitionIdMap, i))
+		{
+			continue;
+		}
+		id = mapId(transitionIdMap, i, machine->transitionTable[i].id);
+		fsme_addTransitionAction(engine, id, isSub ? onSubTransition : onTransition);
+		if (!isSub && GROUPCALL_T_AFFILIATING_TO_AFFILIATED == machine->transitionTable[i].id)
+		{
+			fsme_setGuard(engine, id, affiliationGuard);
+		}
+	}
+}
+
+
+/**
+ * Map an id of the example machines to the id of
+ * their minimized machine. Their ids are the indexes
+ * in their tables.
+ */
+static int mapTableId(const int* idMap, int id)
+{
+	return (NULL != idMap) ? idMap[id] : id;
+}
+
+
+/**
+ * Rewrite a trace of the example machine with the ids
+ * of a minimized machine.
+ */
+static void mapTrace(trace_t* mapped, const trace_t* original, const id_maps_t* maps)
+{
+	int kind;
+	int id;
+	int i;
+
+	mapped->num = original->num;
+	for (i = 0; i < original->num; i++)
+	{
+		kind = original->codes[i] / TRACE_KIND;
+		id = original->codes[i] % TRACE_KIND;
+
+		switch (kind)
+		{
+			case KIND_STATE_ENTRY:
+			case KIND_STATE_EXIT:
+				id = mapTableId(maps->stateIdMap, id);
+				break;
+			case KIND_TRANSITION:
+				id = mapTableId(maps->transitionIdMap, id);
+				break;
+			case KIND_SUB_ENTRY:
+			case KIND_SUB_EXIT:
+				id = mapTableId(maps->subStateIdMap, id);
+				break;
+			case KIND_SUB_TRANSITION:
+				id = mapTableId(maps->subTransitionIdMap, id);
+				break;
+			default:
+				break;
+		}
+		mapped->codes[i] = fsmeTestCode(kind, id);
+	}
+}
+
+
+static boolean isSameTrace(const trace_t* first, const trace_t* second)
+{
+	return (first->num == second->num &&
+			0 == memcmp(first->codes, second->codes, sizeof(int) * first->num));
+}
+
+
+/**
+ * Post an event the way the example does: to the sub
+ * engine of the connected state while it is active,
+ * then to the engine if the sub engine does not take it.
+ */
+static fsme_return_t postEvent(fsme_engine_ptr_t engine,
+							   int connectedStateId,
+							   int event,
+							   const int* in)
+{
+	fsme_engine_ptr_t sub = NULL;
+	fsme_return_t ret = FSME_INVALID_EVENT;
+	int out = 0;
+
+	if (0 <= connectedStateId &&
+		connectedStateId == fsme_getCurrentStateId(engine))
+	{
+		sub = fsme_getSubEngine(engine, connectedStateId);
+	}
+	if (NULL != sub)
+	{
+		ret = fsme_postEvent(sub, event, in, &out);
+	}
+	if (FSME_INVALID_EVENT == ret)
+	{
+		ret = fsme_postEvent(engine, event, in, &out);
+	}
+	return ret;
+}
+
+
+/**
+ * Run a pseudo-random sequence of events on an engine.
+ * The flat engine is driven with a negative connected
+ * state id.
+ */
+static void runSequence(fsme_engine_ptr_t engine,
+						int connectedStateId,
+						int eventNum,
+						unsigned int seed,
+						trace_t* result)
+{
+	int in = 0;
+	int out = 0;
+	int i;
+
+	trace = result;
+	trace->num = 0;
+
+	fsme_resetEngine(engine, TRUE);
+	FSME_CHECK(FSME_OK == fsme_startEngine(engine, &in, &out));
+	for (i = 0; i < SEQUENCE_LENGTH; i++)
+	{
+		seed = seed * 1103515245 + 12345;
+		in = (int)((seed >> 8) & 1);
+		traceCode(fsmeTestCode(KIND_RESULT,
+			postEvent(engine, connectedStateId, (int)((seed >> 16) % eventNum), &in)));
+	}
+
+	trace = NULL;
+}
+
+
+
+/* ------------------- tests -------------------------------------- */
+static trace_t expected;
+static trace_t actual;
+static trace_t mapped;
+
+
+static void testFlatten(void)
+{
+	fsme_engine_ptr_t engine = fsme_newEngine(GROUPCALL_MACHINE);
+	fsme_engine_ptr_t flat = NULL;
+	unsigned int seed;
+
+	FSME_CHECK(NULL != engine);
+	addActions(engine, GROUPCALL_MACHINE, NULL, NULL, FALSE);
+	addActions(fsme_getSubEngine(engine, GROUPCALL_S_CONNECTED),
+			   CONNECTED_MACHINE, NULL, NULL, TRUE);
+
+	flat = fsme_newFlatEngine(engine);
+	FSME_CHECK(NULL != flat);
+
+	for (seed = 1; NULL != flat && seed <= SEQUENCE_NUM; seed++)
+	{
+		runSequence(engine, GROUPCALL_S_CONNECTED, GROUPCALL_EVENT_NUM, seed, &expected);
+		runSequence(flat, -1, GROUPCALL_EVENT_NUM, seed, &actual);
+		FSME_CHECK(isSameTrace(&expected, &actual));
+	}
+
+	fsme_deleteEngine(flat);
+	fsme_deleteEngine(engine);
+}
+
+
+static void testMinimize(void)
+{
+	int stateIdMap[sizeof(GROUPCALL_STATES)/sizeof(GROUPCALL_STATES[0])];
+	int transitionIdMap[sizeof(GROUPCALL_TRANSITIONS)/sizeof(GROUPCALL_TRANSITIONS[0])];
+	id_maps_t maps = { stateIdMap, transitionIdMap, NULL, NULL };
+	fsm_machine_t* machine = NULL;
+	fsme_engine_ptr_t engine = fsme_newEngine(GROUPCALL_MACHINE);
+	fsme_engine_ptr_t minimized = NULL;
+	unsigned int seed;
+
+	FSME_CHECK(NULL != engine);
+	addActions(engine, GROUPCALL_MACHINE, NULL, NULL, FALSE);
+	addActions(fsme_getSubEngine(engine, GROUPCALL_S_CONNECTED),
+			   CONNECTED_MACHINE, NULL, NULL, TRUE);
+
+	machine = fsme_minimizeMachine(GROUPCALL_MACHINE, NULL, FSME_MINIMIZE_MERGE,
+								   stateIdMap, transitionIdMap);
+	FSME_CHECK(NULL != machine);
+	if (NULL != machine)
+	{
+		minimized = fsme_newEngine(machine);
+		FSME_CHECK(NULL != minimized);
+	}
+
+	if (NULL != minimized)
+	{
+		addActions(minimized, GROUPCALL_MACHINE, stateIdMap, transitionIdMap, FALSE);
+		addActions(fsme_getSubEngine(minimized, stateIdMap[GROUPCALL_S_CONNECTED]),
+				   CONNECTED_MACHINE, NULL, NULL, TRUE);
+
+		for (seed = 1; seed <= SEQUENCE_NUM; seed++)
+		{
+			runSequence(engine, GROUPCALL_S_CONNECTED, GROUPCALL_EVENT_NUM, seed, &expected);
+			runSequence(minimized, stateIdMap[GROUPCALL_S_CONNECTED],
+						GROUPCALL_EVENT_NUM, seed, &actual);
+			mapTrace(&mapped, &expected, &maps);
+			FSME_CHECK(isSameTrace(&mapped, &actual));
+		}
+	}
+
+	fsme_deleteEngine(minimized);
+	fsme_deleteMinimizedMachine(machine);
+	fsme_deleteEngine(engine);
+}
+
+
+/* the connected machine has two equivalent states */
+static void testMinimizeMerge(void)
+{
+	int stateIdMap[sizeof(CONNECTED_STATES)/sizeof(CONNECTED_STATES[0])];
+	int transitionIdMap[sizeof(CONNECTED_TRANSITIONS)/sizeof(CONNECTED_TRANSITIONS[0])];
+	id_maps_t maps = { NULL, NULL, stateIdMap, transitionIdMap };
+	fsm_machine_t* machine = NULL;
+	fsme_engine_ptr_t engine = fsme_newEngine(CONNECTED_MACHINE);
+	fsme_engine_ptr_t minimized = NULL;
+	unsigned int seed;
+
+	FSME_CHECK(NULL != engine);
+	addActions(engine, CONNECTED_MACHINE, NULL, NULL, TRUE);
+
+	machine = fsme_minimizeMachine(CONNECTED_MACHINE, NULL, FSME_MINIMIZE_MERGE,
+								   stateIdMap, transitionIdMap);
+	FSME_CHECK(NULL != machine);
+	if (NULL != machine)
+	{
+		FSME_CHECK(machine->stateNum < CONNECTED_MACHINE->stateNum);
+		minimized = fsme_newEngine(machine);
+		FSME_CHECK(NULL != minimized);
+	}
+
+	if (NULL != minimized)
+	{
+		addActions(minimized, CONNECTED_MACHINE, stateIdMap, transitionIdMap, TRUE);
+
+		for (seed = 1; seed <= SEQUENCE_NUM; seed++)
+		{
+			runSequence(engine, -1, CONNECTED_EVENT_NUM, seed, &expected);
+			runSequence(minimized, -1, CONNECTED_EVENT_NUM, seed, &actual);
+			mapTrace(&mapped, &expected, &maps);
+			FSME_CHECK(isSameTrace(&mapped, &actual));
+		}
+	}
+
+	fsme_deleteEngine(minimized);
+	fsme_deleteMinimizedMachine(machine);
+	fsme_deleteEngine(engine);
+}
+
+
+int main()
+{
+	testFlatten();
+	testMinimize();
+	testMinimizeMerge();
+
+	return fsme_testResult();
+}
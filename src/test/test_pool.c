@@ -0,0 +1,164 @@
+#include <stdio.h>
+
+#include "fsm.h"
+#include "fsme_pool.h"
+#include "fsme_test.h"
+
+
+/*--------- machine --------------*/
+typedef enum
+{
+	POOL_S_IDLE,
+	POOL_S_BUSY
+} pool_state_t;
+
+typedef enum
+{
+	POOL_T_IDLE_TO_BUSY,
+	POOL_T_BUSY_TO_IDLE
+} pool_transition_t;
+
+typedef enum
+{
+	POOL_E_START = 0,
+	POOL_E_STOP
+} pool_event_t;
+#define POOL_EVENT_NUM 2
+
+static const fsm_state_t POOL_STATES[] =
+{
+	{ POOL_S_IDLE,	FALSE,	NULL },
+	{ POOL_S_BUSY,	FALSE,	NULL }
+};
+
+static const fsm_transition_t POOL_TRANSITIONS[] =
+{
+	{ POOL_T_IDLE_TO_BUSY,	POOL_S_IDLE,	POOL_S_BUSY },
+	{ POOL_T_BUSY_TO_IDLE,	POOL_S_BUSY,	POOL_S_IDLE }
+};
+
+static const fsm_trigger_t POOL_TRIGGERS[] =
+{
+	{ POOL_S_IDLE,	POOL_E_START,	POOL_T_IDLE_TO_BUSY },
+	{ POOL_S_BUSY,	POOL_E_STOP,	POOL_T_BUSY_TO_IDLE }
+};
+
+static const fsm_machine_t POOL_MACHINE[] =
+{
+	{
+		/* id */				1,
+		/* stateTable */		POOL_STATES,
+		/* stateNum */			sizeof(POOL_STATES)/sizeof(POOL_STATES[0]),
+		/* transitionTable */	POOL_TRANSITIONS,
+		/* transitionNum */		sizeof(POOL_TRANSITIONS)/sizeof(POOL_TRANSITIONS[0]),
+		/* eventNum */			POOL_EVENT_NUM,
+		/* triggerTable */		POOL_TRIGGERS,
+		/* triggerNum */		sizeof(POOL_TRIGGERS)/sizeof(POOL_TRIGGERS[0]),
+		/* entryState */		POOL_S_IDLE
+	}
+};
+
+
+
+/* ------------------- local variables ---------------------------- */
+static fsme_pool_ptr_t pool = NULL;
+static fsme_engine_ptr_t session = NULL;
+static fsme_return_t releasedInAction = FSME_OK;
+static int actionCount = 0;
+
+
+
+/* ------------------- actions ------------------------------------ */
+static void onStop(int id, const void* inContext, void* outContext)
+{
+	(void)id;
+	(void)inContext;
+	(void)outContext;
+
+	actionCount++;
+	releasedInAction = fsme_poolRelease(pool, session);
+}
+
+
+
+/* ------------------- tests -------------------------------------- */
+static void testAcquireRelease(fsme_engine_ptr_t prototype)
+{
+	fsme_engine_ptr_t engines[3];
+	int i;
+
+	pool = fsme_newPool(prototype, 2);
+	FSME_CHECK(NULL != pool);
+
+	/* the pool holds two engines, the third is cloned */
+	for (i = 0; i < 3; i++)
+	{
+		engines[i] = fsme_poolAcquire(pool);
+		FSME_CHECK(NULL != engines[i]);
+		FSME_CHECK(FSME_OK == fsme_startEngine(engines[i], NULL, NULL));
+		FSME_CHECK(FSME_OK == fsme_postEvent(engines[i], POOL_E_START, NULL, NULL));
+	}
+	FSME_CHECK(engines[0] != engines[1] && engines[1] != engines[2]);
+
+	/* the third engine given back does not fit and is deleted */
+	for (i = 0; i < 3; i++)
+	{
+		FSME_CHECK(FSME_OK == fsme_poolRelease(pool, engines[i]));
+	}
+
+	/* engines given back are reset */
+	session = fsme_poolAcquire(pool);
+	FSME_CHECK(session == engines[1]);
+	FSME_CHECK(FSME_OK == fsme_startEngine(session, NULL, NULL));
+	FSME_CHECK(POOL_S_IDLE == fsme_getCurrentStateId(session));
+	FSME_CHECK(FSME_OK == fsme_poolRelease(pool, session));
+
+	FSME_CHECK(FSME_FORBIDDEN == fsme_poolRelease(pool, NULL));
+	FSME_CHECK(FSME_FORBIDDEN == fsme_poolRelease(NULL, engines[0]));
+
+	fsme_deletePool(pool);
+	pool = NULL;
+}
+
+
+static void testReleaseFromAction(fsme_engine_ptr_t prototype)
+{
+	pool = fsme_newPool(prototype, 1);
+	FSME_CHECK(NULL != pool);
+
+	session = fsme_poolAcquire(pool);
+	FSME_CHECK(NULL != session);
+	FSME_CHECK(FSME_OK == fsme_startEngine(session, NULL, NULL));
+	FSME_CHECK(FSME_OK == fsme_postEvent(session, POOL_E_START, NULL, NULL));
+
+	/* the engine processing the event stays with the caller */
+	FSME_CHECK(FSME_OK == fsme_postEvent(session, POOL_E_STOP, NULL, NULL));
+	FSME_CHECK(1 == actionCount);
+	FSME_CHECK(FSME_FORBIDDEN == releasedInAction);
+	FSME_CHECK(POOL_S_IDLE == fsme_getCurrentStateId(session));
+	FSME_CHECK(FSME_OK == fsme_postEvent(session, POOL_E_START, NULL, NULL));
+
+	/* and can be given back once the event is processed */
+	FSME_CHECK(FSME_OK == fsme_poolRelease(pool, session));
+	FSME_CHECK(session == fsme_poolAcquire(pool));
+	FSME_CHECK(FSME_OK == fsme_poolRelease(pool, session));
+
+	fsme_deletePool(pool);
+	pool = NULL;
+}
+
+
+int main()
+{
+	fsme_engine_ptr_t prototype = fsme_newEngine(POOL_MACHINE);
+
+	FSME_CHECK(NULL != prototype);
+	fsme_addTransitionAction(prototype, POOL_T_BUSY_TO_IDLE, onStop);
+
+	testAcquireRelease(prototype);
+	testReleaseFromAction(prototype);
+
+	fsme_deleteEngine(prototype);
+
+	return fsme_testResult();
+}
@@ -0,0 +1,205 @@
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "fsm.h"
+#include "fsme_shm.h"
+#include "fsme_test.h"
+
+
+/*--------- machine --------------*/
+typedef enum
+{
+	SESSION_S_IDLE,
+	SESSION_S_BUSY
+} session_state_t;
+
+typedef enum
+{
+	SESSION_T_IDLE_TO_BUSY,
+	SESSION_T_BUSY_TO_IDLE
+} session_transition_t;
+
+typedef enum
+{
+	SESSION_E_START = 0,
+	SESSION_E_STOP
+} session_event_t;
+#define SESSION_EVENT_NUM 2
+
+static const fsm_state_t SESSION_STATES[] =
+{
+	{ SESSION_S_IDLE,	FALSE,	NULL },
+	{ SESSION_S_BUSY,	FALSE,	NULL }
+};
+
+static const fsm_transition_t SESSION_TRANSITIONS[] =
+{
+	{ SESSION_T_IDLE_TO_BUSY,	SESSION_S_IDLE,	SESSION_S_BUSY },
+	{ SESSION_T_BUSY_TO_IDLE,	SESSION_S_BUSY,	SESSION_S_IDLE }
+};
+
+static const fsm_trigger_t SESSION_TRIGGERS[] =
+{
+	{ SESSION_S_IDLE,	SESSION_E_START,	SESSION_T_IDLE_TO_BUSY },
+	{ SESSION_S_BUSY,	SESSION_E_STOP,		SESSION_T_BUSY_TO_IDLE }
+};
+
+static const fsm_machine_t SESSION_MACHINE[] =
+{
+	{
+		/* id */				1,
+		/* stateTable */		SESSION_STATES,
+		/* stateNum */			sizeof(SESSION_STATES)/sizeof(SESSION_STATES[0]),
+		/* transitionTable */	SESSION_TRANSITIONS,
+		/* transitionNum */		sizeof(SESSION_TRANSITIONS)/sizeof(SESSION_TRANSITIONS[0]),
+		/* eventNum */			SESSION_EVENT_NUM,
+		/* triggerTable */		SESSION_TRIGGERS,
+		/* triggerNum */		sizeof(SESSION_TRIGGERS)/sizeof(SESSION_TRIGGERS[0]),
+		/* entryState */		SESSION_S_IDLE
+	}
+};
+
+#define STORE_NAME_MAX		64
+#define ENGINE_NUM			2
+
+
+
+/* ------------------- local variables ---------------------------- */
+static fsme_shm_store_ptr_t store = NULL;
+static int actionCount = 0;
+static fsme_return_t postedInAction = FSME_OK;
+static fsme_return_t resetInAction = FSME_OK;
+
+
+
+/* ------------------- actions ------------------------------------ */
+static void onStart(int id, const void* inContext, void* outContext)
+{
+	(void)id;
+	(void)inContext;
+	(void)outContext;
+
+	actionCount++;
+	postedInAction = fsme_shmPostEvent(store, 0, SESSION_E_STOP, NULL, NULL);
+	resetInAction = fsme_shmResetEngine(store, 0);
+}
+
+
+
+/* ------------------- tests -------------------------------------- */
+static int getState(int index)
+{
+	int stateId = FSME_FINAL_STATE_ID;
+
+	if (1 != fsme_shmGetStatePath(store, index, &stateId, 1))
+	{
+		return FSME_FINAL_STATE_ID;
+	}
+	return stateId;
+}
+
+
+/**
+ * The child maps the store again and posts the event,
+ * its own actions run.
+ */
+static int runChild(const char* name, fsme_engine_ptr_t prototype)
+{
+	store = fsme_openShmStore(name, prototype);
+	FSME_CHECK(NULL != store);
+	if (NULL == store)
+	{
+		return 1;
+	}
+
+	FSME_CHECK(ENGINE_NUM == fsme_shmGetEngineNum(store));
+	FSME_CHECK(SESSION_S_IDLE == getState(0));
+	FSME_CHECK(FSME_OK == fsme_shmPostEvent(store, 0, SESSION_E_START, NULL, NULL));
+	FSME_CHECK(1 == actionCount);
+
+	/* an action cannot post to or reset its own engine */
+	FSME_CHECK(FSME_ENGINE_FROZEN == postedInAction);
+	FSME_CHECK(FSME_ENGINE_FROZEN == resetInAction);
+
+	/* the second engine is not started */
+	FSME_CHECK(FSME_FORBIDDEN == fsme_shmPostEvent(store, 1, SESSION_E_START, NULL, NULL));
+
+	fsme_closeShmStore(store);
+	return fsme_testResult();
+}
+
+
+static void testAcrossFork(fsme_engine_ptr_t prototype)
+{
+	char name[STORE_NAME_MAX];
+	pid_t child;
+	int status = 1;
+
+	snprintf(name, sizeof(name), "/fsme_test_shm_%d", (int)getpid());
+	fsme_unlinkShmStore(name);
+
+	store = fsme_newShmStore(name, prototype, ENGINE_NUM);
+	FSME_CHECK(NULL != store);
+	if (NULL == store)
+	{
+		return;
+	}
+
+	/* the engines of a new store are not started */
+	FSME_CHECK(FSME_FINAL_STATE_ID == getState(0));
+	FSME_CHECK(FSME_OK == fsme_shmStartEngine(store, 0, NULL, NULL));
+	FSME_CHECK(SESSION_S_IDLE == getState(0));
+
+	fflush(stdout);
+	child = fork();
+	FSME_CHECK(0 <= child);
+	if (0 == child)
+	{
+		status = runChild(name, prototype);
+		fflush(stdout);
+		_exit(status);
+	}
+	if (0 < child)
+	{
+		waitpid(child, &status, 0);
+		FSME_CHECK(WIFEXITED(status) && 0 == WEXITSTATUS(status));
+	}
+
+	/* the event posted by the child is in the store, its actions ran there */
+	FSME_CHECK(0 == actionCount);
+	FSME_CHECK(SESSION_S_BUSY == getState(0));
+	FSME_CHECK(FSME_OK == fsme_shmPostEvent(store, 0, SESSION_E_STOP, NULL, NULL));
+	FSME_CHECK(SESSION_S_IDLE == getState(0));
+	FSME_CHECK(FSME_OK == fsme_shmPostEvent(store, 0, SESSION_E_START, NULL, NULL));
+	FSME_CHECK(1 == actionCount);
+
+	/* a reset engine is not started, and can be started again */
+	FSME_CHECK(FSME_OK == fsme_shmResetEngine(store, 0));
+	FSME_CHECK(FSME_FINAL_STATE_ID == getState(0));
+	FSME_CHECK(FSME_FORBIDDEN == fsme_shmPostEvent(store, 0, SESSION_E_STOP, NULL, NULL));
+	FSME_CHECK(FSME_OK == fsme_shmStartEngine(store, 0, NULL, NULL));
+	FSME_CHECK(SESSION_S_IDLE == getState(0));
+
+	FSME_CHECK(FSME_ERROR_FATAL == fsme_shmPostEvent(store, ENGINE_NUM, SESSION_E_START, NULL, NULL));
+
+	fsme_closeShmStore(store);
+	store = NULL;
+	FSME_CHECK(fsme_unlinkShmStore(name));
+}
+
+
+int main()
+{
+	fsme_engine_ptr_t prototype = fsme_newEngine(SESSION_MACHINE);
+
+	FSME_CHECK(NULL != prototype);
+	fsme_addTransitionAction(prototype, SESSION_T_IDLE_TO_BUSY, onStart);
+
+	testAcrossFork(prototype);
+
+	fsme_deleteEngine(prototype);
+
+	return fsme_testResult();
+}